@@ -17,22 +17,437 @@
 #include <sstream>
 #include <algorithm>
 #include <map>
+#include <set>
+#include <unordered_map>
 #include <cmath>
+#include <cctype>
+#include <fstream>
+#include <cstring>
+#include <cstddef>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <optional>
+#include <csignal>
+#include <iterator>
+#include <random>
+#include <atomic>
+#include <memory>
+#include <new>
+#include <string_view>
+#include <charconv>
+#include <functional>
+#include <deque>
+#include <future>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 namespace fs = std::filesystem;
 
+// Build with -DADVISOR_STATS=0 to compile the instrumentation counters out
+#ifndef ADVISOR_STATS
+#define ADVISOR_STATS 1
+#endif
+
+// Set by CMake's ADVISOR_STATIC option; only picks the startup benchmark's default limit
+#ifndef ADVISOR_STATIC
+#define ADVISOR_STATIC 0
+#endif
+
+#if ADVISOR_STATS
+/**
+ * Process-wide heap allocation counters, fed by the replacement operator
+ * new below. The scan hot path is meant to stay off the heap, so a shared
+ * relaxed counter costs nothing measurable there.
+ */
+namespace AllocationStats {
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> bytes{0};
+}
+
+void* operator new(std::size_t size) {
+    AllocationStats::count.fetch_add(1, std::memory_order_relaxed);
+    AllocationStats::bytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* block = std::malloc(size == 0 ? 1 : size)) {
+        return block;
+    }
+    throw std::bad_alloc();
+}
+
+// Kept out of line: once inlined, GCC flags the free() of a new-ed pointer
+#if defined(__GNUC__)
+__attribute__((noinline))
+#endif
+void operator delete(void* block) noexcept {
+    std::free(block);
+}
+
+void operator delete(void* block, std::size_t) noexcept {
+    ::operator delete(block);
+}
+#endif
+
+// Bump an instrumentation counter; a no-op without ADVISOR_STATS
+#if ADVISOR_STATS
+#define ADVISOR_COUNT(counter) (++(counter))
+#else
+#define ADVISOR_COUNT(counter) ((void)0)
+#endif
+
+/**
+ * Heap allocations made by this process so far, 0 when built without stats
+ */
+uint64_t allocation_count() {
+#if ADVISOR_STATS
+    return AllocationStats::count.load(std::memory_order_relaxed);
+#else
+    return 0;
+#endif
+}
+
+/**
+ * Bytes requested from operator new so far, 0 when built without stats
+ */
+uint64_t allocated_bytes() {
+#if ADVISOR_STATS
+    return AllocationStats::bytes.load(std::memory_order_relaxed);
+#else
+    return 0;
+#endif
+}
+
+/**
+ * Nanosecond lap timer for instrumentation; empty without ADVISOR_STATS
+ */
+struct Stopwatch {
+#if ADVISOR_STATS
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    
+    /**
+     * Nanoseconds since construction or the previous lap
+     */
+    uint64_t lap() {
+        const auto now = std::chrono::steady_clock::now();
+        const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(now - start);
+        start = now;
+        return static_cast<uint64_t>(elapsed.count());
+    }
+#else
+    uint64_t lap() { return 0; }
+#endif
+};
+
 // ANSI Color Codes for terminal output
 namespace Color {
-    const std::string RESET = "\033[0m";
-    const std::string BOLD = "\033[1m";
-    const std::string RED = "\033[31m";
-    const std::string YELLOW = "\033[33m";
-    const std::string GREEN = "\033[32m";
-    const std::string BLUE = "\033[34m";
-    const std::string CYAN = "\033[36m";
-    const std::string MAGENTA = "\033[35m";
+    std::string_view RESET = "\033[0m";
+    std::string_view BOLD = "\033[1m";
+    std::string_view RED = "\033[31m";
+    std::string_view YELLOW = "\033[33m";
+    std::string_view GREEN = "\033[32m";
+    std::string_view BLUE = "\033[34m";
+    std::string_view CYAN = "\033[36m";
+    std::string_view MAGENTA = "\033[35m";
+    
+    /**
+     * Turn every code into an empty string, for output that is not a terminal
+     */
+    void disable() {
+        RESET = BOLD = RED = YELLOW = GREEN = BLUE = CYAN = MAGENTA = "";
+    }
 }
 
+/**
+ * Estimated number of files with one extension
+ */
+struct FileTypeCount {
+    std::string extension;
+    uint64_t count;  // never below the true count
+    uint64_t error;  // the true count is at least count - error
+};
+
+/**
+ * Files per extension, exact up to `capacity` distinct extensions.
+ *
+ * Past that the table turns into a Space-Saving heavy-hitter sketch: it
+ * keeps `capacity` counters in a min-heap and a new extension replaces the
+ * smallest one, inheriting its count as error. Counts stay upper bounds
+ * with a known error, and any extension holding more than 1/capacity of
+ * all files is guaranteed to be present, so the top of the distribution
+ * stays correct while memory no longer grows with the number of distinct
+ * "extensions" (content-addressed stores, random temp names and so on).
+ */
+class FileTypeCounter {
+public:
+    static constexpr size_t DEFAULT_CAPACITY = 4096;
+    
+    explicit FileTypeCounter(size_t capacity = DEFAULT_CAPACITY) : capacity_(std::max<size_t>(capacity, 1)) {}
+    
+    /**
+     * Lower the number of counters kept; takes effect at the next insertion
+     */
+    void set_capacity(size_t capacity) { capacity_ = std::max<size_t>(capacity, 1); }
+    
+    /**
+     * Count `count` files with extension `ext`; `error` carries the
+     * uncertainty of a count that came from another sketch
+     */
+    void add(std::string_view ext, uint64_t count = 1, uint64_t error = 0) {
+        // Look up through a reused key so counting a known extension never allocates
+        key_.assign(ext);
+        auto it = index_.find(key_);
+        if (it != index_.end()) {
+            slots_[it->second].count += count;
+            slots_[it->second].error += error;
+            if (sketch_) {
+                sift_down(it->second);
+            }
+            return;
+        }
+        
+        if (!sketch_ && slots_.size() < capacity_) {
+            insert_index(slots_.size());
+            slots_.push_back({key_, count, error});
+            return;
+        }
+        
+        if (!sketch_) {
+            become_sketch();
+        }
+        // Replace the smallest counter; the newcomer may have had that many before
+        FileTypeCount& min = slots_.front();
+        const uint64_t floor = min.count;
+        spare_.push_back(index_.extract(min.extension));
+        min = {key_, floor + count, floor + error};
+        insert_index(0);
+        sift_down(0);
+    }
+    
+    /**
+     * Fold in another counter (a worker's partial table)
+     */
+    void merge(const FileTypeCounter& other) {
+        if (other.sketch_ && !other.slots_.empty()) {
+            // Extensions the other sketch dropped may each have had up to its minimum
+            const uint64_t floor = other.slots_.front().count;
+            for (auto& slot : slots_) {
+                if (other.index_.count(slot.extension) == 0) {
+                    slot.count += floor;
+                    slot.error += floor;
+                }
+            }
+        }
+        for (const auto& slot : other.slots_) {
+            add(slot.extension, slot.count, slot.error);
+        }
+        if (other.sketch_ && !sketch_) {
+            become_sketch();
+        }
+    }
+    
+    /**
+     * The k extensions with the highest counts, largest first
+     */
+    std::vector<FileTypeCount> top(size_t k) const {
+        std::vector<FileTypeCount> sorted(slots_);
+        k = std::min(k, sorted.size());
+        std::partial_sort(sorted.begin(), sorted.begin() + static_cast<std::ptrdiff_t>(k), sorted.end(),
+            [](const FileTypeCount& a, const FileTypeCount& b) { return a.count > b.count; });
+        sorted.resize(k);
+        return sorted;
+    }
+    
+    /**
+     * All counters, in no particular order
+     */
+    const std::vector<FileTypeCount>& entries() const { return slots_; }
+    
+    /**
+     * Reload counters saved from entries() of a counter in the given mode
+     */
+    void restore(std::vector<FileTypeCount> entries, bool approximate) {
+        slots_ = std::move(entries);
+        sketch_ = approximate;
+        reindex();
+    }
+    
+    /**
+     * Drop all counts but keep the storage, so a table that is refilled
+     * over and over (a worker's per-unit table) stops allocating
+     */
+    void clear() {
+        while (!index_.empty()) {
+            spare_.push_back(index_.extract(index_.begin()));
+        }
+        slots_.clear();
+        sketch_ = false;
+    }
+    
+    bool empty() const { return slots_.empty(); }
+    size_t size() const { return slots_.size(); }
+    
+    /**
+     * True once the table has overflowed and counts carry error bounds
+     */
+    bool approximate() const { return sketch_; }
+    
+private:
+    /**
+     * Keep the `capacity_` largest exact counts and switch to sketch mode
+     */
+    void become_sketch() {
+        // Every dropped extension had at most the smallest kept count, which
+        // is exactly the Space-Saving invariant
+        if (slots_.size() > capacity_) {
+            std::nth_element(slots_.begin(), slots_.begin() + static_cast<std::ptrdiff_t>(capacity_ - 1),
+                slots_.end(), [](const FileTypeCount& a, const FileTypeCount& b) { return a.count > b.count; });
+            slots_.resize(capacity_);
+        }
+        sketch_ = true;
+        reindex();
+    }
+    
+    /**
+     * Rebuild the min-heap and the extension index from scratch
+     */
+    void reindex() {
+        if (sketch_) {
+            std::make_heap(slots_.begin(), slots_.end(),
+                [](const FileTypeCount& a, const FileTypeCount& b) { return a.count > b.count; });
+        }
+        index_.clear();
+        for (size_t i = 0; i < slots_.size(); i++) {
+            index_[slots_[i].extension] = i;
+        }
+    }
+    
+    /**
+     * Map key_ to slot `slot`, reusing a node released by clear() if any
+     */
+    void insert_index(size_t slot) {
+        if (spare_.empty()) {
+            index_.emplace(key_, slot);
+            return;
+        }
+        auto node = std::move(spare_.back());
+        spare_.pop_back();
+        node.key() = key_;
+        node.mapped() = slot;
+        index_.insert(std::move(node));
+    }
+    
+    /**
+     * Restore the min-heap property after slots_[i].count grew
+     */
+    void sift_down(size_t i) {
+        const size_t n = slots_.size();
+        for (;;) {
+            size_t smallest = i;
+            for (size_t child = 2 * i + 1; child <= 2 * i + 2 && child < n; child++) {
+                if (slots_[child].count < slots_[smallest].count) {
+                    smallest = child;
+                }
+            }
+            if (smallest == i) {
+                return;
+            }
+            std::swap(slots_[i], slots_[smallest]);
+            index_[slots_[i].extension] = i;
+            index_[slots_[smallest].extension] = smallest;
+            i = smallest;
+        }
+    }
+    
+    size_t capacity_;
+    bool sketch_ = false;
+    std::vector<FileTypeCount> slots_;               // a min-heap on count in sketch mode
+    std::unordered_map<std::string, size_t> index_;  // extension -> slot
+    std::string key_;                                // lookup buffer for add()
+    std::vector<std::unordered_map<std::string, size_t>::node_type> spare_;  // index nodes kept for reuse
+};
+
+/**
+ * How much a protected path matters, in increasing order
+ */
+enum class Severity : uint8_t { Notice, Warning, Critical };
+
+/**
+ * Where a protected path sits relative to an rm -rf target
+ */
+enum class Protection : uint8_t {
+    Is,        // the target itself is protected
+    Contains,  // a protected directory lies inside the target
+    Under      // the target lies inside a protected directory
+};
+
+/**
+ * A protection rule that applies to an rm -rf target
+ */
+struct ProtectedMatch {
+    Protection relation;
+    Severity severity;
+    std::string pattern;
+    std::string path;    // the protected directory (the shallowest one for Contains)
+    uint64_t count = 1;  // directories matched, for Contains
+};
+
+/**
+ * One high-value file or directory found by a scan
+ */
+struct SensitiveSample {
+    std::string path;
+    std::string note;  // for repositories: whether the current branch is pushed
+};
+
+/**
+ * High-value files of one kind found by a scan
+ */
+struct SensitiveFinding {
+    std::string category;
+    uint64_t count = 0;
+    std::vector<SensitiveSample> samples;  // the shallowest few
+};
+
+// Paths kept per kind of sensitive file
+constexpr size_t SENSITIVE_SAMPLES = 5;
+
+/**
+ * Totals of one target of a multi-target rm -rf
+ */
+struct TargetTotals {
+    std::string path;
+    uint64_t files = 0;
+    uint64_t directories = 0;
+    uint64_t bytes = 0;
+    std::string skipped;  // why it was not scanned on its own: inside another target, or unreadable
+};
+
+/**
+ * An rm -rf operand that was a glob or brace pattern, and what it matched
+ */
+struct PatternExpansion {
+    std::string pattern;
+    uint64_t matches = 0;
+    uint64_t directories_read = 0;
+    double elapsed = 0;  // seconds
+};
+
 /**
  * Structure to hold file analysis results
  */
@@ -42,39 +457,383 @@ struct AnalysisResult {
     uintmax_t total_size = 0;
     uintmax_t largest_file_size = 0;
     std::string largest_file_path;
-    std::map<std::string, size_t> file_types;
+    FileTypeCounter file_types;
+    bool over_limit = false;  // stopped at a --block-over threshold; totals are partial
+    std::vector<ProtectedMatch> protected_paths;  // when scanned with a ProtectionPolicy
+    bool blocked_by_policy = false;  // a Critical rule matched the target or inside it; totals are partial
+    std::vector<SensitiveFinding> sensitive;  // by category, in SensitiveKind order
+    std::vector<TargetTotals> targets;        // per target when several were analyzed together
+    std::vector<PatternExpansion> patterns;   // operands expanded before the analysis
+};
+
+/**
+ * Order in which the scanner visits directory entries.
+ *
+ * Readdir walks entries in the order the kernel returns them. InodeOrder
+ * sorts each directory's entries by inode number before stat-ing them and
+ * visits pending subdirectories lowest-inode first, which turns the random
+ * seeks of a readdir-order walk into a mostly forward sweep on rotational
+ * disks. Auto picks InodeOrder when the target lives on a rotational device.
+ */
+enum class TraversalPolicy {
+    Auto,
+    Readdir,
+    InodeOrder
+};
+
+/**
+ * Limits that keep a scan from hurting other workloads on the host
+ */
+struct GovernorOptions {
+    bool enabled = false;          // idle I/O class, nice 19, PSI-adaptive concurrency
+    unsigned max_iops = 0;         // filesystem calls per second, 0 = unlimited
+    unsigned max_cpu_percent = 0;  // percent of one core, 0 = unlimited
+};
+
+class Vfs;
+class ProtectionPolicy;
+class FindProgram;
+
+/**
+ * Committed totals of a scan still in progress
+ */
+struct ScanProgress {
+    uint64_t elapsed_ms = 0;
+    uint64_t files = 0;
+    uint64_t directories = 0;
+    uint64_t bytes = 0;
+    uint64_t queued = 0;  // directories waiting on the frontier
+};
+
+/**
+ * Tunables for analyze_folder()
+ */
+struct ScanOptions {
+    TraversalPolicy traversal = TraversalPolicy::Auto;
+    unsigned jobs = 0;  // worker threads, 0 = pick automatically
+    GovernorOptions governor;
+    std::string history_file;  // subtree sizes from earlier scans, "" = disabled
+    std::string checkpoint_file;  // periodically persist progress here
+    std::string resume_file;      // continue a scan from this checkpoint
+    unsigned checkpoint_interval = 5;  // seconds between checkpoints
+    uint64_t max_memory = 0;           // bytes, 0 = unbounded
+    const Vfs* filesystem = nullptr;   // scan this instead of the host filesystem
+    std::string record_file;           // save every listing and stat result seen
+    std::string replay_file;           // scan a recording instead of the filesystem
+    std::chrono::microseconds replay_latency{0};  // added to every replayed call
+    std::string trace_file;            // write a Chrome trace of the scan here
+    std::chrono::microseconds trace_threshold{100};  // shortest span recorded
+    std::function<void(const ScanProgress&)> progress;  // called periodically while scanning
+    std::chrono::milliseconds progress_interval{1000};
+    const std::atomic<bool>* cancel = nullptr;  // stop early, with partial totals, once set
+    uint64_t stop_over_bytes = 0;  // stop once more than this many bytes were seen, 0 = never
+    uint64_t stop_over_files = 0;  // stop once more than this many files were seen, 0 = never
+    const ProtectionPolicy* protection = nullptr;  // report protected paths; stop at a Critical one
+    const FindProgram* find = nullptr;  // count only what this find expression deletes
+};
+
+/**
+ * Filesystem calls made by the scanner, by kind
+ */
+struct SyscallCounts {
+    uint64_t open = 0;
+    uint64_t getdents = 0;  // readdir() calls where getdents64 is not used
+    uint64_t stat = 0;
+    uint64_t close = 0;
+    
+    uint64_t total() const { return open + getdents + stat + close; }
+    
+    SyscallCounts& operator+=(const SyscallCounts& other) {
+        open += other.open;
+        getdents += other.getdents;
+        stat += other.stat;
+        close += other.close;
+        return *this;
+    }
+};
+
+/**
+ * Wall and CPU time spent in one phase of an analysis, in seconds
+ */
+struct PhaseStats {
+    double wall = 0.0;
+    double user = 0.0;    // CPU in advisor itself, all threads
+    double system = 0.0;  // CPU in the kernel on advisor's behalf
+    
+    PhaseStats& operator-=(const PhaseStats& other) {
+        wall -= other.wall;
+        user -= other.user;
+        system -= other.system;
+        return *this;
+    }
+};
+
+/**
+ * Stages of an analysis timed by --stats
+ */
+enum class Phase { Scan, Aggregate, Sort, Render, Count };
+
+/**
+ * How one scanner thread spent the scan
+ */
+struct ThreadStats {
+    uint64_t busy_ns = 0;  // scanning directories
+    uint64_t idle_ns = 0;  // waiting for work
+    uint64_t cpu_ns = 0;
+    uint64_t units = 0;    // frontier directories taken
+    uint64_t steals = 0;   // ... of which another worker had queued
+};
+
+/**
+ * Instrumentation filled in by analyze_folder() and display_analysis() on
+ * request; all zero when built without ADVISOR_STATS
+ */
+struct ScanStats {
+    unsigned jobs = 0;
+    uint64_t entries = 0;
+    SyscallCounts syscalls;
+    uint64_t allocations = 0;
+    uint64_t allocated_bytes = 0;
+    PhaseStats phases[static_cast<size_t>(Phase::Count)];
+    std::vector<ThreadStats> threads;
+    
+    PhaseStats& phase(Phase which) { return phases[static_cast<size_t>(which)]; }
+    const PhaseStats& phase(Phase which) const { return phases[static_cast<size_t>(which)]; }
+};
+
+/**
+ * Measures a PhaseStats from construction to elapsed(); does nothing
+ * without ADVISOR_STATS
+ */
+class PhaseTimer {
+public:
+#if ADVISOR_STATS
+    PhaseTimer() : wall_(std::chrono::steady_clock::now()) { ::getrusage(RUSAGE_SELF, &usage_); }
+    
+    PhaseStats elapsed() const {
+        struct rusage now{};
+        ::getrusage(RUSAGE_SELF, &now);
+        auto seconds = [](const timeval& tv) { return static_cast<double>(tv.tv_sec) + tv.tv_usec / 1e6; };
+        return {std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_).count(),
+                seconds(now.ru_utime) - seconds(usage_.ru_utime),
+                seconds(now.ru_stime) - seconds(usage_.ru_stime)};
+    }
+    
+private:
+    std::chrono::steady_clock::time_point wall_;
+    struct rusage usage_{};
+#else
+    PhaseStats elapsed() const { return {}; }
+#endif
+};
+
+/**
+ * How results are written to stdout
+ */
+enum class OutputFormat {
+    Text,    // colored report for people
+    Json,    // one JSON document
+    Ndjson   // progress records during the scan, then the result, one per line
+};
+
+/**
+ * Advisor-wide options given before the command to analyze
+ */
+struct AdvisorOptions {
+    ScanOptions scan;
+    bool stats = false;  // print where the analysis spent its time
+    OutputFormat format = OutputFormat::Text;
+    std::string command_line;  // shell command line to analyze instead of argv
+    bool serve_stdio = false;  // answer NDJSON requests from stdin
+    bool confirm = false;      // ask before an rm -rf; exit 2 unless confirmed
+    std::shared_ptr<const ProtectionPolicy> protection;  // what scan.protection points at
+};
+
+/**
+ * Short formatted number held in place, so report lines can be built
+ * without heap-allocated strings
+ */
+struct NumberText {
+    char data[32];
+    size_t size = 0;
+    
+    operator std::string_view() const { return {data, size}; }
+    
+    void append(std::string_view text) {
+        std::memcpy(data + size, text.data(), text.size());
+        size += text.size();
+    }
+    
+    void append(uint64_t value) {
+        size = static_cast<size_t>(std::to_chars(data + size, data + sizeof(data), value).ptr - data);
+    }
 };
 
+inline std::ostream& operator<<(std::ostream& out, const NumberText& text) {
+    return out << std::string_view(text);
+}
+
+/**
+ * Format a count with thousands separators (1,247)
+ */
+NumberText format_count(uint64_t value) {
+    char digits[24];
+    const auto length = static_cast<size_t>(std::to_chars(digits, digits + sizeof(digits), value).ptr - digits);
+    NumberText text;
+    for (size_t i = 0; i < length; i++) {
+        if (i > 0 && (length - i) % 3 == 0) {
+            text.data[text.size++] = ',';
+        }
+        text.data[text.size++] = digits[i];
+    }
+    return text;
+}
+
+/**
+ * Convert bytes to human-readable format (KB, MB, GB, TB) with two
+ * decimals, using integer arithmetic only
+ */
+NumberText format_size(uintmax_t bytes) {
+    static const char* const units[] = {" B", " KB", " MB", " GB", " TB"};
+    size_t unit_index = 0;
+    uint64_t divisor = 1;
+    while (unit_index < 4 && bytes / divisor >= 1024) {
+        divisor *= 1024;
+        unit_index++;
+    }
+    
+    // Round half to even, as printf("%.2f") does for the exact quotient
+    uint64_t whole = bytes / divisor;
+    const uint64_t scaled = (bytes % divisor) * 100;
+    uint64_t hundredths = scaled / divisor;
+    const uint64_t remainder = scaled % divisor;
+    if (remainder * 2 > divisor || (remainder * 2 == divisor && hundredths % 2 == 1)) {
+        hundredths++;
+    }
+    if (hundredths == 100) {
+        whole++;
+        hundredths = 0;
+    }
+    NumberText text;
+    text.append(whole);
+    text.append(hundredths < 10 ? ".0" : ".");
+    text.append(hundredths);
+    text.append(units[unit_index]);
+    return text;
+}
+
 /**
  * Convert bytes to human-readable format (KB, MB, GB, TB)
  */
 std::string format_bytes(uintmax_t bytes) {
-    const char* units[] = {"B", "KB", "MB", "GB", "TB"};
-    int unit_index = 0;
-    double size = static_cast<double>(bytes);
+    return std::string(format_size(bytes));
+}
+
+/**
+ * Get file extension from a file name, with the same rules as
+ * std::filesystem::path::extension() but without building a path
+ */
+std::string_view get_extension(std::string_view name) {
+    const size_t dot = name.rfind('.');
+    if (dot == std::string_view::npos || dot == 0 || name == "..") {
+        return "[no extension]";
+    }
+    return name.substr(dot);
+}
+
+/**
+ * Fixed buffer installed behind std::cout for the life of main().
+ *
+ * A report is a few dozen short insertions; collecting them here sends the
+ * whole thing out with one write() instead of one per line (or per
+ * insertion, with cout synced to stdio). The buffer is only drained early
+ * when it fills, before an error message, or by flush_if_interactive().
+ */
+class StdoutBuffer : public std::streambuf {
+public:
+    StdoutBuffer() : previous_(std::cout.rdbuf(this)) {
+        setp(buffer_, buffer_ + sizeof(buffer_));
+    }
     
-    while (size >= 1024.0 && unit_index < 4) {
-        size /= 1024.0;
-        unit_index++;
+    ~StdoutBuffer() override {
+        drain();
+        std::cout.rdbuf(previous_);
     }
     
-    std::ostringstream oss;
-    oss << std::fixed << std::setprecision(2) << size << " " << units[unit_index];
-    return oss.str();
+    StdoutBuffer(const StdoutBuffer&) = delete;
+    StdoutBuffer& operator=(const StdoutBuffer&) = delete;
+    
+protected:
+    int sync() override {
+        drain();
+        return 0;
+    }
+    
+    int_type overflow(int_type c) override {
+        drain();
+        if (!traits_type::eq_int_type(c, traits_type::eof())) {
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+    
+    std::streamsize xsputn(const char* data, std::streamsize size) override {
+        std::streamsize done = 0;
+        while (done < size) {
+            if (pptr() == epptr()) {
+                drain();
+            }
+            const std::streamsize chunk = std::min<std::streamsize>(size - done, epptr() - pptr());
+            std::memcpy(pptr(), data + done, static_cast<size_t>(chunk));
+            pbump(static_cast<int>(chunk));
+            done += chunk;
+        }
+        return size;
+    }
+    
+private:
+    void drain() {
+        const char* data = pbase();
+        while (data < pptr()) {
+            const ssize_t written = ::write(STDOUT_FILENO, data, static_cast<size_t>(pptr() - data));
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            if (written <= 0) {
+                break;
+            }
+            data += written;
+        }
+        setp(buffer_, buffer_ + sizeof(buffer_));
+    }
+    
+    std::streambuf* previous_;
+    char buffer_[64 * 1024];
+};
+
+/**
+ * True when stdout is a terminal (cached)
+ */
+bool stdout_is_terminal() {
+    static const bool terminal = ::isatty(STDOUT_FILENO) == 1;
+    return terminal;
 }
 
 /**
- * Get file extension from path
+ * Show what has been printed so far before a long operation, when someone
+ * is watching; pipes and files still get a single write
  */
-std::string get_extension(const fs::path& path) {
-    std::string ext = path.extension().string();
-    return ext.empty() ? "[no extension]" : ext;
+void flush_if_interactive() {
+    if (stdout_is_terminal()) {
+        std::cout.flush();
+    }
 }
 
 /**
  * Print a formatted header
  */
-void print_header(const std::string& title) {
+void print_header(std::string_view title) {
     std::cout << "\n" << Color::BOLD << Color::CYAN 
               << "╔════════════════════════════════════════════════════════════════╗\n"
               << "║ " << std::left << std::setw(62) << title << " ║\n"
@@ -82,10 +841,17 @@ void print_header(const std::string& title) {
               << Color::RESET << "\n\n";
 }
 
+/**
+ * Print a horizontal rule the width of a header box
+ */
+void print_separator() {
+    std::cout << "────────────────────────────────────────────────────────────────\n";
+}
+
 /**
  * Print a warning message
  */
-void print_warning(const std::string& message) {
+void print_warning(std::string_view message) {
     std::cout << Color::BOLD << Color::YELLOW << "⚠️  WARNING: " 
               << Color::RESET << Color::YELLOW << message << Color::RESET << "\n";
 }
@@ -93,241 +859,9022 @@ void print_warning(const std::string& message) {
 /**
  * Print an error message
  */
-void print_error(const std::string& message) {
+void print_error(std::string_view message) {
+    // Keep buffered stdout ahead of the error when both go to one terminal
+    std::cout.flush();
     std::cerr << Color::BOLD << Color::RED << "❌ ERROR: " 
               << Color::RESET << Color::RED << message << Color::RESET << "\n";
 }
 
 /**
- * Print an info message
+ * Print an info message
+ */
+void print_info(std::string_view label, std::string_view value) {
+    std::cout << Color::BOLD << "  " << std::left << std::setw(20) << label << ": " 
+              << Color::RESET << value << "\n";
+}
+
+/**
+ * Streaming JSON writer for machine-readable output.
+ *
+ * Output is built in a fixed buffer that is handed to write() whenever it
+ * fills and at flush(); numbers go through std::to_chars, so writing a
+ * document never allocates. Commas are inserted automatically.
+ */
+class JsonWriter {
+public:
+    explicit JsonWriter(int fd = STDOUT_FILENO) : fd_(fd) {}
+    ~JsonWriter() { flush(); }
+    
+    JsonWriter(const JsonWriter&) = delete;
+    JsonWriter& operator=(const JsonWriter&) = delete;
+    
+    JsonWriter& begin_object() { return open('{'); }
+    JsonWriter& end_object() { return close('}'); }
+    JsonWriter& begin_array() { return open('['); }
+    JsonWriter& end_array() { return close(']'); }
+    
+    /**
+     * Name the next value of the current object
+     */
+    JsonWriter& key(std::string_view name) {
+        separate();
+        string(name);
+        put(':');
+        after_key_ = true;
+        return *this;
+    }
+    
+    JsonWriter& value(uint64_t number) {
+        separate();
+        char digits[24];
+        const auto end = std::to_chars(digits, digits + sizeof(digits), number).ptr;
+        append(digits, static_cast<size_t>(end - digits));
+        return *this;
+    }
+    
+    JsonWriter& value(std::string_view text) {
+        separate();
+        string(text);
+        return *this;
+    }
+    
+    JsonWriter& value(const char* text) { return value(std::string_view(text)); }
+    
+    JsonWriter& value(bool flag) {
+        separate();
+        append(flag ? "true" : "false", flag ? 4 : 5);
+        return *this;
+    }
+    
+    /**
+     * A fractional number with `precision` digits after the point; null
+     * when it is not finite
+     */
+    JsonWriter& value(double number, int precision) {
+        separate();
+        char digits[352];
+        const auto result = std::to_chars(digits, digits + sizeof(digits), number, std::chars_format::fixed, precision);
+        if (!std::isfinite(number) || result.ec != std::errc()) {
+            append("null", 4);
+        } else {
+            append(digits, static_cast<size_t>(result.ptr - digits));
+        }
+        return *this;
+    }
+    
+    JsonWriter& null() {
+        separate();
+        append("null", 4);
+        return *this;
+    }
+    
+    /**
+     * A value that is already valid JSON, written as is
+     */
+    JsonWriter& raw(std::string_view json) {
+        separate();
+        append(json.data(), json.size());
+        return *this;
+    }
+    
+    /**
+     * End a top-level record with a newline and push it out, so NDJSON
+     * readers see each record as soon as it is complete
+     */
+    void end_record() {
+        put('\n');
+        flush();
+        first_[0] = true;
+    }
+    
+    void flush() {
+        // Anything already printed through std::cout goes first
+        std::cout.flush();
+        size_t done = 0;
+        while (done < used_) {
+            const ssize_t written = ::write(fd_, buffer_ + done, used_ - done);
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            if (written <= 0) {
+                failed_ = true;
+                break;
+            }
+            done += static_cast<size_t>(written);
+        }
+        used_ = 0;
+    }
+    
+    /**
+     * False once a write() has failed
+     */
+    bool ok() const { return !failed_; }
+    
+private:
+    static constexpr size_t MAX_DEPTH = 32;
+    
+    JsonWriter& open(char bracket) {
+        separate();
+        put(bracket);
+        if (depth_ + 1 < MAX_DEPTH) {
+            depth_++;
+        }
+        first_[depth_] = true;
+        return *this;
+    }
+    
+    JsonWriter& close(char bracket) {
+        if (depth_ > 0) {
+            depth_--;
+        }
+        put(bracket);
+        return *this;
+    }
+    
+    /**
+     * Comma before every element but the first, except right after a key
+     */
+    void separate() {
+        if (after_key_) {
+            after_key_ = false;
+            return;
+        }
+        if (!first_[depth_]) {
+            put(',');
+        }
+        first_[depth_] = false;
+    }
+    
+    void string(std::string_view text) {
+        static const char hex[] = "0123456789abcdef";
+        put('"');
+        for (const char c : text) {
+            const auto byte = static_cast<unsigned char>(c);
+            if (c == '"' || c == '\\') {
+                put('\\');
+                put(c);
+            } else if (byte < 0x20) {
+                const char escaped[] = {'\\', 'u', '0', '0', hex[byte >> 4], hex[byte & 0xf]};
+                append(escaped, sizeof(escaped));
+            } else {
+                put(c);
+            }
+        }
+        put('"');
+    }
+    
+    void put(char c) {
+        if (used_ == sizeof(buffer_)) {
+            flush();
+        }
+        buffer_[used_++] = c;
+    }
+    
+    void append(const char* data, size_t size) {
+        for (size_t i = 0; i < size; i++) {
+            put(data[i]);
+        }
+    }
+    
+    int fd_;
+    char buffer_[16384];
+    size_t used_ = 0;
+    bool first_[MAX_DEPTH] = {true};
+    size_t depth_ = 0;
+    bool after_key_ = false;
+    bool failed_ = false;
+};
+
+/**
+ * Write one JSON document to `file` with write(JsonWriter&)
+ */
+template <typename Write>
+void write_json_file(const std::string& file, const Write& write) {
+    const int fd = ::open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot write " + file + ": " + std::strerror(errno));
+    }
+    bool ok = false;
+    {
+        JsonWriter json(fd);
+        write(json);
+        json.flush();
+        ok = json.ok();
+    }
+    ::close(fd);
+    if (!ok) {
+        throw std::runtime_error("Cannot write " + file);
+    }
+}
+
+/**
+ * Parse a --format value
+ */
+OutputFormat parse_output_format(const std::string& value) {
+    if (value == "text") return OutputFormat::Text;
+    if (value == "json") return OutputFormat::Json;
+    if (value == "ndjson") return OutputFormat::Ndjson;
+    throw std::runtime_error("Unknown output format: " + value + " (expected text, json or ndjson)");
+}
+
+/**
+ * Parse a --traversal value
+ */
+TraversalPolicy parse_traversal_policy(const std::string& value) {
+    if (value == "auto") return TraversalPolicy::Auto;
+    if (value == "readdir") return TraversalPolicy::Readdir;
+    if (value == "inode") return TraversalPolicy::InodeOrder;
+    throw std::runtime_error("Unknown traversal policy: " + value + " (expected auto, readdir or inode)");
+}
+
+/**
+ * Check whether the block device backing a path is rotational.
+ *
+ * Reads /sys/dev/block/MAJ:MIN/queue/rotational, falling back to the parent
+ * device for partitions. Returns false when the answer cannot be determined.
+ */
+bool is_rotational_device(const std::string& path) {
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0) {
+        return false;
+    }
+    
+    const std::string base = "/sys/dev/block/" + std::to_string(major(st.st_dev)) + ":" +
+                             std::to_string(minor(st.st_dev));
+    for (const char* candidate : {"/queue/rotational", "/../queue/rotational"}) {
+        std::ifstream in(base + candidate);
+        int rotational = 0;
+        if (in >> rotational) {
+            return rotational != 0;
+        }
+    }
+    return false;
+}
+
+/**
+ * Resolve TraversalPolicy::Auto for a concrete scan root
+ */
+TraversalPolicy resolve_traversal_policy(TraversalPolicy policy, const std::string& path) {
+    if (policy != TraversalPolicy::Auto) {
+        return policy;
+    }
+    return is_rotational_device(path) ? TraversalPolicy::InodeOrder : TraversalPolicy::Readdir;
+}
+
+/**
+ * Fixed-size slab that DirNodes are bump-allocated from
+ */
+struct ArenaBlock {
+    static constexpr size_t BYTES = 64 * 1024 - 64;
+    
+    std::atomic<uint32_t> live{1};  // nodes still referenced, plus one while an arena allocates from it
+    size_t used = 0;
+    alignas(std::max_align_t) char data[BYTES];
+};
+
+/**
+ * A directory of the tree being scanned: its own name plus a pointer to
+ * its parent, so queueing a directory copies one name rather than the whole
+ * path. Full paths are rebuilt with append_path() only when a directory is
+ * opened or reported.
+ *
+ * Nodes are reference counted: one reference while the directory is queued
+ * or being scanned, one per live child and one per holder of a reported
+ * path. The name (NUL-terminated) is stored right after the node.
+ */
+struct DirNode {
+    DirNode* parent;  // nullptr for the scan root, whose name is the root path
+    ArenaBlock* block;
+    std::atomic<uint32_t> refs;
+    uint32_t length;
+    
+    const char* name() const { return reinterpret_cast<const char*>(this + 1); }
+};
+
+/**
+ * Owner of every ArenaBlock of one scan.
+ *
+ * Blocks whose nodes have all been released are recycled rather than
+ * freed, so a traversal that has reached its working-set size no longer
+ * touches the heap for directory nodes. Everything is freed with the pool.
+ */
+class BlockPool {
+public:
+    ArenaBlock* acquire() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (free_.empty()) {
+            blocks_.push_back(std::make_unique<ArenaBlock>());
+            return blocks_.back().get();
+        }
+        ArenaBlock* block = free_.back();
+        free_.pop_back();
+        block->live.store(1, std::memory_order_relaxed);
+        block->used = 0;
+        return block;
+    }
+    
+    /**
+     * Drop one reference to a block, recycling it when it was the last
+     */
+    void unref(ArenaBlock* block) {
+        if (block->live.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            free_.push_back(block);
+        }
+    }
+    
+    /**
+     * Drop one reference to a node, releasing ancestors that it kept alive
+     */
+    void release(DirNode* node) {
+        while (node != nullptr && node->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            DirNode* parent = node->parent;
+            unref(node->block);
+            node = parent;
+        }
+    }
+    
+    static DirNode* retain(DirNode* node) {
+        node->refs.fetch_add(1, std::memory_order_relaxed);
+        return node;
+    }
+    
+private:
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<ArenaBlock>> blocks_;
+    std::vector<ArenaBlock*> free_;
+};
+
+/**
+ * Single-threaded bump allocator for DirNodes, one per worker
+ */
+class NodeArena {
+public:
+    /**
+     * A node holding one reference (for the caller), whose parent gains one
+     */
+    DirNode* make(BlockPool& pool, DirNode* parent, std::string_view name) {
+        constexpr size_t align = alignof(DirNode);
+        const size_t bytes = (sizeof(DirNode) + name.size() + 1 + align - 1) & ~(align - 1);
+        if (bytes > ArenaBlock::BYTES) {
+            throw std::runtime_error("Path too long to scan: " + std::string(name));
+        }
+        if (block_ == nullptr || block_->used + bytes > ArenaBlock::BYTES) {
+            if (block_ != nullptr) {
+                pool.unref(block_);
+            }
+            block_ = pool.acquire();
+        }
+        
+        char* at = block_->data + block_->used;
+        block_->used += bytes;
+        block_->live.fetch_add(1, std::memory_order_relaxed);
+        auto* node = new (at) DirNode{parent, block_, {1}, static_cast<uint32_t>(name.size())};
+        std::memcpy(at + sizeof(DirNode), name.data(), name.size());
+        at[sizeof(DirNode) + name.size()] = '\0';
+        if (parent != nullptr) {
+            BlockPool::retain(parent);
+        }
+        return node;
+    }
+    
+private:
+    ArenaBlock* block_ = nullptr;
+};
+
+/**
+ * Append the full path of a directory node to `out`
+ */
+void append_path(const DirNode* node, std::string& out) {
+    if (node->parent != nullptr) {
+        append_path(node->parent, out);
+        if (out.empty() || out.back() != '/') {
+            out += '/';
+        }
+    }
+    out.append(node->name(), node->length);
+}
+
+/**
+ * Append the path of a directory node relative to the scan root
+ */
+void append_relative_path(const DirNode* node, std::string& out) {
+    if (node->parent == nullptr) {
+        return;
+    }
+    if (node->parent->parent != nullptr) {
+        append_relative_path(node->parent, out);
+        out += '/';
+    }
+    out.append(node->name(), node->length);
+}
+
+/**
+ * A directory waiting to be scanned.
+ *
+ * Frontiers are min-heaps that put the largest historical subtree first
+ * (longest-processing-time-first) and then order by `key`: the inode number
+ * under InodeOrder, a decreasing sequence number (depth-first) under Readdir.
+ */
+struct PendingDir {
+    uint64_t weight;  // entries in this subtree during the last scan, 0 if unknown
+    uint64_t key;
+    DirNode* node;    // holds one reference
+    uint32_t depth;
+    uint32_t bucket;  // ScanEngine::tracked_ slot this directory's entries roll up into
+    uint32_t owner = NO_OWNER;  // worker that queued it on the shared frontier
+    uint32_t protection = 0;    // ProtectionPolicy state, 0 (DEAD) when no rule can match below
+    uint8_t find = 0;           // FindProgram::EVALUATE, or REMOVED below an rm -r
+    
+    static constexpr uint32_t NO_OWNER = UINT32_MAX;
+    
+    bool operator>(const PendingDir& other) const {
+        if (weight != other.weight) {
+            return weight < other.weight;
+        }
+        return key > other.key;
+    }
+};
+
+/**
+ * Push onto a PendingDir heap
+ */
+void push_pending(std::vector<PendingDir>& heap, PendingDir dir) {
+    heap.push_back(std::move(dir));
+    std::push_heap(heap.begin(), heap.end(), std::greater<>());
+}
+
+/**
+ * Pop the highest-priority directory off a PendingDir heap
+ */
+PendingDir pop_pending(std::vector<PendingDir>& heap) {
+    std::pop_heap(heap.begin(), heap.end(), std::greater<>());
+    PendingDir dir = std::move(heap.back());
+    heap.pop_back();
+    return dir;
+}
+
+/**
+ * Subtree sizes remembered from earlier scans.
+ *
+ * Stored in a tab-separated file of "<entries>\t<absolute path>" lines, one
+ * per large directory near the top of each scanned root. The scanner uses
+ * it to dispatch the historically largest subtrees first and to keep small
+ * ones on a single worker.
+ */
+class ScanHistory {
+public:
+    // Directories deeper than this below the root are folded into their ancestor
+    static constexpr uint32_t MAX_DEPTH = 4;
+    // Subtrees smaller than this are not worth remembering
+    static constexpr uint64_t MIN_ENTRIES = 256;
+    // Upper bound on remembered subtrees per root
+    static constexpr size_t MAX_PER_ROOT = 4096;
+    
+    /**
+     * ~/.cache/advisor/history.tsv (honouring XDG_CACHE_HOME), or "" without a home
+     */
+    static std::string default_path() {
+        if (const char* cache = std::getenv("XDG_CACHE_HOME"); cache != nullptr && *cache != '\0') {
+            return std::string(cache) + "/advisor/history.tsv";
+        }
+        if (const char* home = std::getenv("HOME"); home != nullptr && *home != '\0') {
+            return std::string(home) + "/.cache/advisor/history.tsv";
+        }
+        return "";
+    }
+    
+    /**
+     * Load the entries recorded below `root` (an absolute, canonical path)
+     */
+    void load(const std::string& file, const std::string& root) {
+        std::ifstream in(file);
+        std::string line;
+        while (std::getline(in, line)) {
+            const size_t tab = line.find('\t');
+            if (tab == std::string::npos) {
+                continue;
+            }
+            std::string path = line.substr(tab + 1);
+            if (!is_within(path, root)) {
+                continue;
+            }
+            subtrees_[relative_key(path, root.size())] = std::strtoull(line.c_str(), nullptr, 10);
+        }
+    }
+    
+    /**
+     * Replace everything recorded below `root` with the given subtrees
+     */
+    static void save(const std::string& file, const std::string& root,
+                     std::vector<std::pair<uint64_t, std::string>> subtrees) {
+        std::vector<std::string> kept;
+        {
+            std::ifstream in(file);
+            std::string line;
+            while (std::getline(in, line)) {
+                const size_t tab = line.find('\t');
+                if (tab != std::string::npos && !is_within(line.substr(tab + 1), root)) {
+                    kept.push_back(std::move(line));
+                }
+            }
+        }
+        
+        std::sort(subtrees.begin(), subtrees.end(), std::greater<>());
+        if (subtrees.size() > MAX_PER_ROOT) {
+            subtrees.resize(MAX_PER_ROOT);
+        }
+        
+        std::error_code ec;
+        fs::create_directories(fs::path(file).parent_path(), ec);
+        const std::string temp = file + ".tmp." + std::to_string(::getpid());
+        {
+            std::ofstream out(temp, std::ios::trunc);
+            for (const auto& line : kept) {
+                out << line << '\n';
+            }
+            for (const auto& [entries, path] : subtrees) {
+                out << entries << '\t' << path << '\n';
+            }
+            if (!out) {
+                fs::remove(temp, ec);
+                return;
+            }
+        }
+        fs::rename(temp, file, ec);
+    }
+    
+    bool empty() const { return subtrees_.empty(); }
+    
+    /**
+     * Entries below a directory at the last scan, 0 if unknown.
+     * `relative` is the path with the scan root prefix stripped.
+     */
+    uint64_t lookup(const std::string& relative) const {
+        auto it = subtrees_.find(relative);
+        return it == subtrees_.end() ? 0 : it->second;
+    }
+    
+    /**
+     * Strip the root prefix (and the separator after it) from a path
+     */
+    static std::string relative_key(const std::string& path, size_t root_size) {
+        size_t start = std::min(root_size, path.size());
+        while (start < path.size() && path[start] == '/') {
+            start++;
+        }
+        return path.substr(start);
+    }
+    
+    /**
+     * True when `path` is `root` or lies below it
+     */
+    static bool is_within(const std::string& path, const std::string& root) {
+        if (path.compare(0, root.size(), root) != 0) {
+            return false;
+        }
+        return path.size() == root.size() || root.back() == '/' || path[root.size()] == '/';
+    }
+    
+private:
+    std::unordered_map<std::string, uint64_t> subtrees_;
+};
+
+/**
+ * Index just past the bracket expression that starts at glob[at], or npos
+ * when it is not terminated (the '[' is then an ordinary character)
+ */
+size_t glob_class_end(std::string_view glob, size_t at) {
+    size_t i = at + 1;
+    if (i < glob.size() && (glob[i] == '!' || glob[i] == '^')) {
+        i++;
+    }
+    if (i < glob.size() && glob[i] == ']') {
+        i++;
+    }
+    const size_t close = glob.find(']', i);
+    return close == std::string_view::npos ? close : close + 1;
+}
+
+/**
+ * Match a character against a bracket expression such as "[a-z_]" or "[!.]"
+ */
+bool glob_class_match(std::string_view set, char c) {
+    const auto ch = static_cast<unsigned char>(c);
+    size_t i = 1;
+    const bool negate = set[i] == '!' || set[i] == '^';
+    i += negate ? 1 : 0;
+    const size_t end = set.size() - 1;
+    bool found = false;
+    for (; i < end; i++) {
+        if (i + 2 < end && set[i + 1] == '-') {
+            found |= static_cast<unsigned char>(set[i]) <= ch && ch <= static_cast<unsigned char>(set[i + 2]);
+            i += 2;
+        } else {
+            found |= set[i] == c;
+        }
+    }
+    return found != negate;
+}
+
+/**
+ * Match one path component against a glob: `*` and `?` (never matching
+ * '/'), bracket expressions and backslash escapes. Backtracks only to the
+ * last `*`, so the cost is linear in practice.
+ */
+bool glob_match(std::string_view glob, std::string_view name) {
+    constexpr size_t npos = std::string_view::npos;
+    size_t g = 0;
+    size_t n = 0;
+    size_t star = npos;  // glob position after the last '*'
+    size_t star_name = 0;
+    while (n < name.size()) {
+        if (g < glob.size()) {
+            const char c = glob[g];
+            size_t next = g + 1;
+            bool matched = false;
+            if (c == '*') {
+                star = next;
+                star_name = n;
+                g = next;
+                continue;
+            }
+            if (c == '?') {
+                matched = true;
+            } else if (c == '[' && (next = glob_class_end(glob, g)) != npos) {
+                matched = glob_class_match(glob.substr(g, next - g), name[n]);
+            } else if (c == '\\' && g + 1 < glob.size()) {
+                matched = glob[g + 1] == name[n];
+                next = g + 2;
+            } else {
+                matched = c == name[n];
+                next = g + 1;
+            }
+            if (matched) {
+                g = next;
+                n++;
+                continue;
+            }
+        }
+        if (star == npos) {
+            return false;
+        }
+        g = star;
+        n = ++star_name;
+    }
+    while (g < glob.size() && glob[g] == '*') {
+        g++;
+    }
+    return g == glob.size();
+}
+
+/**
+ * True when a path component has to be matched as a glob
+ */
+bool has_glob_syntax(std::string_view component) {
+    return component.find_first_of("*?[\\") != std::string_view::npos;
+}
+
+const char* severity_name(Severity severity) {
+    switch (severity) {
+        case Severity::Notice: return "notice";
+        case Severity::Warning: return "warning";
+        case Severity::Critical: return "critical";
+    }
+    return "notice";
+}
+
+const char* protection_name(Protection relation) {
+    switch (relation) {
+        case Protection::Is: return "is";
+        case Protection::Contains: return "contains";
+        case Protection::Under: return "under";
+    }
+    return "is";
+}
+
+// Used when there is no configuration file
+constexpr std::string_view DEFAULT_PROTECTION =
+    "critical /\n"
+    "critical /bin\n"
+    "critical /boot\n"
+    "critical /dev\n"
+    "critical /etc\n"
+    "critical /home\n"
+    "critical /lib\n"
+    "critical /lib64\n"
+    "critical /proc\n"
+    "critical /sbin\n"
+    "critical /sys\n"
+    "critical /usr\n"
+    "critical /var\n"
+    "warning  /home/*\n"
+    "warning  /root\n"
+    "warning  /var/lib/docker\n"
+    "warning  /var/lib/mysql/**\n"
+    "warning  /var/lib/postgresql/**\n"
+    "notice   **/.git\n";
+
+/**
+ * Protected paths and glob patterns, each with a severity, compiled into
+ * a deterministic automaton over path components.
+ *
+ * Patterns are absolute paths ("/etc") or start with "**" to match at any
+ * depth, such as every ".git" directory. A component may use *, ? and
+ * [...]; a "**" component stands for any number of components, including
+ * none, so a trailing one protects a whole subtree.
+ *
+ * The patterns form a trie of components, and compile() turns it into a
+ * DFA whose states are sets of trie nodes: a path is matched with one
+ * step() per component, and a directory's state follows from its parent's
+ * with a single step(). The empty set is state DEAD, where nothing below
+ * can match any more and where almost every directory of a scan ends up.
+ */
+class ProtectionPolicy {
+public:
+    using State = uint32_t;
+    static constexpr State DEAD = 0;
+    
+    struct Rule {
+        Severity severity;
+        std::string pattern;
+    };
+    
+    /**
+     * ~/.config/advisor/protect.conf (honouring XDG_CONFIG_HOME), or "" without a home
+     */
+    static std::string default_path() {
+        if (const char* config = std::getenv("XDG_CONFIG_HOME"); config != nullptr && *config != '\0') {
+            return std::string(config) + "/advisor/protect.conf";
+        }
+        if (const char* home = std::getenv("HOME"); home != nullptr && *home != '\0') {
+            return std::string(home) + "/.config/advisor/protect.conf";
+        }
+        return "";
+    }
+    
+    /**
+     * Compiled rules from `file`: "<severity> <pattern>" lines, with
+     * '#' comments. The built-in rules stand in for a missing default file.
+     */
+    static ProtectionPolicy load(const std::string& file) {
+        ProtectionPolicy policy;
+        std::ifstream in(file);
+        if (!in) {
+            if (!file.empty() && file != default_path()) {
+                throw std::runtime_error("Cannot read protection rules: " + file);
+            }
+            policy.parse(DEFAULT_PROTECTION, "built-in rules");
+        } else {
+            std::ostringstream text;
+            text << in.rdbuf();
+            policy.parse(text.str(), file);
+        }
+        policy.compile();
+        return policy;
+    }
+    
+    /**
+     * Add the rules of a configuration text; `source` names it in errors
+     */
+    void parse(std::string_view text, const std::string& source) {
+        size_t number = 0;
+        for (size_t begin = 0; begin < text.size();) {
+            const size_t end = std::min(text.find('\n', begin), text.size());
+            std::string_view line = text.substr(begin, end - begin);
+            begin = end + 1;
+            number++;
+            line = line.substr(0, line.find('#'));
+            const size_t word = line.find_first_not_of(" \t\r");
+            if (word == std::string_view::npos) {
+                continue;
+            }
+            const size_t gap = line.find_first_of(" \t", word);
+            const size_t pattern = line.find_first_not_of(" \t", gap);
+            const size_t last = line.find_last_not_of(" \t\r");
+            const std::string_view level = line.substr(word, gap - word);
+            const std::string where = source + ":" + std::to_string(number) + ": ";
+            if (pattern == std::string_view::npos) {
+                throw std::runtime_error(where + "expected '<severity> <pattern>'");
+            }
+            Severity severity;
+            if (level == "notice") {
+                severity = Severity::Notice;
+            } else if (level == "warning") {
+                severity = Severity::Warning;
+            } else if (level == "critical") {
+                severity = Severity::Critical;
+            } else {
+                throw std::runtime_error(where + "unknown severity '" + std::string(level) +
+                                         "' (expected notice, warning or critical)");
+            }
+            try {
+                add(severity, std::string(line.substr(pattern, last + 1 - pattern)));
+            } catch (const std::exception& e) {
+                throw std::runtime_error(where + e.what());
+            }
+        }
+    }
+    
+    /**
+     * Add one rule; takes effect with the next compile()
+     */
+    void add(Severity severity, std::string pattern) {
+        if (pattern.empty() || (pattern[0] != '/' && pattern.compare(0, 2, "**") != 0)) {
+            throw std::runtime_error("pattern '" + pattern + "' must be absolute or start with **");
+        }
+        uint32_t node = 0;
+        for (size_t begin = 0; begin < pattern.size();) {
+            const size_t end = std::min(pattern.find('/', begin), pattern.size());
+            const std::string component = pattern.substr(begin, end - begin);
+            begin = end + 1;
+            if (component.empty()) {
+                continue;
+            }
+            if (component == "." || component == "..") {
+                throw std::runtime_error("pattern '" + pattern + "' must not contain . or ..");
+            }
+            node = component == "**" ? any_depth_child(node) : child(node, component);
+        }
+        nodes_[node].rules.push_back(static_cast<uint32_t>(rules_.size()));
+        rules_.push_back({severity, std::move(pattern)});
+    }
+    
+    /**
+     * Build the DFA from the trie, eagerly: every state knows its successor
+     * for each literal component its nodes mention and, for any other name,
+     * for each combination of its glob components
+     */
+    void compile() {
+        states_.clear();
+        state_ids_.clear();
+        intern({});
+        start_ = intern({0});
+        for (State id = 0; id < states_.size(); id++) {
+            std::set<std::string> literals;
+            std::vector<std::string> globs;
+            for (const uint32_t node : states_[id].nodes) {
+                for (const auto& [name, next] : nodes_[node].literals) {
+                    literals.insert(name);
+                }
+                for (const auto& [glob, next] : nodes_[node].globs) {
+                    if (glob != "*" && std::find(globs.begin(), globs.end(), glob) == globs.end()) {
+                        globs.push_back(glob);
+                    }
+                }
+            }
+            if (globs.size() > MAX_GLOBS) {
+                throw std::runtime_error("Protection rules use more than " + std::to_string(MAX_GLOBS) +
+                                         " different globs at one level");
+            }
+            
+            std::vector<std::pair<std::string, State>> literal_steps;
+            for (const auto& name : literals) {
+                uint32_t mask = 0;
+                for (size_t i = 0; i < globs.size(); i++) {
+                    mask |= glob_match(globs[i], name) ? 1u << i : 0;
+                }
+                literal_steps.emplace_back(name, intern(successors(id, &name, globs, mask)));
+            }
+            std::vector<State> others;
+            for (uint32_t mask = 0; mask < 1u << globs.size(); mask++) {
+                others.push_back(intern(successors(id, nullptr, globs, mask)));
+            }
+            states_[id].literals = std::move(literal_steps);
+            states_[id].globs = std::move(globs);
+            states_[id].others = std::move(others);
+        }
+    }
+    
+    State start() const { return start_; }
+    
+    /**
+     * State after one more path component
+     */
+    State step(State state, std::string_view name) const {
+        if (state == DEAD) {
+            return DEAD;
+        }
+        const DfaState& from = states_[state];
+        const auto found = std::lower_bound(from.literals.begin(), from.literals.end(), name,
+            [](const std::pair<std::string, State>& entry, std::string_view key) { return entry.first < key; });
+        if (found != from.literals.end() && found->first == name) {
+            return found->second;
+        }
+        uint32_t mask = 0;
+        for (size_t i = 0; i < from.globs.size(); i++) {
+            mask |= glob_match(from.globs[i], name) ? 1u << i : 0;
+        }
+        return from.others[mask];
+    }
+    
+    /**
+     * State after each '/'-separated component of `path`
+     */
+    State walk(State state, std::string_view path) const {
+        for (size_t begin = 0; begin < path.size() && state != DEAD;) {
+            const size_t end = std::min(path.find('/', begin), path.size());
+            if (end > begin) {
+                state = step(state, path.substr(begin, end - begin));
+            }
+            begin = end + 1;
+        }
+        return state;
+    }
+    
+    /**
+     * Rules that match a path in `state`
+     */
+    const std::vector<uint32_t>& accepts(State state) const { return states_[state].accepts; }
+    
+    const Rule& rule(uint32_t index) const { return rules_[index]; }
+    
+    /**
+     * Rules that `canonical` is, and those of its nearest protected ancestor
+     * (other than "/", which everything lives under)
+     */
+    std::vector<ProtectedMatch> match_target(const std::string& canonical) const {
+        std::vector<ProtectedMatch> matches;
+        std::vector<std::pair<State, size_t>> ancestors;  // protected ones, with their path length
+        State state = start_;
+        for (size_t begin = 0; begin < canonical.size() && state != DEAD;) {
+            const size_t end = std::min(canonical.find('/', begin), canonical.size());
+            if (end > begin) {
+                if (begin > 1 && !accepts(state).empty()) {
+                    ancestors.emplace_back(state, begin - 1);
+                }
+                state = step(state, std::string_view(canonical).substr(begin, end - begin));
+            }
+            begin = end + 1;
+        }
+        const std::vector<uint32_t>& is = accepts(state);
+        for (const uint32_t index : is) {
+            matches.push_back({Protection::Is, rules_[index].severity, rules_[index].pattern, canonical});
+        }
+        // A "**" rule that the target already is says nothing new about its ancestors
+        for (auto ancestor = ancestors.rbegin(); ancestor != ancestors.rend(); ++ancestor) {
+            const size_t before = matches.size();
+            for (const uint32_t index : accepts(ancestor->first)) {
+                if (std::find(is.begin(), is.end(), index) == is.end()) {
+                    matches.push_back({Protection::Under, rules_[index].severity, rules_[index].pattern,
+                                       canonical.substr(0, ancestor->second)});
+                }
+            }
+            if (matches.size() > before) {
+                break;
+            }
+        }
+        return matches;
+    }
+    
+private:
+    static constexpr size_t MAX_GLOBS = 8;
+    static constexpr size_t MAX_STATES = 1 << 16;
+    static constexpr uint32_t NONE = UINT32_MAX;
+    
+    /**
+     * A trie node: one pattern prefix
+     */
+    struct Node {
+        std::vector<std::pair<std::string, uint32_t>> literals;
+        std::vector<std::pair<std::string, uint32_t>> globs;
+        uint32_t any_depth = NONE;  // child reached through "**"
+        bool loops = false;         // this node is a "**": further components stay here
+        std::vector<uint32_t> rules;
+    };
+    
+    struct DfaState {
+        std::vector<uint32_t> nodes;  // sorted trie nodes
+        std::vector<uint32_t> accepts;
+        std::vector<std::pair<std::string, State>> literals;  // sorted by name
+        std::vector<std::string> globs;
+        std::vector<State> others;  // by mask of matching globs
+    };
+    
+    uint32_t child(uint32_t node, const std::string& component) {
+        const bool glob = has_glob_syntax(component);
+        for (const auto& [name, next] : glob ? nodes_[node].globs : nodes_[node].literals) {
+            if (name == component) {
+                return next;
+            }
+        }
+        const auto next = static_cast<uint32_t>(nodes_.size());
+        nodes_.emplace_back();
+        (glob ? nodes_[node].globs : nodes_[node].literals).emplace_back(component, next);
+        return next;
+    }
+    
+    uint32_t any_depth_child(uint32_t node) {
+        if (nodes_[node].any_depth == NONE) {
+            nodes_[node].any_depth = static_cast<uint32_t>(nodes_.size());
+            nodes_.emplace_back();
+            nodes_.back().loops = true;
+        }
+        return nodes_[node].any_depth;
+    }
+    
+    /**
+     * Trie nodes reached from `state` by a component equal to `literal`
+     * (nullptr: none of its literals) that matches the globs in `mask`
+     */
+    std::vector<uint32_t> successors(State state, const std::string* literal, const std::vector<std::string>& globs,
+                                     uint32_t mask) const {
+        std::vector<uint32_t> next;
+        for (const uint32_t node : states_[state].nodes) {
+            if (nodes_[node].loops) {
+                next.push_back(node);
+            }
+            for (const auto& [name, target] : nodes_[node].literals) {
+                if (literal != nullptr && name == *literal) {
+                    next.push_back(target);
+                }
+            }
+            for (const auto& [glob, target] : nodes_[node].globs) {
+                const auto bit = std::find(globs.begin(), globs.end(), glob) - globs.begin();
+                if (glob == "*" || (mask >> bit & 1) != 0) {
+                    next.push_back(target);
+                }
+            }
+        }
+        return next;
+    }
+    
+    /**
+     * Id of the state for a set of trie nodes, closed over "**" (which may
+     * match no component at all)
+     */
+    State intern(std::vector<uint32_t> nodes) {
+        for (size_t i = 0; i < nodes.size(); i++) {
+            if (nodes_[nodes[i]].any_depth != NONE) {
+                nodes.push_back(nodes_[nodes[i]].any_depth);
+            }
+        }
+        std::sort(nodes.begin(), nodes.end());
+        nodes.erase(std::unique(nodes.begin(), nodes.end()), nodes.end());
+        const auto [found, added] = state_ids_.emplace(nodes, static_cast<State>(states_.size()));
+        if (!added) {
+            return found->second;
+        }
+        if (states_.size() == MAX_STATES) {
+            throw std::runtime_error("Protection rules are too complex to compile");
+        }
+        DfaState state;
+        for (const uint32_t node : nodes) {
+            state.accepts.insert(state.accepts.end(), nodes_[node].rules.begin(), nodes_[node].rules.end());
+        }
+        std::sort(state.accepts.begin(), state.accepts.end());
+        state.nodes = std::move(nodes);
+        states_.push_back(std::move(state));
+        return found->second;
+    }
+    
+    std::vector<Rule> rules_;
+    std::vector<Node> nodes_{1};  // the root: "/"
+    std::vector<DfaState> states_;
+    std::map<std::vector<uint32_t>, State> state_ids_;
+    State start_ = DEAD;
+};
+
+/**
+ * Kinds of high-value files the scanner looks for, in report order
+ */
+enum class SensitiveKind : uint8_t {
+    PrivateKey, Certificate, Secrets, PasswordStore, Wallet, Database, Repository, CredentialDir, Count
+};
+
+constexpr const char* SENSITIVE_KIND_NAMES[] = {
+    "private keys", "certificates", "secrets", "password stores", "wallets", "databases",
+    "repositories", "credential dirs",
+};
+
+/**
+ * A name to look for: "name" matches exactly, "*suffix" and "prefix*"
+ * match an end of the name, case-insensitively
+ */
+struct SensitivePattern {
+    std::string_view pattern;
+    SensitiveKind kind;
+    bool directory;  // matches directories, otherwise files
+};
+
+constexpr SensitivePattern SENSITIVE_PATTERNS[] = {
+    {"id_rsa", SensitiveKind::PrivateKey, false},
+    {"id_dsa", SensitiveKind::PrivateKey, false},
+    {"id_ecdsa", SensitiveKind::PrivateKey, false},
+    {"id_ed25519", SensitiveKind::PrivateKey, false},
+    {"*.key", SensitiveKind::PrivateKey, false},
+    {"*.ppk", SensitiveKind::PrivateKey, false},
+    {"*.pem", SensitiveKind::Certificate, false},
+    {"*.p12", SensitiveKind::Certificate, false},
+    {"*.pfx", SensitiveKind::Certificate, false},
+    {".env", SensitiveKind::Secrets, false},
+    {".env.*", SensitiveKind::Secrets, false},
+    {".netrc", SensitiveKind::Secrets, false},
+    {".pgpass", SensitiveKind::Secrets, false},
+    {".htpasswd", SensitiveKind::Secrets, false},
+    {"*.kdbx", SensitiveKind::PasswordStore, false},
+    {"*.kdb", SensitiveKind::PasswordStore, false},
+    {".password-store", SensitiveKind::PasswordStore, true},
+    {"wallet.dat", SensitiveKind::Wallet, false},
+    {"*.sqlite", SensitiveKind::Database, false},
+    {"*.sqlite3", SensitiveKind::Database, false},
+    {"*.db", SensitiveKind::Database, false},
+    {".git", SensitiveKind::Repository, true},
+    {".hg", SensitiveKind::Repository, true},
+    {".svn", SensitiveKind::Repository, true},
+    {".ssh", SensitiveKind::CredentialDir, true},
+    {".gnupg", SensitiveKind::CredentialDir, true},
+    {".aws", SensitiveKind::CredentialDir, true},
+    {".kube", SensitiveKind::CredentialDir, true},
+    {".docker", SensitiveKind::CredentialDir, true},
+};
+
+/**
+ * Aho-Corasick automaton over entry names for every SENSITIVE_PATTERNS
+ * entry at once.
+ *
+ * A name is matched as "/name/": '/' never occurs inside a name, so exact
+ * names, suffixes and prefixes all become plain substrings ("/id_rsa/",
+ * ".pem/", "/.env."). The automaton is a full transition table over byte
+ * classes (one per byte used by a pattern, upper case folded, plus one for
+ * everything else), and each state carries the bit set of every pattern
+ * ending there or at a suffix of it, so a name costs one table lookup and
+ * one OR per byte, whatever the number of patterns.
+ */
+class SensitiveMatcher {
+public:
+    static_assert(std::size(SENSITIVE_PATTERNS) <= 64, "pattern bits must fit a uint64_t");
+    
+    static const SensitiveMatcher& instance() {
+        static const SensitiveMatcher matcher;
+        return matcher;
+    }
+    
+    /**
+     * Bit i set when SENSITIVE_PATTERNS[i] matches `name`
+     */
+    uint64_t match(std::string_view name) const {
+        uint32_t state = start_;
+        uint64_t found = 0;
+        for (const char c : name) {
+            state = next_[state * classes_ + class_of_[static_cast<unsigned char>(c)]];
+            found |= output_[state];
+        }
+        state = next_[state * classes_ + class_of_[static_cast<unsigned char>('/')]];
+        return found | output_[state];
+    }
+    
+private:
+    SensitiveMatcher() {
+        std::fill(std::begin(class_of_), std::end(class_of_), 0);
+        std::vector<std::string> keys;
+        for (const auto& entry : SENSITIVE_PATTERNS) {
+            const std::string_view pattern = entry.pattern;
+            std::string key = pattern.front() == '*' ? "" : "/";
+            key.append(pattern.substr(pattern.front() == '*' ? 1 : 0,
+                                      pattern.size() - (pattern.front() == '*' || pattern.back() == '*' ? 1 : 0)));
+            key += pattern.back() == '*' ? "" : "/";
+            for (const char c : key) {
+                auto& cls = class_of_[static_cast<unsigned char>(c)];
+                if (cls == 0) {
+                    cls = ++classes_;
+                }
+            }
+            keys.push_back(std::move(key));
+        }
+        classes_++;
+        for (int c = 'A'; c <= 'Z'; c++) {
+            class_of_[c] = class_of_[c - 'A' + 'a'];
+        }
+        
+        // The trie, with -1 for missing edges
+        std::vector<int32_t> trie(classes_, -1);
+        output_.assign(1, 0);
+        for (size_t i = 0; i < keys.size(); i++) {
+            uint32_t node = 0;
+            for (const char c : keys[i]) {
+                const uint8_t cls = class_of_[static_cast<unsigned char>(c)];
+                if (trie[node * classes_ + cls] < 0) {
+                    trie[node * classes_ + cls] = static_cast<int32_t>(output_.size());
+                    output_.push_back(0);
+                    trie.resize(trie.size() + classes_, -1);
+                }
+                node = static_cast<uint32_t>(trie[node * classes_ + cls]);
+            }
+            output_[node] |= uint64_t{1} << i;
+        }
+        
+        // Breadth-first: failure links, then transitions and outputs inherited through them
+        const size_t states = output_.size();
+        next_.assign(states * classes_, 0);
+        std::vector<uint32_t> fail(states, 0);
+        std::vector<uint32_t> queue;
+        for (uint32_t cls = 0; cls < classes_; cls++) {
+            if (trie[cls] > 0) {
+                next_[cls] = static_cast<uint32_t>(trie[cls]);
+                queue.push_back(static_cast<uint32_t>(trie[cls]));
+            }
+        }
+        for (size_t head = 0; head < queue.size(); head++) {
+            const uint32_t node = queue[head];
+            output_[node] |= output_[fail[node]];
+            for (uint32_t cls = 0; cls < classes_; cls++) {
+                const int32_t child = trie[node * classes_ + cls];
+                if (child < 0) {
+                    next_[node * classes_ + cls] = next_[fail[node] * classes_ + cls];
+                    continue;
+                }
+                next_[node * classes_ + cls] = static_cast<uint32_t>(child);
+                fail[static_cast<size_t>(child)] = next_[fail[node] * classes_ + cls];
+                queue.push_back(static_cast<uint32_t>(child));
+            }
+        }
+        start_ = next_[class_of_[static_cast<unsigned char>('/')]];
+    }
+    
+    uint8_t class_of_[256];
+    uint32_t classes_ = 0;
+    uint32_t start_ = 0;
+    std::vector<uint32_t> next_;    // state * classes_ + class
+    std::vector<uint64_t> output_;  // patterns matched on entering each state
+};
+
+/**
+ * Bits of the SENSITIVE_PATTERNS entries that match directories
+ */
+constexpr uint64_t sensitive_directory_bits() {
+    uint64_t bits = 0;
+    for (size_t i = 0; i < std::size(SENSITIVE_PATTERNS); i++) {
+        bits |= SENSITIVE_PATTERNS[i].directory ? uint64_t{1} << i : 0;
+    }
+    return bits;
+}
+
+/**
+ * Read a ref of a git directory, loose or packed; "" when it does not exist
+ */
+std::string read_git_ref(const std::string& git_dir, const std::string& ref) {
+    std::string value;
+    std::ifstream loose(git_dir + "/" + ref);
+    if (std::getline(loose, value)) {
+        return value;
+    }
+    std::ifstream packed(git_dir + "/packed-refs");
+    std::string line;
+    while (std::getline(packed, line)) {
+        const size_t space = line.find(' ');
+        if (space != std::string::npos && line.compare(space + 1, std::string::npos, ref) == 0) {
+            return line.substr(0, space);
+        }
+    }
+    return "";
+}
+
+/**
+ * Whether the current branch of a .git directory is on a remote, from its
+ * refs alone: "" when it matches a remote-tracking branch, else a short note
+ */
+std::string git_push_note(const std::string& git_dir) {
+    std::string head;
+    std::ifstream in(git_dir + "/HEAD");
+    if (!std::getline(in, head)) {
+        return "";
+    }
+    if (head.compare(0, 16, "ref: refs/heads/") != 0) {
+        return "detached HEAD";
+    }
+    const std::string branch = head.substr(16);
+    const std::string local = read_git_ref(git_dir, "refs/heads/" + branch);
+    if (local.empty()) {
+        return "no commits";
+    }
+    
+    std::vector<std::string> remotes;
+    std::error_code ec;
+    for (fs::directory_iterator it(git_dir + "/refs/remotes", ec), end; !ec && it != end; it.increment(ec)) {
+        remotes.push_back(it->path().filename().string());
+    }
+    std::ifstream packed(git_dir + "/packed-refs");
+    std::string line;
+    while (std::getline(packed, line)) {
+        const size_t at = line.find(" refs/remotes/");
+        if (at != std::string::npos) {
+            const size_t end = line.find('/', at + 14);
+            std::string remote = line.substr(at + 14, end - at - 14);
+            if (std::find(remotes.begin(), remotes.end(), remote) == remotes.end()) {
+                remotes.push_back(std::move(remote));
+            }
+        }
+    }
+    if (remotes.empty()) {
+        return "no remote";
+    }
+    std::sort(remotes.begin(), remotes.end());
+    for (const auto& remote : remotes) {
+        const std::string pushed = read_git_ref(git_dir, "refs/remotes/" + remote + "/" + branch);
+        if (pushed == local) {
+            return "";
+        }
+        if (!pushed.empty()) {
+            return "branch " + branch + " differs from " + remote + "/" + branch;
+        }
+    }
+    return "branch " + branch + " not on any remote";
+}
+
+/**
+ * One name read from a directory, before it has been stat-ed
+ */
+struct RawEntry {
+    ino_t inode;
+    unsigned char type;
+    uint32_t name;  // cookie the reader uses to find the name again
+};
+
+/**
+ * The parts of a stat() result the scanner uses
+ */
+struct EntryStat {
+    unsigned char type;  // DT_* type of the entry itself (links are not followed)
+    uint64_t size;
+    int64_t mtime_ns;    // 0 when the backend does not keep it
+};
+
+/**
+ * Per-worker cursor over the directories of a Vfs. Not thread-safe; each
+ * worker owns one.
+ */
+class VfsReader {
+public:
+    virtual ~VfsReader() = default;
+    
+    /**
+     * Count the calls this reader makes into `counts`
+     */
+    virtual void count_into(SyscallCounts& counts) { counts_ = &counts; }
+    
+    /**
+     * Open a directory, closing the previous one. Returns false on failure.
+     */
+    virtual bool open(const char* path) = 0;
+    
+    /**
+     * Read up to `limit` entries into `entries`, skipping "." and "..".
+     * Names stay valid until the next call. Returns false once the
+     * directory is exhausted.
+     */
+    virtual bool read(size_t limit, std::vector<RawEntry>& entries) = 0;
+    
+    virtual const char* name(const RawEntry& entry) const = 0;
+    
+    /**
+     * Stat an entry of the open directory without following symlinks
+     */
+    virtual bool stat(const RawEntry& entry, EntryStat& st) = 0;
+    
+    virtual void close() = 0;
+    
+protected:
+    SyscallCounts own_counts_;
+    SyscallCounts* counts_ = &own_counts_;
+};
+
+/**
+ * The filesystem under the scanner: the real one, or a stand-in for
+ * benchmarks and for replaying a recorded scan
+ */
+class Vfs {
+public:
+    virtual ~Vfs() = default;
+    
+    /**
+     * Throw unless `path` is a directory the scanner can read
+     */
+    virtual void check_directory(const std::string& path) const = 0;
+    
+    virtual std::unique_ptr<VfsReader> reader() const = 0;
+    
+    /**
+     * True when paths refer to the host filesystem (so device properties
+     * and scan history apply)
+     */
+    virtual bool is_real() const { return false; }
+    
+    /**
+     * True when stat results carry modification times
+     */
+    virtual bool has_mtimes() const { return true; }
+};
+
+/**
+ * Directory reader over real syscalls.
+ *
+ * On Linux entries come straight from getdents64 and their names are packed
+ * into one flat buffer, so once the buffers have grown to fit, reading a
+ * directory of any size allocates nothing. Elsewhere it falls back to
+ * opendir/readdir.
+ */
+class PosixReader : public VfsReader {
+public:
+    PosixReader() = default;
+    PosixReader(const PosixReader&) = delete;
+    PosixReader& operator=(const PosixReader&) = delete;
+    
+    ~PosixReader() override { close(); }
+    
+    bool open(const char* path) override {
+        close();
+        ADVISOR_COUNT(counts_->open);
+#ifdef __linux__
+        fd_ = ::open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        pos_ = 0;
+        end_ = 0;
+#else
+        dir_ = ::opendir(path);
+        fd_ = dir_ != nullptr ? ::dirfd(dir_) : -1;
+#endif
+        return fd_ >= 0;
+    }
+    
+    void close() override {
+#ifdef __linux__
+        if (fd_ >= 0) {
+            ADVISOR_COUNT(counts_->close);
+            ::close(fd_);
+        }
+#else
+        if (dir_ != nullptr) {
+            ADVISOR_COUNT(counts_->close);
+            ::closedir(dir_);
+            dir_ = nullptr;
+        }
+#endif
+        fd_ = -1;
+    }
+    
+    bool read(size_t limit, std::vector<RawEntry>& entries) override {
+        entries.clear();
+        names_.clear();
+        while (entries.size() < limit) {
+            const char* name = nullptr;
+            ino_t inode = 0;
+            unsigned char type = DT_UNKNOWN;
+            if (!next(name, inode, type)) {
+                return false;
+            }
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+                continue;
+            }
+            entries.push_back({inode, type, static_cast<uint32_t>(names_.size())});
+            names_.append(name, std::strlen(name) + 1);
+        }
+        return true;
+    }
+    
+    const char* name(const RawEntry& entry) const override { return names_.data() + entry.name; }
+    
+    bool stat(const RawEntry& entry, EntryStat& st) override {
+        ADVISOR_COUNT(counts_->stat);
+        struct stat info;
+        if (::fstatat(fd_, name(entry), &info, AT_SYMLINK_NOFOLLOW) != 0) {
+            return false;
+        }
+        st.type = IFTODT(info.st_mode);
+        st.size = static_cast<uint64_t>(info.st_size);
+        st.mtime_ns = static_cast<int64_t>(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+        return true;
+    }
+    
+private:
+    bool next(const char*& name, ino_t& inode, unsigned char& type) {
+#ifdef __linux__
+        if (pos_ >= end_) {
+            ADVISOR_COUNT(counts_->getdents);
+            const long n = ::syscall(SYS_getdents64, fd_, buffer_, sizeof(buffer_));
+            if (n <= 0) {
+                return false;
+            }
+            pos_ = 0;
+            end_ = static_cast<size_t>(n);
+        }
+        const auto* ent = reinterpret_cast<const struct dirent64*>(buffer_ + pos_);
+        pos_ += ent->d_reclen;
+#else
+        ADVISOR_COUNT(counts_->getdents);
+        const dirent* ent = ::readdir(dir_);
+        if (ent == nullptr) {
+            return false;
+        }
+#endif
+        name = ent->d_name;
+        inode = static_cast<ino_t>(ent->d_ino);
+        type = ent->d_type;
+        return true;
+    }
+    
+    int fd_ = -1;
+    std::string names_;
+#ifdef __linux__
+    size_t pos_ = 0;
+    size_t end_ = 0;
+    alignas(8) char buffer_[32 * 1024];
+#else
+    DIR* dir_ = nullptr;
+#endif
+};
+
+/**
+ * The host filesystem
+ */
+class PosixFs : public Vfs {
+public:
+    void check_directory(const std::string& path) const override {
+        if (!fs::exists(path)) {
+            throw std::runtime_error("Path does not exist: " + path);
+        }
+        
+        if (!fs::is_directory(path)) {
+            throw std::runtime_error("Path is not a directory: " + path);
+        }
+        
+        if (::access(path.c_str(), R_OK | X_OK) != 0) {
+            throw std::runtime_error("Error accessing directory: " + path + ": " + std::strerror(errno));
+        }
+    }
+    
+    std::unique_ptr<VfsReader> reader() const override { return std::make_unique<PosixReader>(); }
+    
+    bool is_real() const override { return true; }
+};
+
+/**
+ * Empty a partial result, keeping its storage for reuse
+ */
+void reset_result(AnalysisResult& result) {
+    result.total_files = 0;
+    result.total_directories = 0;
+    result.total_size = 0;
+    result.largest_file_size = 0;
+    result.largest_file_path.clear();
+    result.file_types.clear();
+}
+
+/**
+ * Fold one partial result into another
+ */
+void merge_result(AnalysisResult& into, const AnalysisResult& from) {
+    into.total_files += from.total_files;
+    into.total_directories += from.total_directories;
+    into.total_size += from.total_size;
+    if (from.largest_file_size > into.largest_file_size) {
+        into.largest_file_size = from.largest_file_size;
+        into.largest_file_path = from.largest_file_path;
+    }
+    into.file_types.merge(from.file_types);
+}
+
+/**
+ * Per-structure caps derived from --max-memory.
+ *
+ * Every structure that would otherwise grow with the size of the tree gets
+ * a share of the budget: the in-memory frontier (overflow spills to disk),
+ * the extension tables (heavy-hitter sketch capacity), the history
+ * rollup (limited in count, paths spilled to disk), the batch of entries
+ * read from one directory at a time and the buffer in front of the frontier
+ * spill file.
+ */
+struct MemoryLimits {
+    size_t frontier_entries = SIZE_MAX;
+    size_t file_types = FileTypeCounter::DEFAULT_CAPACITY;  // counters per table
+    size_t tracked_dirs = SIZE_MAX;       // history rollup slots
+    size_t tracked_path_bytes = SIZE_MAX; // rollup paths kept in memory before spilling
+    size_t dir_batch = SIZE_MAX;          // entries read from a directory at once
+    size_t spill_buffer = 64 * 1024;      // frontier spill bytes buffered before writing or per reload
+    
+    static MemoryLimits from_budget(uint64_t budget, unsigned jobs) {
+        MemoryLimits limits;
+        if (budget == 0) {
+            return limits;
+        }
+        // Leave room for the executable, thread stacks and the allocator itself
+        constexpr uint64_t BASELINE = 8 * 1024 * 1024;
+        const uint64_t usable = budget > 2 * BASELINE ? budget - BASELINE : budget / 2;
+        auto share = [&](uint64_t fraction, uint64_t item_bytes, uint64_t floor) {
+            return static_cast<size_t>(std::max(floor, usable / fraction / item_bytes));
+        };
+        limits.frontier_entries = share(4, 160, 64);
+        // Each worker holds a committed table and a per-unit table
+        limits.file_types = std::min(limits.file_types, share(8 * uint64_t{jobs} * 2, 128, 16));
+        limits.tracked_dirs = share(16, 16, 64);
+        limits.tracked_path_bytes = share(16, 1, 4096);
+        limits.dir_batch = share(8 * uint64_t{jobs}, 96, 256);
+        limits.spill_buffer = std::min(limits.spill_buffer, share(64, 1, 4096));
+        return limits;
+    }
+};
+
+/**
+ * Peak resident set size of this process, in bytes
+ */
+uint64_t peak_rss_bytes() {
+    struct rusage usage{};
+    ::getrusage(RUSAGE_SELF, &usage);
+    return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+}
+
+/**
+ * Token bucket shared by all workers to enforce --max-iops
+ */
+class RateLimiter {
+public:
+    explicit RateLimiter(unsigned per_second)
+        : interval_(per_second ? std::chrono::nanoseconds(1000000000 / per_second)
+                               : std::chrono::nanoseconds(0)) {}
+    
+    /**
+     * Block until the caller may issue one more filesystem call
+     */
+    void acquire() {
+        if (interval_.count() == 0) {
+            return;
+        }
+        std::chrono::steady_clock::time_point slot;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            slot = std::max(next_, std::chrono::steady_clock::now());
+            next_ = slot + interval_;
+        }
+        std::this_thread::sleep_until(slot);
+    }
+    
+private:
+    std::chrono::nanoseconds interval_;
+    std::mutex mutex_;
+    std::chrono::steady_clock::time_point next_;
+};
+
+/**
+ * Read the cumulative "some" stall time, in microseconds, from a PSI file
+ * such as /proc/pressure/io. Returns false when PSI is unavailable.
+ */
+bool read_psi_total(const char* path, uint64_t& total_us) {
+    FILE* file = std::fopen(path, "r");
+    if (file == nullptr) {
+        return false;
+    }
+    char line[256];
+    bool found = false;
+    while (std::fgets(line, sizeof(line), file) != nullptr) {
+        const char* total = std::strstr(line, "total=");
+        if (std::strncmp(line, "some", 4) == 0 && total != nullptr) {
+            total_us = std::strtoull(total + 6, nullptr, 10);
+            found = true;
+            break;
+        }
+    }
+    std::fclose(file);
+    return found;
+}
+
+/**
+ * CPU time consumed by this process so far
+ */
+std::chrono::nanoseconds process_cpu_time() {
+    timespec ts{};
+    ::clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+}
+
+/**
+ * CPU time consumed by the calling thread so far
+ */
+std::chrono::nanoseconds thread_cpu_time() {
+    timespec ts{};
+    ::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+}
+
+/**
+ * Drop the calling thread (and every thread it spawns afterwards) to the
+ * idle I/O scheduling class and the lowest CPU priority
+ */
+void apply_background_priority() {
+#ifdef __linux__
+    constexpr int IOPRIO_CLASS_IDLE = 3;
+    constexpr int IOPRIO_CLASS_SHIFT = 13;
+    constexpr int IOPRIO_WHO_PROCESS = 1;
+    ::syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+#endif
+    ::setpriority(PRIO_PROCESS, 0, 19);
+}
+
+/**
+ * Append a base-128 varint
+ */
+void put_varint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out += static_cast<char>((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+
+/**
+ * Append a varint length-prefixed string
+ */
+void put_string(std::string& out, const std::string& value) {
+    put_varint(out, value.size());
+    out += value;
+}
+
+/**
+ * Cursor over data written with put_varint()/put_string().
+ *
+ * Readers return false when the data ends mid-value, leaving `pos` where it
+ * was so a caller can retry once more bytes are available.
+ */
+struct ByteReader {
+    const std::string& data;
+    size_t pos = 0;
+    
+    bool varint(uint64_t& value) {
+        size_t at = pos;
+        value = 0;
+        for (int shift = 0; shift < 64 && at < data.size(); shift += 7) {
+            const auto byte = static_cast<unsigned char>(data[at++]);
+            value |= uint64_t{byte & 0x7fu} << shift;
+            if ((byte & 0x80) == 0) {
+                pos = at;
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    bool string(std::string& value) {
+        const size_t start = pos;
+        uint64_t size = 0;
+        if (!varint(size) || size > data.size() - pos) {
+            pos = start;
+            return false;
+        }
+        value.assign(data, pos, size);
+        pos += size;
+        return true;
+    }
+    
+    bool at_end() const { return pos >= data.size(); }
+};
+
+/**
+ * Encode a frontier entry; `relative` is its path with the scan root stripped
+ */
+void encode_pending(std::string& out, const PendingDir& dir, const std::string& relative) {
+    put_varint(out, dir.weight);
+    put_varint(out, dir.key);
+    put_varint(out, dir.depth);
+    put_varint(out, dir.bucket);
+    put_string(out, relative);
+}
+
+/**
+ * Decode a frontier entry written by encode_pending(); the node is left
+ * for the caller to create from `relative`
+ */
+bool decode_pending(ByteReader& reader, PendingDir& dir, std::string& relative) {
+    const size_t start = reader.pos;
+    uint64_t depth = 0;
+    uint64_t bucket = 0;
+    if (reader.varint(dir.weight) && reader.varint(dir.key) && reader.varint(depth) &&
+        reader.varint(bucket) && reader.string(relative)) {
+        dir.node = nullptr;
+        dir.depth = static_cast<uint32_t>(depth);
+        dir.bucket = static_cast<uint32_t>(bucket);
+        return true;
+    }
+    reader.pos = start;
+    return false;
+}
+
+/**
+ * Write a whole buffer to a file descriptor
+ */
+bool write_all(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        const ssize_t n = ::write(fd, data, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+/**
+ * Append-only byte log that lives in memory until it outgrows its limit,
+ * then moves to an unlinked temporary file.
+ *
+ * Used to keep scan state that grows with the tree (overflow of the
+ * directory frontier, paths of directories tracked for history) out of RAM
+ * under --max-memory. Not thread-safe; callers serialize access.
+ */
+class SpillFile {
+public:
+    explicit SpillFile(size_t memory_limit = SIZE_MAX) : memory_limit_(memory_limit) {}
+    SpillFile(const SpillFile&) = delete;
+    SpillFile& operator=(const SpillFile&) = delete;
+    
+    ~SpillFile() {
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+    }
+    
+    /**
+     * Append bytes and return the offset they were stored at
+     */
+    uint64_t append(const std::string& bytes) {
+        const uint64_t offset = size();
+        buffer_ += bytes;
+        if (buffer_.size() > memory_limit_ || (fd_ >= 0 && buffer_.size() >= FLUSH_BYTES)) {
+            flush();
+        }
+        return offset;
+    }
+    
+    /**
+     * Move buffered bytes to disk
+     */
+    void flush() {
+        if (buffer_.empty()) {
+            return;
+        }
+        if (fd_ < 0) {
+            open_temp();
+        }
+        if (!write_all(fd_, buffer_.data(), buffer_.size())) {
+            throw std::runtime_error(std::string("Cannot write spill file: ") + std::strerror(errno));
+        }
+        on_disk_ += buffer_.size();
+        buffer_.clear();
+    }
+    
+    /**
+     * Read `length` bytes starting at `offset` into `out`
+     */
+    void read(uint64_t offset, size_t length, std::string& out) const {
+        out.resize(length);
+        size_t done = 0;
+        // On-disk part first, then whatever is still buffered
+        while (done < length && offset + done < on_disk_) {
+            const size_t want = static_cast<size_t>(std::min<uint64_t>(length - done, on_disk_ - offset - done));
+            const ssize_t n = ::pread(fd_, &out[done], want, static_cast<off_t>(offset + done));
+            if (n <= 0) {
+                throw std::runtime_error(std::string("Cannot read spill file: ") + std::strerror(errno));
+            }
+            done += static_cast<size_t>(n);
+        }
+        if (done < length) {
+            buffer_.copy(&out[done], length - done, static_cast<size_t>(offset + done - on_disk_));
+        }
+    }
+    
+    /**
+     * Copy the range [from, to), which must already be flushed, to another
+     * file descriptor. Safe to call while another thread appends.
+     */
+    bool copy_flushed_to(int out_fd, uint64_t from, uint64_t to) const {
+        std::string chunk(FLUSH_BYTES, '\0');
+        for (uint64_t at = from; at < to;) {
+            const size_t want = static_cast<size_t>(std::min<uint64_t>(to - at, FLUSH_BYTES));
+            const ssize_t n = ::pread(fd_, chunk.data(), want, static_cast<off_t>(at));
+            if (n <= 0 || !write_all(out_fd, chunk.data(), static_cast<size_t>(n))) {
+                return false;
+            }
+            at += static_cast<uint64_t>(n);
+        }
+        return true;
+    }
+    
+    uint64_t size() const { return on_disk_ + buffer_.size(); }
+    
+private:
+    static constexpr size_t FLUSH_BYTES = 64 * 1024;
+    
+    void open_temp() {
+        const char* dir = std::getenv("TMPDIR");
+        std::string name = std::string(dir != nullptr && *dir != '\0' ? dir : "/tmp") + "/advisor-spill-XXXXXX";
+        fd_ = ::mkstemp(name.data());
+        if (fd_ < 0) {
+            throw std::runtime_error("Cannot create spill file " + name + ": " + std::strerror(errno));
+        }
+        ::unlink(name.c_str());
+    }
+    
+    size_t memory_limit_;
+    int fd_ = -1;
+    uint64_t on_disk_ = 0;
+    std::string buffer_;
+};
+
+/**
+ * Partial scan state persisted by --checkpoint and read back by --resume.
+ *
+ * Only completed work units are folded into `result`; every directory that
+ * was queued or in flight at snapshot time is listed in `frontier` (paths
+ * relative to `root`), so resuming never visits a finished subtree twice.
+ */
+struct ScanCheckpoint {
+    std::string root;  // canonical scan root
+    AnalysisResult result;
+    std::vector<std::pair<PendingDir, std::string>> frontier;  // with paths relative to root
+    
+    static constexpr char MAGIC[] = "ADVCKPT1";
+    
+    /**
+     * Encode the aggregate part of a checkpoint; encode_pending() records follow
+     */
+    static void encode_header(std::string& out, const std::string& root, const AnalysisResult& result) {
+        out.append(MAGIC, sizeof(MAGIC) - 1);
+        put_string(out, root);
+        put_varint(out, result.total_files);
+        put_varint(out, result.total_directories);
+        put_varint(out, result.total_size);
+        put_varint(out, result.largest_file_size);
+        put_string(out, result.largest_file_path);
+        put_varint(out, result.file_types.approximate() ? 1 : 0);
+        put_varint(out, result.file_types.size());
+        for (const auto& type : result.file_types.entries()) {
+            put_string(out, type.extension);
+            put_varint(out, type.count);
+            put_varint(out, type.error);
+        }
+    }
+    
+    /**
+     * Atomically replace `file` with an encoded checkpoint, optionally
+     * followed by the [from, to) range of spilled frontier records
+     */
+    static void write_file(const std::string& file, const std::string& data,
+                           const SpillFile* spill = nullptr, uint64_t from = 0, uint64_t to = 0) {
+        const std::string temp = file + ".tmp";
+        const int fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (fd < 0) {
+            throw std::runtime_error("Cannot write checkpoint " + temp + ": " + std::strerror(errno));
+        }
+        const bool ok = write_all(fd, data.data(), data.size()) &&
+                        (spill == nullptr || from == to || spill->copy_flushed_to(fd, from, to));
+        ::close(fd);
+        if (!ok || ::rename(temp.c_str(), file.c_str()) != 0) {
+            throw std::runtime_error("Cannot write checkpoint " + file + ": " + std::strerror(errno));
+        }
+    }
+    
+    /**
+     * Load a checkpoint written by write_file()
+     */
+    static ScanCheckpoint read_file(const std::string& file) {
+        std::ifstream in(file, std::ios::binary);
+        if (!in) {
+            throw std::runtime_error("Cannot read checkpoint " + file);
+        }
+        const std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        const std::runtime_error corrupt("Corrupt checkpoint file: " + file);
+        if (data.compare(0, sizeof(MAGIC) - 1, MAGIC) != 0) {
+            throw corrupt;
+        }
+        
+        ByteReader reader{data, sizeof(MAGIC) - 1};
+        ScanCheckpoint checkpoint;
+        AnalysisResult& result = checkpoint.result;
+        uint64_t files = 0;
+        uint64_t directories = 0;
+        uint64_t approximate = 0;
+        uint64_t types = 0;
+        if (!reader.string(checkpoint.root) || !reader.varint(files) || !reader.varint(directories) ||
+            !reader.varint(result.total_size) || !reader.varint(result.largest_file_size) ||
+            !reader.string(result.largest_file_path) || !reader.varint(approximate) || !reader.varint(types)) {
+            throw corrupt;
+        }
+        result.total_files = files;
+        result.total_directories = directories;
+        std::vector<FileTypeCount> counts;
+        for (; types > 0; types--) {
+            FileTypeCount type{};
+            if (!reader.string(type.extension) || !reader.varint(type.count) || !reader.varint(type.error)) {
+                throw corrupt;
+            }
+            counts.push_back(std::move(type));
+        }
+        result.file_types.restore(std::move(counts), approximate != 0);
+        while (!reader.at_end()) {
+            PendingDir dir{};
+            std::string relative;
+            if (!decode_pending(reader, dir, relative)) {
+                throw corrupt;
+            }
+            // History slots belong to the run that wrote the checkpoint
+            dir.bucket = 0;
+            checkpoint.frontier.emplace_back(dir, std::move(relative));
+        }
+        return checkpoint;
+    }
+};
+
+/**
+ * A directory tree held in memory as flat arrays: one fixed-size record
+ * per entry (40 bytes) plus a single pool of names.
+ *
+ * Serves synthetic trees to `advisor bench` at sizes no disk would hold
+ * comfortably, and replays scans recorded with --record, optionally with a
+ * delay injected into every call to mimic slow storage such as NFS.
+ */
+class MemoryFs : public Vfs {
+public:
+    static constexpr char MAGIC[] = "ADVREC2\n";
+    static constexpr char MAGIC_V1[] = "ADVREC1\n";  // recordings without modification times
+    
+    // Outcome of stat-ing an entry
+    enum StatState : uint8_t { NOT_STATED = 0, STAT_OK = 1, STAT_FAILED = 2 };
+    
+    /**
+     * Start the listing of a directory; entries added next belong to it
+     */
+    void add_directory(const std::string& path, bool readable = true) {
+        dirs_.push_back({entries_.size(), 0, readable});
+        index_[path] = dirs_.size() - 1;
+    }
+    
+    void add_entry(std::string_view name, uint64_t inode, unsigned char type, StatState stat_state,
+                   unsigned char stat_type = DT_UNKNOWN, uint64_t size = 0, int64_t mtime_ns = 0) {
+        entries_.push_back({names_.size(), inode, size, mtime_ns, type, stat_state, stat_type});
+        names_.append(name);
+        names_ += '\0';
+        dirs_.back().count++;
+    }
+    
+    /**
+     * Delay every call by `latency`
+     */
+    void set_latency(std::chrono::microseconds latency) { latency_ = latency; }
+    
+    size_t size() const { return entries_.size(); }
+    
+    /**
+     * Load a recording written by RecordingFs
+     */
+    static std::unique_ptr<MemoryFs> load_recording(const std::string& file) {
+        std::ifstream in(file, std::ios::binary);
+        if (!in) {
+            throw std::runtime_error("Cannot read recording " + file);
+        }
+        const std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        const std::runtime_error corrupt("Corrupt recording file: " + file);
+        const bool v1 = data.compare(0, sizeof(MAGIC_V1) - 1, MAGIC_V1) == 0;
+        if (!v1 && data.compare(0, sizeof(MAGIC) - 1, MAGIC) != 0) {
+            throw corrupt;
+        }
+        
+        auto fs = std::make_unique<MemoryFs>();
+        fs->has_mtimes_ = !v1;
+        ByteReader reader{data, sizeof(MAGIC) - 1};
+        std::string path;
+        std::string name;
+        while (!reader.at_end()) {
+            uint64_t readable = 0;
+            uint64_t count = 0;
+            if (!reader.string(path) || !reader.varint(readable) || !reader.varint(count)) {
+                throw corrupt;
+            }
+            fs->add_directory(path, readable != 0);
+            for (; count > 0; count--) {
+                uint64_t inode = 0;
+                uint64_t type = 0;
+                uint64_t state = 0;
+                uint64_t stat_type = DT_UNKNOWN;
+                uint64_t size = 0;
+                uint64_t mtime = 0;
+                if (!reader.string(name) || !reader.varint(inode) || !reader.varint(type) ||
+                    !reader.varint(state) || state > STAT_FAILED ||
+                    (state == STAT_OK && (!reader.varint(stat_type) || !reader.varint(size) ||
+                                          (!v1 && !reader.varint(mtime))))) {
+                    throw corrupt;
+                }
+                fs->add_entry(name, inode, static_cast<unsigned char>(type), static_cast<StatState>(state),
+                              static_cast<unsigned char>(stat_type), size, static_cast<int64_t>(mtime));
+            }
+        }
+        return fs;
+    }
+    
+    /**
+     * Create the tree on disk, as sparse files. Directories are created in
+     * the order they were added, so parents must come first.
+     */
+    void materialize() const {
+        std::vector<std::pair<size_t, const std::string*>> order;
+        for (const auto& [path, dir] : index_) {
+            order.emplace_back(dir, &path);
+        }
+        std::sort(order.begin(), order.end());
+        for (const auto& [id, path] : order) {
+            if (::mkdir(path->c_str(), 0755) != 0 && errno != EEXIST) {
+                throw std::runtime_error("Cannot create " + *path + ": " + std::strerror(errno));
+            }
+            const Dir& dir = dirs_[id];
+            for (uint64_t i = dir.first; i < dir.first + dir.count; i++) {
+                const Entry& entry = entries_[i];
+                if (entry.type != DT_REG) {
+                    continue;
+                }
+                const std::string file = *path + "/" + (names_.data() + entry.name);
+                const int fd = ::open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+                if (fd < 0 || ::ftruncate(fd, static_cast<off_t>(entry.size)) != 0) {
+                    const int error = errno;
+                    if (fd >= 0) {
+                        ::close(fd);
+                    }
+                    throw std::runtime_error("Cannot create " + file + ": " + std::strerror(error));
+                }
+                ::close(fd);
+            }
+        }
+    }
+    
+    void check_directory(const std::string& path) const override {
+        auto it = index_.find(path);
+        if (it == index_.end()) {
+            throw std::runtime_error("Path does not exist: " + path);
+        }
+        if (!dirs_[it->second].readable) {
+            throw std::runtime_error("Error accessing directory: " + path);
+        }
+    }
+    
+    std::unique_ptr<VfsReader> reader() const override { return std::make_unique<Reader>(*this); }
+    
+    bool has_mtimes() const override { return has_mtimes_; }
+    
+    /**
+     * Whether the times given to add_entry() are real; synthetic trees leave them at 0
+     */
+    void set_has_mtimes(bool has) { has_mtimes_ = has; }
+    
+private:
+    struct Dir {
+        uint64_t first;  // index of the first entry
+        uint32_t count;
+        bool readable;
+    };
+    
+    struct Entry {
+        uint64_t name;  // offset into names_
+        uint64_t inode;
+        uint64_t size;
+        int64_t mtime_ns;
+        unsigned char type;
+        StatState stat_state;
+        unsigned char stat_type;
+    };
+    
+    class Reader : public VfsReader {
+    public:
+        explicit Reader(const MemoryFs& fs) : fs_(fs) {}
+        
+        bool open(const char* path) override {
+            ADVISOR_COUNT(counts_->open);
+            fs_.delay();
+            key_.assign(path);
+            auto it = fs_.index_.find(key_);
+            dir_ = it != fs_.index_.end() && fs_.dirs_[it->second].readable ? &fs_.dirs_[it->second] : nullptr;
+            next_ = 0;
+            return dir_ != nullptr;
+        }
+        
+        bool read(size_t limit, std::vector<RawEntry>& entries) override {
+            entries.clear();
+            if (dir_ == nullptr) {
+                return false;
+            }
+            ADVISOR_COUNT(counts_->getdents);
+            fs_.delay();
+            for (; entries.size() < limit && next_ < dir_->count; next_++) {
+                const Entry& entry = fs_.entries_[dir_->first + next_];
+                entries.push_back({static_cast<ino_t>(entry.inode), entry.type, next_});
+            }
+            return next_ < dir_->count;
+        }
+        
+        const char* name(const RawEntry& entry) const override {
+            return fs_.names_.data() + fs_.entries_[dir_->first + entry.name].name;
+        }
+        
+        bool stat(const RawEntry& raw, EntryStat& st) override {
+            ADVISOR_COUNT(counts_->stat);
+            fs_.delay();
+            const Entry& entry = fs_.entries_[dir_->first + raw.name];
+            st = {entry.stat_type, entry.size, entry.mtime_ns};
+            return entry.stat_state == STAT_OK;
+        }
+        
+        void close() override {
+            if (dir_ != nullptr) {
+                ADVISOR_COUNT(counts_->close);
+                dir_ = nullptr;
+            }
+        }
+        
+    private:
+        const MemoryFs& fs_;
+        const Dir* dir_ = nullptr;
+        uint32_t next_ = 0;
+        std::string key_;
+    };
+    
+    void delay() const {
+        if (latency_.count() > 0) {
+            std::this_thread::sleep_for(latency_);
+        }
+    }
+    
+    std::vector<Dir> dirs_;
+    std::vector<Entry> entries_;
+    std::string names_;
+    std::unordered_map<std::string, size_t> index_;  // directory path -> dirs_ slot
+    std::chrono::microseconds latency_{0};
+    bool has_mtimes_ = false;
+};
+
+/**
+ * Wraps another Vfs and writes every directory listing and stat result the
+ * scanner sees to a file that MemoryFs::load_recording() replays.
+ *
+ * A listing is buffered per directory and appended, under a lock, when
+ * the directory is closed.
+ */
+class RecordingFs : public Vfs {
+public:
+    RecordingFs(const Vfs& inner, const std::string& file) : inner_(inner), file_(file) {
+        fd_ = ::open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd_ < 0 || !write_all(fd_, MemoryFs::MAGIC, sizeof(MemoryFs::MAGIC) - 1)) {
+            throw std::runtime_error("Cannot write recording " + file + ": " + std::strerror(errno));
+        }
+    }
+    RecordingFs(const RecordingFs&) = delete;
+    RecordingFs& operator=(const RecordingFs&) = delete;
+    
+    ~RecordingFs() override { ::close(fd_); }
+    
+    /**
+     * Throw if any listing could not be written
+     */
+    void check_written() const {
+        if (failed_) {
+            throw std::runtime_error("Cannot write recording " + file_);
+        }
+    }
+    
+    void check_directory(const std::string& path) const override { inner_.check_directory(path); }
+    
+    std::unique_ptr<VfsReader> reader() const override { return std::make_unique<Reader>(*this, inner_.reader()); }
+    
+    bool is_real() const override { return inner_.is_real(); }
+    
+    bool has_mtimes() const override { return inner_.has_mtimes(); }
+    
+private:
+    struct Recorded {
+        std::string name;
+        uint64_t inode;
+        unsigned char type;
+        MemoryFs::StatState stat_state;
+        EntryStat stat;
+    };
+    
+    class Reader : public VfsReader {
+    public:
+        Reader(const RecordingFs& owner, std::unique_ptr<VfsReader> inner)
+            : owner_(owner), inner_(std::move(inner)) {}
+        
+        ~Reader() override { close(); }
+        
+        void count_into(SyscallCounts& counts) override {
+            VfsReader::count_into(counts);
+            inner_->count_into(counts);
+        }
+        
+        bool open(const char* path) override {
+            close();
+            const bool ok = inner_->open(path);
+            path_ = path;
+            recorded_.clear();
+            open_ = true;
+            if (!ok) {
+                // The scanner does not close directories it failed to open
+                emit(false);
+            }
+            return ok;
+        }
+        
+        bool read(size_t limit, std::vector<RawEntry>& entries) override {
+            const bool more = inner_->read(limit, batch_);
+            batch_start_ = recorded_.size();
+            entries.clear();
+            for (const auto& entry : batch_) {
+                entries.push_back({entry.inode, entry.type, static_cast<uint32_t>(recorded_.size())});
+                recorded_.push_back({inner_->name(entry), static_cast<uint64_t>(entry.inode), entry.type,
+                                     MemoryFs::NOT_STATED, {DT_UNKNOWN, 0, 0}});
+            }
+            return more;
+        }
+        
+        const char* name(const RawEntry& entry) const override { return recorded_[entry.name].name.c_str(); }
+        
+        bool stat(const RawEntry& entry, EntryStat& st) override {
+            Recorded& recorded = recorded_[entry.name];
+            const bool ok = inner_->stat(batch_[entry.name - batch_start_], st);
+            recorded.stat_state = ok ? MemoryFs::STAT_OK : MemoryFs::STAT_FAILED;
+            if (ok) {
+                recorded.stat = st;
+            }
+            return ok;
+        }
+        
+        void close() override {
+            if (open_) {
+                inner_->close();
+                emit(true);
+            }
+        }
+        
+    private:
+        void emit(bool readable) {
+            open_ = false;
+            record_.clear();
+            put_string(record_, path_);
+            put_varint(record_, readable ? 1 : 0);
+            put_varint(record_, recorded_.size());
+            for (const auto& entry : recorded_) {
+                put_string(record_, entry.name);
+                put_varint(record_, entry.inode);
+                put_varint(record_, entry.type);
+                put_varint(record_, entry.stat_state);
+                if (entry.stat_state == MemoryFs::STAT_OK) {
+                    put_varint(record_, entry.stat.type);
+                    put_varint(record_, entry.stat.size);
+                    put_varint(record_, static_cast<uint64_t>(entry.stat.mtime_ns));
+                }
+            }
+            owner_.append(record_);
+        }
+        
+        const RecordingFs& owner_;
+        std::unique_ptr<VfsReader> inner_;
+        std::string path_;
+        std::vector<Recorded> recorded_;  // the whole listing of the open directory
+        std::vector<RawEntry> batch_;     // the inner reader's current batch
+        size_t batch_start_ = 0;
+        std::string record_;
+        bool open_ = false;
+    };
+    
+    void append(const std::string& record) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!write_all(fd_, record.data(), record.size())) {
+            failed_ = true;
+        }
+    }
+    
+    const Vfs& inner_;
+    std::string file_;
+    int fd_ = -1;
+    mutable std::mutex mutex_;
+    mutable bool failed_ = false;
+};
+
+/**
+ * One scanner event for the Chrome trace, stored inline so recording never
+ * allocates
+ */
+struct TraceEvent {
+    enum Kind : uint8_t { Visit, Io, Wait, Steal, Queue };
+    
+    uint64_t start_ns;
+    uint64_t duration_ns;
+    uint64_t value;  // entries (Visit), victim worker (Steal), queued directories (Queue)
+    uint64_t io_ns;  // time a Visit spent in filesystem calls
+    Kind kind;
+    char name[87];   // tail of the directory path, or the call name for Io
+};
+
+/**
+ * Fixed-capacity event buffer owned by one scanner thread; once full, the
+ * oldest events are overwritten
+ */
+class TraceRing {
+public:
+    explicit TraceRing(size_t capacity) : events_(capacity) {}
+    
+    /**
+     * Slot for a new event
+     */
+    TraceEvent& next() {
+        return events_[recorded_++ % events_.size()];
+    }
+    
+    /**
+     * Events still held, oldest first
+     */
+    template <typename Visitor>
+    void for_each(Visitor visit) const {
+        const uint64_t first = dropped();
+        for (uint64_t i = first; i < recorded_; i++) {
+            visit(events_[i % events_.size()]);
+        }
+    }
+    
+    /**
+     * Events overwritten because the ring wrapped
+     */
+    uint64_t dropped() const { return recorded_ > events_.size() ? recorded_ - events_.size() : 0; }
+    
+    uint64_t last_queue_sample_ns = 0;
+    
+private:
+    std::vector<TraceEvent> events_;
+    uint64_t recorded_ = 0;
+};
+
+/**
+ * Timeline of a scan in Chrome Trace Event format (chrome://tracing,
+ * ui.perfetto.dev): directory visits and filesystem calls longer than a
+ * threshold, idle waits, work steals and the frontier depth.
+ *
+ * Each worker records into its own ring with steady_clock timestamps (a
+ * vDSO read), and nothing is formatted until write() runs after the scan.
+ */
+class ScanTrace {
+public:
+    static constexpr size_t RING_EVENTS = 16384;  // per worker, about 2 MB
+    static constexpr uint64_t QUEUE_SAMPLE_NS = 1000000;
+    
+    ScanTrace(unsigned workers, std::chrono::microseconds threshold)
+        : epoch_(std::chrono::steady_clock::now()),
+          threshold_ns_(static_cast<uint64_t>(threshold.count()) * 1000) {
+        for (unsigned i = 0; i < workers; i++) {
+            rings_.emplace_back(RING_EVENTS);
+        }
+    }
+    
+    TraceRing& ring(unsigned worker) { return rings_[worker]; }
+    
+    /**
+     * Nanoseconds since the trace started
+     */
+    uint64_t now() const {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - epoch_).count());
+    }
+    
+    /**
+     * Record a span on `ring` if it lasted at least the threshold, and
+     * return its length. Long names keep their tail, which is the
+     * informative end of a path.
+     */
+    uint64_t span(TraceRing& ring, TraceEvent::Kind kind, std::string_view name, uint64_t start_ns,
+                  uint64_t value = 0, uint64_t io_ns = 0) const {
+        const uint64_t duration_ns = now() - start_ns;
+        if (duration_ns >= threshold_ns_) {
+            record(ring, kind, name, start_ns, duration_ns, value, io_ns);
+        }
+        return duration_ns;
+    }
+    
+    /**
+     * Record an instant or counter event on `ring`
+     */
+    void mark(TraceRing& ring, TraceEvent::Kind kind, uint64_t value) const {
+        record(ring, kind, "", now(), 0, value, 0);
+    }
+    
+    /**
+     * Write every ring as one JSON trace
+     */
+    void write(const std::string& file, const std::string& root) const {
+        const auto pid = static_cast<uint64_t>(::getpid());
+        auto us = [](uint64_t ns) { return static_cast<double>(ns) / 1e3; };
+        write_json_file(file, [&](JsonWriter& json) {
+            uint64_t dropped = 0;
+            json.begin_object().key("displayTimeUnit").value("ms").key("traceEvents").begin_array();
+            json.begin_object().key("name").value("process_name").key("ph").value("M").key("pid").value(pid);
+            json.key("args").begin_object().key("name").value("advisor scan " + root).end_object().end_object();
+            for (size_t tid = 0; tid < rings_.size(); tid++) {
+                json.begin_object().key("name").value("thread_name").key("ph").value("M").key("pid").value(pid);
+                json.key("tid").value(static_cast<uint64_t>(tid));
+                json.key("args").begin_object().key("name").value("worker " + std::to_string(tid)).end_object();
+                json.end_object();
+                dropped += rings_[tid].dropped();
+                rings_[tid].for_each([&](const TraceEvent& event) {
+                    json.begin_object().key("pid").value(pid).key("tid").value(static_cast<uint64_t>(tid));
+                    json.key("ts").value(us(event.start_ns), 3);
+                    switch (event.kind) {
+                    case TraceEvent::Visit:
+                        json.key("ph").value("X").key("cat").value("dir").key("name").value(event.name);
+                        json.key("dur").value(us(event.duration_ns), 3);
+                        json.key("args").begin_object().key("entries").value(event.value);
+                        json.key("io_us").value(us(event.io_ns), 3).end_object();
+                        break;
+                    case TraceEvent::Io:
+                        json.key("ph").value("X").key("cat").value("io").key("name").value(event.name);
+                        json.key("dur").value(us(event.duration_ns), 3);
+                        break;
+                    case TraceEvent::Wait:
+                        json.key("ph").value("X").key("cat").value("sched").key("name").value("idle");
+                        json.key("dur").value(us(event.duration_ns), 3);
+                        break;
+                    case TraceEvent::Steal:
+                        json.key("ph").value("i").key("s").value("t").key("cat").value("sched").key("name").value("steal");
+                        json.key("args").begin_object().key("from").value(event.value).end_object();
+                        break;
+                    case TraceEvent::Queue:
+                        json.key("ph").value("C").key("name").value("frontier");
+                        json.key("args").begin_object().key("queued").value(event.value).end_object();
+                        break;
+                    }
+                    json.end_object();
+                });
+            }
+            json.end_array();
+            json.key("otherData").begin_object().key("dropped_events").value(dropped).end_object();
+            json.end_object().end_record();
+        });
+    }
+    
+private:
+    static void record(TraceRing& ring, TraceEvent::Kind kind, std::string_view name, uint64_t start_ns,
+                       uint64_t duration_ns, uint64_t value, uint64_t io_ns) {
+        TraceEvent& event = ring.next();
+        event.start_ns = start_ns;
+        event.duration_ns = duration_ns;
+        event.value = value;
+        event.io_ns = io_ns;
+        event.kind = kind;
+        if (name.size() >= sizeof(event.name)) {
+            name.remove_prefix(name.size() - (sizeof(event.name) - 1));
+        }
+        std::memcpy(event.name, name.data(), name.size());
+        event.name[name.size()] = '\0';
+    }
+    
+    std::chrono::steady_clock::time_point epoch_;
+    uint64_t threshold_ns_;
+    std::vector<TraceRing> rings_;
+};
+
+/**
+ * Set from SIGINT/SIGTERM/SIGHUP while a checkpointed scan is running
+ */
+volatile std::sig_atomic_t g_interrupted = 0;
+
+extern "C" void handle_interrupt_signal(int) {
+    g_interrupted = 1;
+}
+
+/**
+ * The expression of a `find` that deletes, compiled into a program for
+ * the scanner to run on every entry.
+ *
+ * Tests (-name, -iname, -path, -ipath, -type, -size, -mtime, -mmin,
+ * -newer), operators (!, -a, -o, ',' and parentheses) and actions
+ * (-delete, -exec/-execdir/-ok/-okdir running rm, -prune) become flat
+ * instructions around one boolean register, with -a and -o compiled to
+ * short-circuit jumps. Names, paths and types come from the directory
+ * listing; sizes and times are only asked for when an instruction that
+ * needs them is reached, and everything but directories already has them from the
+ * scanner's own stat. Global options (-maxdepth, -mindepth, -depth) are
+ * kept for the scanner. Anything else is refused rather than guessed.
+ */
+class FindProgram {
+public:
+    // What running the program on an entry does to it
+    enum Verdict : uint8_t {
+        KEEP = 0,
+        DELETE = 1,       // the entry itself (a directory only when it is empty by then)
+        DELETE_TREE = 2,  // rm -r: the directory and everything below
+        PRUNE = 4,        // do not descend
+    };
+    
+    // PendingDir::find: below an rm -r nothing is evaluated, everything goes
+    static constexpr uint8_t EVALUATE = 0;
+    static constexpr uint8_t REMOVED = 1;
+    
+    /**
+     * An entry as the scanner sees it; the path is dir + '/' + name, or
+     * `whole` for a start point
+     */
+    struct Candidate {
+        std::string_view dir;
+        std::string_view name;
+        std::string_view whole;
+        unsigned char type;  // DT_* type, links not followed
+        uint32_t depth;      // 0 for the start point
+    };
+    
+    /**
+     * Compile the expression part of a find command line
+     */
+    static FindProgram compile(const std::vector<std::string>& words) {
+        FindProgram program;
+        program.words_ = &words;
+        program.now_ns_ = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        if (!words.empty()) {
+            program.parse_list();
+            if (program.pos_ < words.size()) {
+                throw std::runtime_error("find: unexpected '" + words[program.pos_] + "'");
+            }
+        }
+        program.words_ = nullptr;
+        if (!program.deletes_) {
+            throw std::runtime_error("find: the expression neither deletes nor runs rm");
+        }
+        // GNU find refuses to run rather than delete what -prune was meant to protect
+        const bool prunes = std::any_of(program.code_.begin(), program.code_.end(),
+                                        [](const Instruction& in) { return in.op == Op::Prune; });
+        if (prunes && program.action_.find("-delete") != std::string::npos) {
+            throw std::runtime_error("find: -delete turns on -depth, which makes -prune do nothing; find refuses to run");
+        }
+        return program;
+    }
+    
+    uint32_t max_depth() const { return max_depth_; }
+    
+    /**
+     * True when a test needs modification times (-mtime, -mmin, -newer)
+     */
+    bool uses_time() const {
+        return std::any_of(code_.begin(), code_.end(),
+                           [](const Instruction& in) { return in.op == Op::Age || in.op == Op::Newer; });
+    }
+    
+    /**
+     * How the expression deletes, for the report: "-delete", "-exec rm -r", ...
+     */
+    const std::string& action() const { return action_; }
+    
+    /**
+     * Run the program on an entry; `stat` returns the entry's EntryStat
+     * (nullptr when it cannot be had) and is only called when needed
+     */
+    template <typename Stat>
+    uint8_t run(const Candidate& entry, Stat&& stat) const {
+        if (entry.depth < min_depth_) {
+            return KEEP;
+        }
+        uint8_t verdict = KEEP;
+        bool r = true;
+        for (size_t pc = 0; pc < code_.size(); pc++) {
+            const Instruction& in = code_[pc];
+            switch (in.op) {
+            case Op::Name:
+                r = glob_match(strings_[in.arg], entry.name);
+                break;
+            case Op::IName:
+                r = glob_match(strings_[in.arg], folded(entry.name));
+                break;
+            case Op::Path:
+            case Op::IPath: {
+                thread_local std::string path;
+                if (entry.whole.empty()) {
+                    path.assign(entry.dir);
+                    if (path.empty() || path.back() != '/') {
+                        path += '/';
+                    }
+                    path.append(entry.name);
+                } else {
+                    path.assign(entry.whole);
+                }
+                r = glob_match(strings_[in.arg], in.op == Op::IPath ? folded(path) : std::string_view(path));
+                break;
+            }
+            case Op::Type:
+                r = ((in.value >> entry.type) & 1) != 0;
+                break;
+            case Op::Size: {
+                const EntryStat* st = stat();
+                r = st != nullptr && compare((st->size + in.arg - 1) / in.arg, in.value, in.sign);
+                break;
+            }
+            case Op::Age: {
+                const EntryStat* st = stat();
+                const int64_t age = st != nullptr ? (now_ns_ - st->mtime_ns) / (int64_t{1000000000} * in.arg) : 0;
+                r = st != nullptr && compare(static_cast<uint64_t>(std::max<int64_t>(age, 0)), in.value, in.sign);
+                break;
+            }
+            case Op::Newer: {
+                const EntryStat* st = stat();
+                r = st != nullptr && st->mtime_ns > static_cast<int64_t>(in.value);
+                break;
+            }
+            case Op::True:
+                r = true;
+                break;
+            case Op::False:
+                r = false;
+                break;
+            case Op::Not:
+                r = !r;
+                break;
+            case Op::JumpIfFalse:
+                pc = r ? pc : in.arg - 1;
+                break;
+            case Op::JumpIfTrue:
+                pc = r ? in.arg - 1 : pc;
+                break;
+            case Op::Delete:
+                verdict |= DELETE;
+                r = true;
+                break;
+            case Op::Remove:
+                // rm without -r fails on a directory; a batched -exec ... + still counts as true
+                r = entry.type != DT_DIR || in.value != 0;
+                verdict |= entry.type != DT_DIR ? DELETE : KEEP;
+                break;
+            case Op::RemoveTree:
+                verdict |= entry.type == DT_DIR ? DELETE | DELETE_TREE : DELETE;
+                r = true;
+                break;
+            case Op::Prune:
+                // -delete implies -depth, and -prune does nothing then
+                verdict |= depth_first_ ? KEEP : PRUNE;
+                r = true;
+                break;
+            }
+        }
+        return verdict;
+    }
+    
+private:
+    enum class Op : uint8_t {
+        Name, IName, Path, IPath, Type, Size, Age, Newer,
+        True, False, Not, JumpIfFalse, JumpIfTrue,
+        Delete, Remove, RemoveTree, Prune,
+    };
+    
+    struct Instruction {
+        Op op;
+        int8_t sign = 0;     // -1, 0 or +1 for "-n", "n" and "+n"
+        uint32_t arg = 0;    // string index, jump target, size unit or time unit (seconds)
+        uint64_t value = 0;  // number, type mask, reference time or batch flag
+    };
+    
+    
+    static bool compare(uint64_t actual, uint64_t wanted, int8_t sign) {
+        return sign > 0 ? actual > wanted : sign < 0 ? actual < wanted : actual == wanted;
+    }
+    
+    static std::string_view folded(std::string_view text) {
+        thread_local std::string lower;
+        lower.assign(text);
+        std::transform(lower.begin(), lower.end(), lower.begin(),
+                       [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        return lower;
+    }
+    
+    bool at(std::string_view word) const { return pos_ < words_->size() && (*words_)[pos_] == word; }
+    
+    const std::string& argument(const std::string& option) {
+        if (pos_ >= words_->size()) {
+            throw std::runtime_error("find: missing argument to " + option);
+        }
+        return (*words_)[pos_++];
+    }
+    
+    /**
+     * "+n", "-n" or "n", with an optional unit suffix left in `suffix`
+     */
+    static uint64_t signed_number(const std::string& option, const std::string& text, int8_t& sign, char* suffix) {
+        const size_t start = text[0] == '+' || text[0] == '-' ? 1 : 0;
+        sign = text[0] == '+' ? 1 : text[0] == '-' ? -1 : 0;
+        uint64_t value = 0;
+        const char* end = text.data() + text.size();
+        const auto parsed = std::from_chars(text.data() + start, end, value);
+        const bool unit = suffix != nullptr && parsed.ptr + 1 == end;
+        if (parsed.ec != std::errc() || parsed.ptr == text.data() + start || (parsed.ptr != end && !unit)) {
+            throw std::runtime_error("find: invalid argument '" + text + "' to " + option);
+        }
+        if (suffix != nullptr) {
+            *suffix = unit ? *parsed.ptr : 'b';
+        }
+        return value;
+    }
+    
+    void emit(Instruction in) { code_.push_back(in); }
+    
+    // expression [, expression]...
+    void parse_list() {
+        parse_or();
+        while (at(",")) {
+            pos_++;
+            parse_or();
+        }
+    }
+    
+    void parse_or() {
+        parse_and();
+        while (at("-o") || at("-or")) {
+            pos_++;
+            const size_t jump = code_.size();
+            emit({Op::JumpIfTrue});
+            parse_and();
+            code_[jump].arg = static_cast<uint32_t>(code_.size());
+        }
+    }
+    
+    void parse_and() {
+        parse_unary();
+        while (pos_ < words_->size() && !at(")") && !at(",") && !at("-o") && !at("-or")) {
+            if (at("-a") || at("-and")) {
+                pos_++;
+            }
+            const size_t jump = code_.size();
+            emit({Op::JumpIfFalse});
+            parse_unary();
+            code_[jump].arg = static_cast<uint32_t>(code_.size());
+        }
+    }
+    
+    void parse_unary() {
+        if (pos_ >= words_->size()) {
+            throw std::runtime_error("find: expected an expression");
+        }
+        if (at("!") || at("-not")) {
+            pos_++;
+            parse_unary();
+            emit({Op::Not});
+        } else if (at("(")) {
+            pos_++;
+            parse_list();
+            if (!at(")")) {
+                throw std::runtime_error("find: missing ')'");
+            }
+            pos_++;
+        } else {
+            parse_primary();
+        }
+    }
+    
+    void parse_primary() {
+        const std::string option = (*words_)[pos_++];
+        if (option == "-name" || option == "-iname" || option == "-path" || option == "-ipath" ||
+            option == "-wholename" || option == "-iwholename") {
+            std::string pattern = argument(option);
+            const bool fold = option[1] == 'i';
+            if (fold) {
+                pattern = std::string(folded(pattern));
+            }
+            const bool name = option == "-name" || option == "-iname";
+            strings_.push_back(std::move(pattern));
+            emit({name ? (fold ? Op::IName : Op::Name) : (fold ? Op::IPath : Op::Path), 0,
+                  static_cast<uint32_t>(strings_.size() - 1), 0});
+        } else if (option == "-type") {
+            // One bit per DT_* type; Solaris doors (D) never occur here
+            constexpr std::string_view letters = "bcdpflsD";
+            constexpr unsigned char dt[] = {DT_BLK, DT_CHR, DT_DIR, DT_FIFO, DT_REG, DT_LNK, DT_SOCK, DT_UNKNOWN};
+            uint64_t mask = 0;
+            const std::string& types = argument(option);
+            for (size_t i = 0; i < types.size(); i += 2) {
+                const size_t letter = letters.find(types[i]);
+                if (letter == std::string_view::npos || (i + 1 < types.size() && types[i + 1] != ',')) {
+                    throw std::runtime_error("find: unknown argument to -type: " + types);
+                }
+                mask |= types[i] == 'D' ? 0 : uint64_t{1} << dt[letter];
+            }
+            emit({Op::Type, 0, 0, mask});
+        } else if (option == "-size") {
+            char unit = 'b';
+            Instruction in{Op::Size};
+            in.value = signed_number(option, argument(option), in.sign, &unit);
+            const char* units = "cwbkMG";
+            const uint32_t sizes[] = {1, 2, 512, 1024, 1024 * 1024, 1024 * 1024 * 1024};
+            const char* found = std::strchr(units, unit);
+            if (found == nullptr || unit == '\0') {
+                throw std::runtime_error("find: invalid unit in -size");
+            }
+            in.arg = sizes[found - units];
+            emit(in);
+        } else if (option == "-mtime" || option == "-mmin") {
+            Instruction in{Op::Age};
+            in.value = signed_number(option, argument(option), in.sign, nullptr);
+            in.arg = option == "-mtime" ? 86400 : 60;
+            emit(in);
+        } else if (option == "-newer") {
+            const std::string& reference = argument(option);
+            struct stat info{};
+            if (::stat(reference.c_str(), &info) != 0) {
+                throw std::runtime_error("find: " + reference + ": " + std::strerror(errno));
+            }
+            const int64_t mtime = static_cast<int64_t>(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+            emit({Op::Newer, 0, 0, static_cast<uint64_t>(mtime)});
+        } else if (option == "-maxdepth" || option == "-mindepth") {
+            int8_t sign = 0;
+            const uint64_t depth = signed_number(option, argument(option), sign, nullptr);
+            if (sign != 0) {
+                throw std::runtime_error("find: " + option + " takes a plain number");
+            }
+            (option == "-maxdepth" ? max_depth_ : min_depth_) = static_cast<uint32_t>(std::min<uint64_t>(depth, UINT32_MAX));
+            emit({Op::True});
+        } else if (option == "-depth" || option == "-d") {
+            depth_first_ = true;
+            emit({Op::True});
+        } else if (option == "-delete") {
+            depth_first_ = true;
+            note_action("-delete");
+            emit({Op::Delete});
+        } else if (option == "-exec" || option == "-execdir" || option == "-ok" || option == "-okdir") {
+            parse_exec(option);
+        } else if (option == "-prune") {
+            emit({Op::Prune});
+        } else if (option == "-true" || option == "-print" || option == "-print0" || option == "-ls" ||
+                   option == "-noleaf" || option == "-ignore_readdir_race" || option == "-mount" || option == "-xdev") {
+            emit({Op::True});
+        } else if (option == "-false") {
+            emit({Op::False});
+        } else {
+            throw std::runtime_error("find: " + option + " is not evaluated by advisor");
+        }
+    }
+    
+    /**
+     * -exec COMMAND ... ; or + : only rm deletes anything
+     */
+    void parse_exec(const std::string& option) {
+        const size_t start = pos_;
+        while (pos_ < words_->size() && (*words_)[pos_] != ";" && !((*words_)[pos_] == "+" && (*words_)[pos_ - 1] == "{}")) {
+            pos_++;
+        }
+        if (pos_ >= words_->size() || pos_ == start) {
+            throw std::runtime_error("find: missing argument to " + option);
+        }
+        const bool batch = (*words_)[pos_] == "+";
+        const std::string_view command = (*words_)[start];
+        bool recursive = false;
+        for (size_t i = start + 1; i < pos_ && (*words_)[i] != "--"; i++) {
+            const std::string& word = (*words_)[i];
+            recursive |= word == "--recursive" ||
+                         (word.size() > 1 && word[0] == '-' && word[1] != '-' && word.find_first_of("rR") != std::string::npos);
+        }
+        pos_++;
+        if (command.substr(command.rfind('/') + 1) != "rm") {
+            emit({Op::True});
+            return;
+        }
+        note_action(option + (recursive ? " rm -r" : " rm"));
+        emit({recursive ? Op::RemoveTree : Op::Remove, 0, 0, batch ? 1u : 0u});
+    }
+    
+    void note_action(const std::string& action) {
+        deletes_ = true;
+        if (action_.find(action) == std::string::npos) {
+            action_.append(action_.empty() ? "" : ", ").append(action);
+        }
+    }
+    
+    std::vector<Instruction> code_;
+    std::vector<std::string> strings_;
+    uint32_t max_depth_ = UINT32_MAX;
+    uint32_t min_depth_ = 0;
+    bool depth_first_ = false;
+    bool deletes_ = false;
+    std::string action_;
+    int64_t now_ns_ = 0;
+    
+    // While compiling
+    const std::vector<std::string>* words_ = nullptr;
+    size_t pos_ = 0;
+};
+
+/**
+ * Multi-threaded directory walker behind analyze_folder().
+ *
+ * Workers share one frontier of pending directories. Each worker scans a
+ * directory into its own partial result and pushes the subdirectories back
+ * onto the frontier, so the scan ends once the frontier is empty and no
+ * worker is busy. When the governor is enabled, a supervisor thread adjusts
+ * how many workers may run (AIMD on PSI stall time and CPU use).
+ *
+ * With scan history, subtrees that were large last time are split into
+ * per-directory tasks and dispatched largest first, while subtrees known to
+ * be small are walked to completion by the worker that found them.
+ *
+ * A work unit (one frontier directory plus any subtrees walked inline) is
+ * accumulated privately and committed under the frontier lock together with
+ * the subdirectories it discovered, so a checkpoint taken under that lock
+ * always sees a consistent cut: committed totals plus the directories still
+ * queued or in flight.
+ *
+ * Directories are DirNodes carved from per-worker arenas, file names never
+ * leave the DirReader buffer and extensions are looked up in place, so once
+ * the buffers are warm the per-entry path does not allocate.
+ */
+class ScanEngine {
+public:
+    ScanEngine(const Vfs& vfs, TraversalPolicy policy, unsigned jobs, const GovernorOptions& governor,
+               const ScanHistory& history, const MemoryLimits& limits)
+        : policy_(policy), jobs_(jobs), governor_(governor), history_(history), limits_(limits),
+          limiter_(governor.max_iops), frontier_spill_(limits.spill_buffer), allowed_(governor.enabled ? 1 : jobs),
+          tracked_paths_(limits.tracked_path_bytes), workers_(jobs) {
+        for (auto& worker : workers_) {
+            worker.result = fresh_result();
+            worker.unit = fresh_result();
+            worker.reader = vfs.reader();
+            worker.reader->count_into(worker.syscalls);
+        }
+    }
+    
+    /**
+     * Continue from a checkpoint instead of starting at the root
+     */
+    void restore(ScanCheckpoint checkpoint) {
+        resumed_ = true;
+        workers_[0].result = std::move(checkpoint.result);
+        workers_[0].result.file_types.set_capacity(limits_.file_types);
+        resume_frontier_ = std::move(checkpoint.frontier);
+    }
+    
+    /**
+     * Periodically persist progress to `file` while run() is scanning
+     */
+    void enable_checkpoints(std::string file, std::string canonical_root, std::chrono::seconds interval) {
+        checkpoint_file_ = std::move(file);
+        checkpoint_root_ = std::move(canonical_root);
+        checkpoint_interval_ = interval;
+    }
+    
+    /**
+     * Report committed totals to `callback` every interval while run() is
+     * scanning; the callback runs on its own thread, without locks held
+     */
+    void enable_progress(std::function<void(const ScanProgress&)> callback, std::chrono::milliseconds interval) {
+        progress_ = std::move(callback);
+        progress_interval_ = interval;
+    }
+    
+    /**
+     * Record a timeline of the scan into `trace`, which needs one ring per
+     * worker
+     */
+    void enable_trace(ScanTrace& trace) {
+        trace_ = &trace;
+        for (unsigned id = 0; id < jobs_; id++) {
+            workers_[id].trace = &trace.ring(id);
+        }
+    }
+    
+    /**
+     * Wind run() down early, with partial totals, once `cancel` is set
+     */
+    void enable_cancel(const std::atomic<bool>& cancel) { cancel_ = &cancel; }
+    
+    /**
+     * Wind run() down early once more than `bytes` or `files` (0: no
+     * limit) have been seen
+     */
+    void enable_limits(uint64_t bytes, uint64_t files) {
+        limit_bytes_ = bytes;
+        limit_files_ = files;
+    }
+    
+    /**
+     * Count only what `program` deletes. `root_verdict` is what it does to
+     * the root itself, which the caller evaluated: under an rm -r everything
+     * is counted, and a pruned root is not scanned at all.
+     */
+    void enable_find(const FindProgram& program, uint8_t root_verdict) {
+        find_ = &program;
+        find_root_ = (root_verdict & FindProgram::DELETE_TREE) != 0 ? FindProgram::REMOVED : FindProgram::EVALUATE;
+        find_skips_root_ = find_root_ == FindProgram::EVALUATE &&
+                           ((root_verdict & FindProgram::PRUNE) != 0 || program.max_depth() == 0);
+    }
+    
+    /**
+     * Match every directory below the root against `policy`, which the
+     * root (`canonical_root` on the host) was already matched against by
+     * the caller; run() stops at the first Critical match
+     */
+    void enable_protection(const ProtectionPolicy& policy, const std::string& canonical_root) {
+        protection_ = &policy;
+        protection_root_ = canonical_root;
+        protection_start_ = policy.walk(policy.start(), canonical_root);
+    }
+    
+    /**
+     * Protected directories found inside the root by the last run(),
+     * the shallowest one per rule
+     */
+    std::vector<ProtectedMatch> protected_contents() const {
+        std::vector<ProtectedMatch> matches;
+        std::vector<const ProtectedHit*> first;
+        for (const auto& worker : workers_) {
+            for (const auto& hit : worker.protected_hits) {
+                auto found = std::find_if(first.begin(), first.end(),
+                    [&](const ProtectedHit* seen) { return seen->rule == hit.rule; });
+                if (found == first.end()) {
+                    first.push_back(&hit);
+                    const auto& rule = protection_->rule(hit.rule);
+                    matches.push_back({Protection::Contains, rule.severity, rule.pattern, hit.path, hit.count});
+                    continue;
+                }
+                ProtectedMatch& match = matches[static_cast<size_t>(found - first.begin())];
+                match.count += hit.count;
+                if (std::make_pair(hit.depth, hit.path) < std::make_pair((*found)->depth, (*found)->path)) {
+                    *found = &hit;
+                    match.path = hit.path;
+                }
+            }
+        }
+        std::sort(matches.begin(), matches.end(), [](const ProtectedMatch& a, const ProtectedMatch& b) {
+            return std::make_pair(b.severity, a.path) < std::make_pair(a.severity, b.path);
+        });
+        return matches;
+    }
+    
+    /**
+     * Totals of each target given to the last run(), in the same order
+     */
+    std::vector<TargetTotals> target_totals() const {
+        std::vector<TargetTotals> totals(targets_.size());
+        for (size_t i = 0; i < targets_.size(); i++) {
+            append_path(target_nodes_[i], totals[i].path);
+            for (const auto& worker : workers_) {
+                totals[i].files += worker.target_totals[i].files;
+                totals[i].directories += worker.target_totals[i].directories;
+                totals[i].bytes += worker.target_totals[i].bytes;
+            }
+        }
+        return totals;
+    }
+    
+    /**
+     * High-value files and directories found by the last run(), with the
+     * shallowest SENSITIVE_SAMPLES of each kind
+     */
+    std::vector<SensitiveFinding> sensitive_files() const {
+        std::vector<SensitiveFinding> findings;
+        for (size_t kind = 0; kind < static_cast<size_t>(SensitiveKind::Count); kind++) {
+            SensitiveFinding finding;
+            std::vector<std::pair<uint32_t, std::string>> samples;
+            for (const auto& worker : workers_) {
+                finding.count += worker.sensitive[kind].count;
+                samples.insert(samples.end(), worker.sensitive[kind].samples.begin(),
+                               worker.sensitive[kind].samples.end());
+            }
+            if (finding.count == 0) {
+                continue;
+            }
+            std::sort(samples.begin(), samples.end());
+            samples.resize(std::min(samples.size(), SENSITIVE_SAMPLES));
+            finding.category = SENSITIVE_KIND_NAMES[kind];
+            for (auto& sample : samples) {
+                finding.samples.push_back({std::move(sample.second), ""});
+            }
+            findings.push_back(std::move(finding));
+        }
+        return findings;
+    }
+    
+    /**
+     * True when run() stopped at a Critical protected directory
+     */
+    bool protected_stop() const { return protected_stop_.load(std::memory_order_relaxed); }
+    
+    /**
+     * True when run() stopped because a limit from enable_limits() was crossed
+     */
+    bool over_limit() const { return over_limit_.load(std::memory_order_relaxed); }
+    
+    /**
+     * True when run() returned early because of a signal
+     */
+    bool interrupted() const { return interrupted_; }
+    
+    /**
+     * True when run() returned before walking the whole tree
+     */
+    bool stopped_early() const { return stopped_early_; }
+    
+    /**
+     * True when the scan continued from a checkpoint
+     */
+    bool resumed() const { return resumed_; }
+    
+    /**
+     * Scan everything below root and return the merged statistics. With
+     * `targets` (paths relative to root, none inside another) only those
+     * subtrees are scanned, all on the same workers, and target_totals()
+     * tells them apart.
+     */
+    AnalysisResult run(const std::string& root, const std::vector<std::string>& targets = {}) {
+        root_size_ = root.size();
+        root_node_ = arena_.make(pool_, nullptr, root);
+        uint64_t root_weight = history_.lookup("");
+        if (!targets.empty()) {
+            root_weight = 0;
+            for (const auto& target : targets) {
+                root_weight += history_.lookup(target);
+            }
+        }
+        // Subtrees below this share of the whole tree are not worth splitting
+        split_threshold_ = std::max<uint64_t>(1, root_weight / (uint64_t{jobs_} * 16));
+        tracked_.push_back({tracked_paths_.append(root), static_cast<uint32_t>(root.size()), 0});
+        if (!targets.empty()) {
+            targets_ = targets;
+            for (auto& worker : workers_) {
+                worker.target_totals.assign(targets.size(), {});
+            }
+            std::string path;
+            for (const auto& target : targets) {
+                // Kept for target_of(), whose pointer comparisons need the nodes alive
+                DirNode* node = arena_.make(pool_, root_node_, target);
+                target_nodes_.push_back(node);
+                path.clear();
+                append_path(node, path);
+                PendingDir dir{history_.lookup(target), UINT64_MAX - sequence_++, BlockPool::retain(node), 0,
+                               static_cast<uint32_t>(tracked_.size()), PendingDir::NO_OWNER,
+                               protection_ == nullptr ? ProtectionPolicy::DEAD
+                                                      : protection_->walk(protection_start_, target)};
+                target_protection_.push_back(dir.protection);
+                tracked_.push_back({tracked_paths_.append(path), static_cast<uint32_t>(path.size()), 0});
+                push_shared(dir);
+            }
+        } else if (resumed_) {
+            for (auto& [dir, relative] : resume_frontier_) {
+                dir.node = make_reloaded(relative);
+                dir.protection = reloaded_protection(relative);
+                push_shared(dir);
+            }
+            resume_frontier_ = {};
+        } else if (!find_skips_root_) {
+            push_shared({root_weight, 0, BlockPool::retain(root_node_), 0, 0, PendingDir::NO_OWNER, protection_start_,
+                         find_root_});
+        }
+        if (!has_work()) {
+            done_ = true;
+        }
+        
+        std::thread supervisor;
+        if (governor_.enabled || governor_.max_cpu_percent > 0) {
+            supervisor = std::thread(&ScanEngine::govern, this);
+        }
+        std::thread checkpointer;
+        if (!checkpoint_file_.empty()) {
+            checkpointer = std::thread(&ScanEngine::checkpoint_loop, this);
+        }
+        std::thread reporter;
+        if (progress_) {
+            reporter = std::thread(&ScanEngine::progress_loop, this);
+        }
+        
+        // The calling thread doubles as worker 0
+        std::vector<std::thread> workers;
+        for (unsigned id = 1; id < jobs_; id++) {
+            workers.emplace_back(&ScanEngine::work, this, id);
+        }
+        work(0);
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        if (supervisor.joinable()) {
+            supervisor.join();
+        }
+        if (checkpointer.joinable()) {
+            checkpointer.join();
+        }
+        if (reporter.joinable()) {
+            reporter.join();
+        }
+        if (interrupted_) {
+            // Workers have committed their last units; persist what is left
+            const uint64_t spill_end = frontier_spill_.size();
+            ScanCheckpoint::write_file(checkpoint_file_, encode_checkpoint(), &frontier_spill_,
+                                       spill_read_, spill_end);
+        }
+        
+        for (DirNode* node : target_nodes_) {
+            pool_.release(node);
+        }
+        
+        const PhaseTimer aggregate;
+        AnalysisResult result = committed_result();
+        for (auto& worker : workers_) {
+            worker.result = AnalysisResult();
+        }
+        aggregate_ = aggregate.elapsed();
+        return result;
+    }
+    
+    /**
+     * Time run() spent merging the per-worker results
+     */
+    const PhaseStats& aggregate_time() const { return aggregate_; }
+    
+    /**
+     * How each worker spent the last run
+     */
+    std::vector<ThreadStats> thread_stats() const {
+        std::vector<ThreadStats> threads;
+        for (const auto& worker : workers_) {
+            threads.push_back(worker.stats);
+        }
+        return threads;
+    }
+    
+    /**
+     * Filesystem calls made by all workers so far
+     */
+    SyscallCounts syscalls() const {
+        SyscallCounts total;
+        for (const auto& worker : workers_) {
+            total += worker.syscalls;
+        }
+        return total;
+    }
+    
+    /**
+     * Entries below each directory in the top ScanHistory::MAX_DEPTH levels
+     * of the last run, as (entries, path) pairs
+     */
+    std::vector<std::pair<uint64_t, std::string>> subtree_sizes() {
+        std::vector<uint64_t> totals(tracked_.size(), 0);
+        for (const auto& worker : workers_) {
+            for (size_t i = 0; i < worker.bucket_entries.size(); i++) {
+                totals[i] += worker.bucket_entries[i];
+            }
+        }
+        // Children are always registered after their parent
+        for (size_t i = totals.size(); i-- > 1;) {
+            totals[tracked_[i].parent] += totals[i];
+        }
+        
+        std::vector<std::pair<uint64_t, std::string>> sizes;
+        for (size_t i = 0; i < totals.size(); i++) {
+            if (totals[i] >= ScanHistory::MIN_ENTRIES) {
+                std::string path;
+                tracked_paths_.read(tracked_[i].offset, tracked_[i].length, path);
+                sizes.emplace_back(totals[i], std::move(path));
+            }
+        }
+        return sizes;
+    }
+    
+private:
+    // Governor tuning: sampling period and PSI stall percentages
+    static constexpr auto GOVERNOR_TICK = std::chrono::milliseconds(250);
+    static constexpr double PRESSURE_HIGH = 10.0;
+    static constexpr double PRESSURE_LOW = 2.0;
+    // Files counted between checks of --block-over thresholds
+    static constexpr uint64_t LIMIT_CHECK_FILES = 256;
+    static constexpr uint64_t SENSITIVE_DIRECTORIES = sensitive_directory_bits();
+    
+    /**
+     * A protection rule matched inside the root, with the shallowest
+     * directory this worker saw it match
+     */
+    struct ProtectedHit {
+        uint32_t rule;
+        uint32_t depth;
+        uint64_t count;
+        std::string path;
+    };
+    
+    /**
+     * Sensitive files of one kind seen by a worker, with the shallowest
+     * SENSITIVE_SAMPLES as (depth, path)
+     */
+    struct SensitiveTally {
+        uint64_t count = 0;
+        std::vector<std::pair<uint32_t, std::string>> samples;
+    };
+    
+    /**
+     * Where the largest file of a result lives: its directory (retained)
+     * and its name, joined into a path only when reported
+     */
+    struct LargestFile {
+        DirNode* dir = nullptr;
+        std::string name;
+    };
+    
+    /**
+     * Per-worker accumulators, merged once the scan finishes
+     */
+    struct WorkerState {
+        AnalysisResult result;                 // committed units, guarded by mutex_
+        AnalysisResult unit;                   // the unit being scanned
+        LargestFile largest;                   // of `result`, guarded by mutex_
+        LargestFile unit_largest;              // of `unit`
+        std::optional<PendingDir> in_flight;   // frontier entry of that unit, guarded by mutex_
+        std::vector<uint64_t> bucket_entries;  // entries per tracked_ slot
+        std::vector<PendingDir> local;         // small subtrees this worker walks alone
+        std::vector<RawEntry> entries;         // reused directory read buffer
+        std::unique_ptr<VfsReader> reader;
+        SyscallCounts syscalls;
+        ThreadStats stats;
+        TraceRing* trace = nullptr;  // this worker's ring when tracing
+        NodeArena arena;
+        std::string path;        // full path of the directory being scanned
+        std::string child_path;  // scratch for subdirectory paths
+        std::string key;         // scratch for history lookups
+        uint64_t sequence = 0;
+        std::vector<ProtectedHit> protected_hits;
+        std::vector<TargetTotals> target_totals;  // committed, per run() target; counts only
+        SensitiveTally sensitive[static_cast<size_t>(SensitiveKind::Count)];
+    };
+    
+    /**
+     * A directory whose subtree size is recorded for the next scan; its
+     * path lives in tracked_paths_
+     */
+    struct TrackedDir {
+        uint64_t offset;
+        uint32_t length;
+        uint32_t parent;
+    };
+    
+    /**
+     * An empty result whose extension table respects the memory limits
+     */
+    AnalysisResult fresh_result() const {
+        AnalysisResult result;
+        result.file_types.set_capacity(limits_.file_types);
+        return result;
+    }
+    
+    /**
+     * Merge the committed results of all workers, rebuilding the path of
+     * the largest file from its directory node.
+     * Requires mutex_, or that all workers have exited.
+     */
+    AnalysisResult committed_result() const {
+        AnalysisResult committed = fresh_result();
+        const WorkerState* largest = nullptr;
+        for (const auto& worker : workers_) {
+            merge_result(committed, worker.result);
+            if (largest == nullptr || worker.result.largest_file_size > largest->result.largest_file_size) {
+                largest = &worker;
+            }
+        }
+        // A result restored from a checkpoint keeps its path until a unit beats it
+        if (largest != nullptr && largest->largest.dir != nullptr) {
+            std::string& path = committed.largest_file_path;
+            path.clear();
+            append_path(largest->largest.dir, path);
+            if (path.back() != '/') {
+                path += '/';
+            }
+            path += largest->largest.name;
+        }
+        return committed;
+    }
+    
+    /**
+     * Point `file` at `name` inside `dir`, releasing the previous directory
+     */
+    void set_largest(LargestFile& file, DirNode* dir, const char* name) {
+        if (dir != nullptr) {
+            BlockPool::retain(dir);
+        }
+        if (file.dir != nullptr) {
+            pool_.release(file.dir);
+        }
+        file.dir = dir;
+        file.name.assign(name);
+    }
+    
+    /**
+     * Node for a directory read back from a checkpoint or the spill file.
+     * The whole relative path becomes one name below the root.
+     * Requires mutex_ once workers are running.
+     */
+    DirNode* make_reloaded(const std::string& relative) {
+        if (relative.empty()) {
+            return BlockPool::retain(root_node_);
+        }
+        return arena_.make(pool_, root_node_, relative);
+    }
+    
+    /**
+     * Index of the run() target a directory belongs to
+     */
+    size_t target_of(const DirNode* node) const {
+        while (node->parent != root_node_) {
+            node = node->parent;
+        }
+        for (size_t i = 0; i < target_nodes_.size(); i++) {
+            if (target_nodes_[i] == node) {
+                return i;
+            }
+        }
+        // A reloaded directory's name is its whole path below the root
+        const std::string_view name(node->name(), node->length);
+        for (size_t i = 0; i < targets_.size(); i++) {
+            if (name.substr(0, targets_[i].size()) == targets_[i] &&
+                (name.size() == targets_[i].size() || name[targets_[i].size()] == '/')) {
+                return i;
+            }
+        }
+        return 0;
+    }
+    
+    /**
+     * ProtectionPolicy state of a reloaded directory, which checkpoints and
+     * the spill file do not store
+     */
+    uint32_t reloaded_protection(const std::string& relative) const {
+        return protection_ == nullptr ? ProtectionPolicy::DEAD : protection_->walk(protection_start_, relative);
+    }
+    
+    /**
+     * True while directories are queued in memory or spilled to disk.
+     * Requires mutex_.
+     */
+    bool has_work() const { return !frontier_.empty() || spilled_ > 0; }
+    
+    /**
+     * Queue a directory on the shared frontier, spilling it to disk when the
+     * in-memory heap is at its limit. Requires mutex_.
+     */
+    void push_shared(PendingDir dir) {
+        if (frontier_.size() < limits_.frontier_entries) {
+            push_pending(frontier_, std::move(dir));
+            return;
+        }
+        spill_record_.clear();
+        relative_path_.clear();
+        append_relative_path(dir.node, relative_path_);
+        encode_pending(spill_record_, dir, relative_path_);
+        // Checkpoints copy spilled records, but are never taken with a find expression
+        if (find_ != nullptr) {
+            put_varint(spill_record_, dir.find);
+        }
+        frontier_spill_.append(spill_record_);
+        spilled_++;
+        pool_.release(dir.node);
+    }
+    
+    /**
+     * Pop the next shared directory, reloading spilled ones once the
+     * in-memory heap runs dry. Requires mutex_ and has_work().
+     */
+    PendingDir pop_shared() {
+        if (frontier_.empty()) {
+            const size_t target = std::max<size_t>(1, limits_.frontier_entries / 2);
+            while (spilled_ > 0 && frontier_.size() < target) {
+                const uint64_t available = frontier_spill_.size() - spill_read_;
+                frontier_spill_.read(spill_read_, static_cast<size_t>(std::min<uint64_t>(available, limits_.spill_buffer)),
+                                     spill_chunk_);
+                ByteReader reader{spill_chunk_};
+                PendingDir dir{};
+                uint64_t find = 0;
+                for (size_t start = reader.pos; spilled_ > 0 && frontier_.size() < target; start = reader.pos) {
+                    if (!decode_pending(reader, dir, relative_path_) || (find_ != nullptr && !reader.varint(find))) {
+                        reader.pos = start;
+                        break;
+                    }
+                    dir.find = static_cast<uint8_t>(find);
+                    dir.node = make_reloaded(relative_path_);
+                    dir.protection = reloaded_protection(relative_path_);
+                    push_pending(frontier_, dir);
+                    spilled_--;
+                }
+                spill_read_ += reader.pos;
+            }
+        }
+        return pop_pending(frontier_);
+    }
+    
+    /**
+     * Worker loop: pop a directory, scan it, publish its subdirectories
+     */
+    void work(unsigned id) {
+        WorkerState& state = workers_[id];
+        std::vector<PendingDir> shared;
+#if ADVISOR_STATS
+        const auto cpu_start = thread_cpu_time();
+#endif
+        Stopwatch clock;
+        
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;) {
+            state.stats.busy_ns += clock.lap();
+            const uint64_t wait_start = state.trace != nullptr ? trace_->now() : 0;
+            work_cv_.wait(lock, [&] {
+                return done_ || stopping_ || (id < allowed_ && has_work());
+            });
+            state.stats.idle_ns += clock.lap();
+            if (state.trace != nullptr) {
+                trace_->span(*state.trace, TraceEvent::Wait, "", wait_start);
+            }
+            if (done_ || stopping_) {
+#if ADVISOR_STATS
+                state.stats.cpu_ns = static_cast<uint64_t>((thread_cpu_time() - cpu_start).count());
+#endif
+                return;
+            }
+            
+            state.in_flight = pop_shared();
+            busy_++;
+            ADVISOR_COUNT(state.stats.units);
+            if (state.in_flight->owner != id && state.in_flight->owner != PendingDir::NO_OWNER) {
+                ADVISOR_COUNT(state.stats.steals);
+                if (state.trace != nullptr) {
+                    trace_->mark(*state.trace, TraceEvent::Steal, state.in_flight->owner);
+                }
+            }
+            
+            lock.unlock();
+            scan_directory(*state.in_flight, state, shared);
+            while (!state.local.empty()) {
+                const PendingDir dir = pop_pending(state.local);
+                if (!stop_requested()) {
+                    scan_directory(dir, state, shared);
+                }
+                pool_.release(dir.node);
+            }
+            lock.lock();
+            
+            // Commit the unit and its subdirectories in one step
+            busy_--;
+            if (!targets_.empty()) {
+                TargetTotals& totals = state.target_totals[target_of(state.in_flight->node)];
+                totals.files += state.unit.total_files;
+                totals.directories += state.unit.total_directories;
+                totals.bytes += state.unit.total_size;
+            }
+            pool_.release(state.in_flight->node);
+            state.in_flight.reset();
+            if (state.unit.largest_file_size > state.result.largest_file_size) {
+                std::swap(state.largest, state.unit_largest);
+            }
+            set_largest(state.unit_largest, nullptr, "");
+            merge_result(state.result, state.unit);
+            reset_result(state.unit);
+            for (auto& child : shared) {
+                if (policy_ != TraversalPolicy::InodeOrder) {
+                    child.key = UINT64_MAX - sequence_++;
+                }
+                child.owner = id;
+                push_shared(std::move(child));
+            }
+            if (state.trace != nullptr &&
+                trace_->now() - state.trace->last_queue_sample_ns >= ScanTrace::QUEUE_SAMPLE_NS) {
+                state.trace->last_queue_sample_ns = trace_->now();
+                trace_->mark(*state.trace, TraceEvent::Queue, frontier_.size() + spilled_);
+            }
+            
+            if (stop_requested() && !stopping_) {
+                stopping_ = true;
+                stopped_early_ = true;
+                work_cv_.notify_all();
+                governor_cv_.notify_all();
+                progress_cv_.notify_all();
+            } else if (!has_work() && busy_ == 0) {
+                done_ = true;
+                work_cv_.notify_all();
+                governor_cv_.notify_all();
+                checkpoint_cv_.notify_all();
+                progress_cv_.notify_all();
+            } else if (!shared.empty()) {
+                work_cv_.notify_all();
+            }
+            shared.clear();
+        }
+    }
+    
+    /**
+     * True once the scan should stop early; checked between directories
+     * and directory batches, so a worker notices within one of them
+     */
+    bool stop_requested() const {
+        return over_limit_.load(std::memory_order_relaxed) || protected_stop_.load(std::memory_order_relaxed) ||
+               (cancel_ != nullptr && cancel_->load(std::memory_order_relaxed));
+    }
+    
+    /**
+     * Add what a directory batch contributed to the scan-wide totals that
+     * the limits are checked against
+     */
+    void count_toward_limits(uint64_t files, uint64_t bytes) {
+        const uint64_t files_seen = files_seen_.fetch_add(files, std::memory_order_relaxed) + files;
+        const uint64_t bytes_seen = bytes_seen_.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+        if ((limit_files_ > 0 && files_seen > limit_files_) || (limit_bytes_ > 0 && bytes_seen > limit_bytes_)) {
+            over_limit_.store(true, std::memory_order_relaxed);
+        }
+    }
+    
+    /**
+     * Note a directory inside the root that protection rules match, other
+     * than the rules the root itself matches
+     */
+    void record_protected(const PendingDir& dir, WorkerState& state) {
+        const uint32_t top = targets_.empty() ? protection_start_ : target_protection_[target_of(dir.node)];
+        const std::vector<uint32_t>& root_rules = protection_->accepts(top);
+        for (const uint32_t rule : protection_->accepts(dir.protection)) {
+            if (std::find(root_rules.begin(), root_rules.end(), rule) != root_rules.end()) {
+                continue;
+            }
+            auto hit = std::find_if(state.protected_hits.begin(), state.protected_hits.end(),
+                                    [&](const ProtectedHit& seen) { return seen.rule == rule; });
+            if (hit == state.protected_hits.end()) {
+                hit = state.protected_hits.insert(hit, {rule, UINT32_MAX, 0, ""});
+            }
+            hit->count++;
+            if (dir.depth <= hit->depth) {
+                std::string path = protection_root_;
+                if (path.back() != '/') {
+                    path += '/';
+                }
+                append_relative_path(dir.node, path);
+                if (dir.depth < hit->depth || path < hit->path) {
+                    hit->depth = dir.depth;
+                    hit->path = std::move(path);
+                }
+            }
+            if (protection_->rule(rule).severity == Severity::Critical) {
+                protected_stop_.store(true, std::memory_order_relaxed);
+            }
+        }
+    }
+    
+    /**
+     * Count an entry that SENSITIVE_PATTERNS `bits` match, keeping its path
+     * while it is among the worker's shallowest of its kind
+     */
+    void record_sensitive(uint64_t bits, const PendingDir& dir, const char* name, WorkerState& state) {
+        const size_t index = static_cast<size_t>(__builtin_ctzll(bits));
+        SensitiveTally& tally = state.sensitive[static_cast<size_t>(SENSITIVE_PATTERNS[index].kind)];
+        tally.count++;
+        auto& samples = tally.samples;
+        if (samples.size() == SENSITIVE_SAMPLES && dir.depth >= samples.back().first) {
+            return;
+        }
+        std::string path = state.path;
+        if (path.back() != '/') {
+            path += '/';
+        }
+        path += name;
+        std::pair<uint32_t, std::string> sample{dir.depth, std::move(path)};
+        samples.insert(std::upper_bound(samples.begin(), samples.end(), sample), std::move(sample));
+        if (samples.size() > SENSITIVE_SAMPLES) {
+            samples.pop_back();
+        }
+    }
+    
+    /**
+     * Decide where a freshly discovered subdirectory goes: onto the shared
+     * frontier, or onto the worker's own stack when history says its
+     * subtree (or the one it belongs to) is small. `find` is the child's
+     * FindProgram state; with a find expression only removed directories
+     * count as protected ones the target contains.
+     */
+    void schedule_child(const PendingDir& parent, const char* name, ino_t inode,
+                        WorkerState& state, std::vector<PendingDir>& shared, uint8_t find = FindProgram::REMOVED) {
+        DirNode* node = state.arena.make(pool_, parent.node, name);
+        PendingDir child{0, static_cast<uint64_t>(inode), node, parent.depth + 1, parent.bucket};
+        child.find = find;
+        if (parent.protection != ProtectionPolicy::DEAD) {
+            child.protection = protection_->step(parent.protection, name);
+            if (find == FindProgram::REMOVED && !protection_->accepts(child.protection).empty()) {
+                record_protected(child, state);
+            }
+        }
+        
+        // Everything below a small subtree stays on this worker
+        const bool in_small_subtree = parent.weight > 0 && parent.weight < split_threshold_;
+        const bool track = child.depth <= ScanHistory::MAX_DEPTH;
+        const bool lookup = !history_.empty() && !in_small_subtree;
+        if (track || lookup) {
+            // state.path still holds the parent's path while its entries are scanned
+            std::string& path = state.child_path;
+            path.assign(state.path);
+            if (path.back() != '/') {
+                path += '/';
+            }
+            path += name;
+        }
+        
+        if (track) {
+            std::lock_guard<std::mutex> lock(tracked_mutex_);
+            // Past the rollup budget, new directories fold into their parent's slot
+            if (tracked_.size() < limits_.tracked_dirs) {
+                child.bucket = static_cast<uint32_t>(tracked_.size());
+                tracked_.push_back({tracked_paths_.append(state.child_path),
+                                    static_cast<uint32_t>(state.child_path.size()), parent.bucket});
+            }
+        }
+        
+        bool inline_walk = false;
+        if (!history_.empty()) {
+            if (in_small_subtree) {
+                child.weight = parent.weight;
+            } else {
+                size_t start = std::min(root_size_, state.child_path.size());
+                while (start < state.child_path.size() && state.child_path[start] == '/') {
+                    start++;
+                }
+                state.key.assign(state.child_path, start, std::string::npos);
+                child.weight = history_.lookup(state.key);
+            }
+            inline_walk = child.weight > 0 && child.weight < split_threshold_;
+        }
+        
+        if (inline_walk) {
+            if (policy_ != TraversalPolicy::InodeOrder) {
+                child.key = UINT64_MAX - state.sequence++;
+            }
+            push_pending(state.local, child);
+        } else {
+            shared.push_back(child);
+        }
+    }
+    
+    /**
+     * Scan a single directory: account its files and collect its subdirectories
+     */
+    void scan_directory(const PendingDir& pending, WorkerState& state, std::vector<PendingDir>& shared) {
+        AnalysisResult& result = state.unit;
+        VfsReader& reader = *state.reader;
+        const SensitiveMatcher& sensitive = SensitiveMatcher::instance();
+        state.path.clear();
+        append_path(pending.node, state.path);
+        const uint64_t visit_start = state.trace != nullptr ? trace_->now() : 0;
+        uint64_t io_ns = 0;
+        uint64_t listed = 0;
+        
+        limiter_.acquire();
+        if (!traced_io(state, "open", io_ns, [&] { return reader.open(state.path.c_str()); })) {
+            // Skip directories we can't access
+            return;
+        }
+        
+        if (state.bucket_entries.size() <= pending.bucket) {
+            state.bucket_entries.resize(pending.bucket + 1, 0);
+        }
+        
+        std::vector<RawEntry>& entries = state.entries;
+        // Huge directories are processed in bounded batches, each sorted on its own
+        // With limits, totals are published every LIMIT_CHECK_FILES files
+        const bool limited = limit_bytes_ > 0 || limit_files_ > 0;
+        uint64_t counted_files = result.total_files;
+        uint64_t counted_bytes = result.total_size;
+        auto publish = [&] {
+            count_toward_limits(result.total_files - counted_files, result.total_size - counted_bytes);
+            counted_files = result.total_files;
+            counted_bytes = result.total_size;
+        };
+        for (bool more = true; more && !stop_requested();) {
+            more = traced_io(state, "getdents", io_ns, [&] { return reader.read(limits_.dir_batch, entries); });
+            state.bucket_entries[pending.bucket] += entries.size();
+            listed += entries.size();
+            
+            if (policy_ == TraversalPolicy::InodeOrder) {
+                std::sort(entries.begin(), entries.end(),
+                    [](const RawEntry& a, const RawEntry& b) { return a.inode < b.inode; });
+            }
+            
+            for (const auto& entry : entries) {
+                const char* name = reader.name(entry);
+                unsigned char type = entry.type;
+                EntryStat st{};
+                bool have_stat = false;
+                
+                // Everything rm removes besides directories needs a stat for its size (lstat
+                // size for links); DT_UNKNOWN needs one for its type
+                if (type != DT_DIR) {
+                    limiter_.acquire();
+                    if (!traced_io(state, "stat", io_ns, [&] { return reader.stat(entry, st); })) {
+                        continue;
+                    }
+                    have_stat = true;
+                    type = st.type;
+                }
+                
+                // With a find expression only what it deletes is counted
+                uint8_t verdict = find_ == nullptr || pending.find == FindProgram::REMOVED
+                                ? FindProgram::DELETE | FindProgram::DELETE_TREE : FindProgram::KEEP;
+                if (find_ != nullptr && pending.find == FindProgram::EVALUATE) {
+                    verdict = find_->run({state.path, name, {}, type, pending.depth + 1}, [&]() -> const EntryStat* {
+                        if (!have_stat) {
+                            limiter_.acquire();
+                            have_stat = traced_io(state, "stat", io_ns, [&] { return reader.stat(entry, st); });
+                        }
+                        return have_stat ? &st : nullptr;
+                    });
+                }
+                
+                if (type != DT_DIR && have_stat) {
+                    if ((verdict & FindProgram::DELETE) == 0) {
+                        continue;
+                    }
+                    result.total_files++;
+                    auto size = static_cast<uintmax_t>(st.size);
+                    result.total_size += size;
+                    
+                    // Track largest file
+                    if (size > result.largest_file_size) {
+                        result.largest_file_size = size;
+                        set_largest(state.unit_largest, pending.node, name);
+                    }
+                    
+                    // Track file types
+                    result.file_types.add(get_extension(name));
+                    if (const uint64_t bits = sensitive.match(name) & ~SENSITIVE_DIRECTORIES) {
+                        record_sensitive(bits, pending, name, state);
+                    }
+                    
+                    if (limited && result.total_files - counted_files >= LIMIT_CHECK_FILES) {
+                        publish();
+                        if (stop_requested()) {
+                            break;
+                        }
+                    }
+                    
+                } else if (type == DT_DIR) {
+                    if ((verdict & FindProgram::DELETE) != 0) {
+                        result.total_directories++;
+                        if (const uint64_t bits = sensitive.match(name) & SENSITIVE_DIRECTORIES) {
+                            record_sensitive(bits, pending, name, state);
+                        }
+                    }
+                    if ((verdict & FindProgram::DELETE_TREE) != 0) {
+                        schedule_child(pending, name, entry.inode, state, shared);
+                    } else if ((verdict & FindProgram::PRUNE) == 0 && pending.depth + 1 < find_->max_depth()) {
+                        schedule_child(pending, name, entry.inode, state, shared, FindProgram::EVALUATE);
+                    }
+                }
+            }
+            if (limited) {
+                publish();
+            }
+        }
+            
+        reader.close();
+        if (state.trace != nullptr) {
+            trace_->span(*state.trace, TraceEvent::Visit, state.path, visit_start, listed, io_ns);
+        }
+    }
+    
+    /**
+     * Make a filesystem call, timing it onto the worker's trace when tracing
+     */
+    template <typename Call>
+    bool traced_io(WorkerState& state, const char* name, uint64_t& io_ns, Call call) {
+        if (state.trace == nullptr) {
+            return call();
+        }
+        const uint64_t start = trace_->now();
+        const bool ok = call();
+        io_ns += trace_->span(*state.trace, TraceEvent::Io, name, start);
+        return ok;
+    }
+    
+    /**
+     * Serialize committed totals plus every queued or in-flight directory.
+     * Must be called with mutex_ held, or after all workers have exited.
+     */
+    std::string encode_checkpoint() {
+        const AnalysisResult committed = committed_result();
+        
+        std::string data;
+        data.reserve(checkpoint_size_hint_);
+        ScanCheckpoint::encode_header(data, checkpoint_root_, committed);
+        auto encode = [&](const PendingDir& dir) {
+            relative_path_.clear();
+            append_relative_path(dir.node, relative_path_);
+            encode_pending(data, dir, relative_path_);
+        };
+        for (const auto& dir : frontier_) {
+            encode(dir);
+        }
+        for (const auto& worker : workers_) {
+            if (worker.in_flight) {
+                encode(*worker.in_flight);
+            }
+        }
+        checkpoint_size_hint_ = data.size() + data.size() / 4;
+        // Spilled entries are appended from disk by the writer
+        frontier_spill_.flush();
+        return data;
+    }
+    
+    /**
+     * Checkpoint loop: snapshot every interval, stop the scan on a signal
+     */
+    void checkpoint_loop() {
+        constexpr auto poll = std::chrono::milliseconds(100);
+        auto next = std::chrono::steady_clock::now() + checkpoint_interval_;
+        
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!done_) {
+            checkpoint_cv_.wait_for(lock, poll, [&] { return done_; });
+            if (done_) {
+                break;
+            }
+            if (g_interrupted) {
+                stopping_ = true;
+                interrupted_ = true;
+                work_cv_.notify_all();
+                governor_cv_.notify_all();
+                progress_cv_.notify_all();
+                break;
+            }
+            if (std::chrono::steady_clock::now() < next) {
+                continue;
+            }
+            
+            // Encoding is the only part that holds the frontier lock
+            std::string data = encode_checkpoint();
+            const uint64_t spill_from = spill_read_;
+            const uint64_t spill_to = frontier_spill_.size();
+            lock.unlock();
+            try {
+                ScanCheckpoint::write_file(checkpoint_file_, data, &frontier_spill_, spill_from, spill_to);
+            } catch (const std::exception& e) {
+                print_error(e.what());
+            }
+            next = std::chrono::steady_clock::now() + checkpoint_interval_;
+            lock.lock();
+        }
+    }
+    
+    /**
+     * Progress loop: report committed totals every interval
+     */
+    void progress_loop() {
+        const auto start = std::chrono::steady_clock::now();
+        
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!done_ && !stopping_) {
+            progress_cv_.wait_for(lock, progress_interval_, [&] { return done_ || stopping_; });
+            if (done_ || stopping_) {
+                break;
+            }
+            ScanProgress progress;
+            progress.elapsed_ms = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start).count());
+            for (const auto& worker : workers_) {
+                progress.files += worker.result.total_files;
+                progress.directories += worker.result.total_directories;
+                progress.bytes += worker.result.total_size;
+            }
+            progress.queued = frontier_.size() + spilled_;
+            lock.unlock();
+            progress_(progress);
+            lock.lock();
+        }
+    }
+    
+    /**
+     * Supervisor loop: sample PSI and CPU use, resize the active worker set
+     */
+    void govern() {
+        uint64_t io_prev = 0;
+        uint64_t cpu_prev = 0;
+        const bool psi = governor_.enabled &&
+                         read_psi_total("/proc/pressure/io", io_prev) &&
+                         read_psi_total("/proc/pressure/cpu", cpu_prev);
+        auto wall_prev = std::chrono::steady_clock::now();
+        auto used_prev = process_cpu_time();
+        
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!done_ && !stopping_) {
+            governor_cv_.wait_for(lock, GOVERNOR_TICK, [&] { return done_ || stopping_; });
+            if (done_ || stopping_) {
+                break;
+            }
+            lock.unlock();
+            
+            const auto wall_now = std::chrono::steady_clock::now();
+            const auto used_now = process_cpu_time();
+            const double wall_us = std::chrono::duration<double, std::micro>(wall_now - wall_prev).count();
+            const double cpu_percent =
+                100.0 * std::chrono::duration<double, std::micro>(used_now - used_prev).count() / wall_us;
+            wall_prev = wall_now;
+            used_prev = used_now;
+            
+            double io_pressure = 0.0;
+            double cpu_pressure = 0.0;
+            uint64_t io_now = io_prev;
+            uint64_t cpu_now = cpu_prev;
+            if (psi && read_psi_total("/proc/pressure/io", io_now) &&
+                read_psi_total("/proc/pressure/cpu", cpu_now)) {
+                io_pressure = 100.0 * static_cast<double>(io_now - io_prev) / wall_us;
+                cpu_pressure = 100.0 * static_cast<double>(cpu_now - cpu_prev) / wall_us;
+                io_prev = io_now;
+                cpu_prev = cpu_now;
+            }
+            
+            const double cpu_cap = governor_.max_cpu_percent;
+            const bool over_cpu = cpu_cap > 0 && cpu_percent > cpu_cap;
+            const bool pressured = io_pressure > PRESSURE_HIGH || cpu_pressure > PRESSURE_HIGH;
+            const bool idle = io_pressure < PRESSURE_LOW && cpu_pressure < PRESSURE_LOW &&
+                              (cpu_cap == 0 || cpu_percent < 0.8 * cpu_cap);
+            
+            // A single worker still over the CPU cap: pause everyone for the excess share
+            auto pause = std::chrono::microseconds(0);
+            
+            lock.lock();
+            if (over_cpu || pressured) {
+                if (allowed_ <= 1 && over_cpu) {
+                    pause = std::chrono::duration_cast<std::chrono::microseconds>(
+                        GOVERNOR_TICK * ((cpu_percent - cpu_cap) / cpu_percent));
+                }
+                allowed_ = std::max(1u, allowed_ / 2);
+            } else if (idle && allowed_ < jobs_) {
+                allowed_++;
+                work_cv_.notify_all();
+            }
+            
+            if (pause.count() > 0) {
+                const unsigned resume = allowed_;
+                allowed_ = 0;
+                governor_cv_.wait_for(lock, pause, [&] { return done_ || stopping_; });
+                allowed_ = resume;
+                work_cv_.notify_all();
+            }
+        }
+    }
+    
+    const TraversalPolicy policy_;
+    const unsigned jobs_;
+    const GovernorOptions governor_;
+    const ScanHistory& history_;
+    const MemoryLimits limits_;
+    RateLimiter limiter_;
+    BlockPool pool_;
+    size_t root_size_ = 0;
+    uint64_t split_threshold_ = 1;
+    
+    std::mutex mutex_;
+    std::condition_variable work_cv_;
+    std::condition_variable governor_cv_;
+    std::condition_variable checkpoint_cv_;
+    std::condition_variable progress_cv_;
+    std::vector<PendingDir> frontier_;  // binary min-heap, guarded by mutex_
+    SpillFile frontier_spill_;          // frontier overflow, guarded by mutex_
+    uint64_t spill_read_ = 0;
+    size_t spilled_ = 0;
+    std::string spill_record_;
+    std::string spill_chunk_;
+    std::string relative_path_;  // scratch for encode_pending()/decode_pending()
+    NodeArena arena_;            // the root and reloaded directories
+    DirNode* root_node_ = nullptr;
+    uint64_t sequence_ = 0;
+    unsigned busy_ = 0;
+    unsigned allowed_;
+    bool done_ = false;
+    bool stopping_ = false;
+    
+    std::string checkpoint_file_;
+    std::string checkpoint_root_;
+    std::chrono::seconds checkpoint_interval_{5};
+    size_t checkpoint_size_hint_ = 4096;
+    std::vector<std::pair<PendingDir, std::string>> resume_frontier_;
+    bool resumed_ = false;
+    bool interrupted_ = false;
+    const std::atomic<bool>* cancel_ = nullptr;
+    bool stopped_early_ = false;
+    uint64_t limit_bytes_ = 0;
+    uint64_t limit_files_ = 0;
+    std::atomic<uint64_t> files_seen_{0};
+    std::atomic<uint64_t> bytes_seen_{0};
+    std::atomic<bool> over_limit_{false};
+    const ProtectionPolicy* protection_ = nullptr;
+    std::string protection_root_;
+    uint32_t protection_start_ = ProtectionPolicy::DEAD;
+    std::atomic<bool> protected_stop_{false};
+    const FindProgram* find_ = nullptr;
+    uint8_t find_root_ = FindProgram::EVALUATE;
+    bool find_skips_root_ = false;
+    std::vector<std::string> targets_;           // of run(), relative to the root
+    std::vector<DirNode*> target_nodes_;         // one reference each
+    std::vector<uint32_t> target_protection_;    // ProtectionPolicy state of each target
+    std::function<void(const ScanProgress&)> progress_;
+    std::chrono::milliseconds progress_interval_{1000};
+    PhaseStats aggregate_;
+    ScanTrace* trace_ = nullptr;
+    
+    std::mutex tracked_mutex_;
+    std::vector<TrackedDir> tracked_;  // guarded by tracked_mutex_ while scanning
+    SpillFile tracked_paths_;
+    
+    std::vector<WorkerState> workers_;
+};
+
+/**
+ * Pick a worker count when --jobs was not given
+ */
+unsigned resolve_jobs(unsigned requested, TraversalPolicy policy) {
+    if (requested > 0) {
+        return requested;
+    }
+    // A single sweep keeps a rotational disk's head moving forward
+    if (policy == TraversalPolicy::InodeOrder) {
+        return 1;
+    }
+    return std::clamp(std::thread::hardware_concurrency(), 1u, 8u);
+}
+
+/**
+ * Analyze a folder and return detailed statistics, filling in `stats`
+ * when given. With `targets`, canonical directories below `path` none of
+ * which lies inside another, only those are scanned, on one set of
+ * workers, and result.targets holds the totals of each.
+ */
+AnalysisResult analyze_folder(const std::string& path, const ScanOptions& options = {},
+                              ScanStats* stats = nullptr, const std::vector<std::string>& targets = {}) {
+    const uint64_t allocations_before = allocation_count();
+    const uint64_t bytes_before = allocated_bytes();
+    
+    // A replayed recording or a caller-supplied tree stands in for the host filesystem
+    PosixFs host;
+    std::unique_ptr<MemoryFs> replay;
+    const Vfs* vfs = options.filesystem != nullptr ? options.filesystem : &host;
+    if (!options.replay_file.empty()) {
+        replay = MemoryFs::load_recording(options.replay_file);
+        replay->set_latency(options.replay_latency);
+        vfs = replay.get();
+    }
+    std::unique_ptr<RecordingFs> recording;
+    if (!options.record_file.empty()) {
+        recording = std::make_unique<RecordingFs>(*vfs, options.record_file);
+        vfs = recording.get();
+    }
+    
+    // Strip trailing separators so history keys line up between runs
+    std::string root = path;
+    while (root.size() > 1 && root.back() == '/') {
+        root.pop_back();
+    }
+    vfs->check_directory(root);
+    if (options.find != nullptr && options.find->uses_time() && !vfs->has_mtimes()) {
+        throw std::runtime_error("find: -mtime, -mmin and -newer need modification times, which this scan source does not keep");
+    }
+    
+    if (options.governor.enabled) {
+        apply_background_priority();
+    }
+    
+    // Device properties and scan history only mean something for real paths
+    const bool real = vfs->is_real();
+    const std::string canonical_root = real ? fs::canonical(root).string() : root;
+    
+    // find evaluates its start point too, by the name and path it was given as
+    uint8_t find_verdict = FindProgram::DELETE | FindProgram::DELETE_TREE;
+    if (options.find != nullptr) {
+        const std::string name = root == "/" ? root : fs::path(root).filename().string();
+        EntryStat st{};
+        bool have_stat = false;
+        find_verdict = options.find->run({"", name, root, DT_DIR, 0}, [&]() -> const EntryStat* {
+            struct stat info{};
+            if (!have_stat && real && ::stat(root.c_str(), &info) == 0) {
+                st = {DT_DIR, static_cast<uint64_t>(info.st_size),
+                      static_cast<int64_t>(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec};
+                have_stat = true;
+            }
+            return have_stat ? &st : nullptr;
+        });
+    }
+    
+    // A target that is itself critically protected is blocked without a scan;
+    // a find start point only matters when it goes as a whole
+    std::vector<ProtectedMatch> protection;
+    if (options.protection != nullptr && (find_verdict & FindProgram::DELETE_TREE) != 0) {
+        for (const auto& target : targets.empty() ? std::vector<std::string>{canonical_root} : targets) {
+            for (auto& match : options.protection->match_target(target)) {
+                protection.push_back(std::move(match));
+            }
+        }
+        for (const auto& match : protection) {
+            if (match.relation == Protection::Is && match.severity == Severity::Critical) {
+                AnalysisResult result;
+                result.protected_paths = std::move(protection);
+                result.blocked_by_policy = true;
+                return result;
+            }
+        }
+    }
+    // A find expression scans part of the tree, whose sizes would mislead later scans
+    const bool use_history = real && !options.history_file.empty() && options.find == nullptr;
+    ScanHistory history;
+    if (use_history) {
+        history.load(options.history_file, canonical_root);
+    }
+    
+    TraversalPolicy policy = options.traversal;
+    if (real) {
+        policy = resolve_traversal_policy(policy, root);
+    } else if (policy == TraversalPolicy::Auto) {
+        policy = TraversalPolicy::Readdir;
+    }
+    const unsigned jobs = resolve_jobs(options.jobs, policy);
+    ScanEngine engine(*vfs, policy, jobs, options.governor, history, MemoryLimits::from_budget(options.max_memory, jobs));
+    
+    if (!targets.empty() && (!options.resume_file.empty() || !options.checkpoint_file.empty())) {
+        throw std::runtime_error("--checkpoint and --resume take a single rm -rf target");
+    }
+    if (options.find != nullptr && (!options.resume_file.empty() || !options.checkpoint_file.empty())) {
+        throw std::runtime_error("--checkpoint and --resume do not apply to find");
+    }
+    if (!options.resume_file.empty()) {
+        ScanCheckpoint checkpoint = ScanCheckpoint::read_file(options.resume_file);
+        if (checkpoint.root != canonical_root) {
+            throw std::runtime_error("Checkpoint " + options.resume_file + " is for " + checkpoint.root +
+                                     ", not " + canonical_root);
+        }
+        engine.restore(std::move(checkpoint));
+    }
+    
+    // Resuming keeps checkpointing to the same file unless told otherwise
+    const std::string& checkpoint_file =
+        options.checkpoint_file.empty() ? options.resume_file : options.checkpoint_file;
+    if (!checkpoint_file.empty()) {
+        engine.enable_checkpoints(checkpoint_file, canonical_root,
+                                  std::chrono::seconds(std::max(1u, options.checkpoint_interval)));
+        struct sigaction action{};
+        action.sa_handler = handle_interrupt_signal;
+        ::sigemptyset(&action.sa_mask);
+        for (int signal : {SIGINT, SIGTERM, SIGHUP}) {
+            ::sigaction(signal, &action, nullptr);
+        }
+    }
+    
+    if (options.progress) {
+        engine.enable_progress(options.progress, options.progress_interval);
+    }
+    if (options.cancel != nullptr) {
+        engine.enable_cancel(*options.cancel);
+    }
+    engine.enable_limits(options.stop_over_bytes, options.stop_over_files);
+    if (options.protection != nullptr) {
+        engine.enable_protection(*options.protection, canonical_root);
+    }
+    if (options.find != nullptr) {
+        engine.enable_find(*options.find, find_verdict);
+    }
+    std::unique_ptr<ScanTrace> trace;
+    if (!options.trace_file.empty()) {
+        trace = std::make_unique<ScanTrace>(jobs, options.trace_threshold);
+        engine.enable_trace(*trace);
+    }
+    
+    std::vector<std::string> relative_targets;
+    for (const auto& target : targets) {
+        relative_targets.push_back(ScanHistory::relative_key(target, canonical_root.size()));
+    }
+    
+    const PhaseTimer scan;
+    AnalysisResult result = engine.run(root, relative_targets);
+    if (recording != nullptr) {
+        recording->check_written();
+    }
+    if (trace != nullptr) {
+        trace->write(options.trace_file, root);
+    }
+    if (stats != nullptr) {
+        stats->jobs = jobs;
+        stats->entries = result.total_files + result.total_directories;
+        stats->syscalls = engine.syscalls();
+        stats->allocations = allocation_count() - allocations_before;
+        stats->allocated_bytes = allocated_bytes() - bytes_before;
+        stats->phase(Phase::Scan) = scan.elapsed();
+        stats->phase(Phase::Scan) -= engine.aggregate_time();
+        stats->phase(Phase::Aggregate) = engine.aggregate_time();
+        stats->threads = engine.thread_stats();
+    }
+    
+    if (engine.interrupted()) {
+        throw std::runtime_error("Scan interrupted; progress saved to " + checkpoint_file +
+                                 " (continue with --resume " + checkpoint_file + ")");
+    }
+    result.over_limit = engine.over_limit();
+    if (options.protection != nullptr) {
+        result.protected_paths = std::move(protection);
+        for (auto& match : engine.protected_contents()) {
+            result.protected_paths.push_back(std::move(match));
+        }
+        result.blocked_by_policy = engine.protected_stop();
+    }
+    result.sensitive = engine.sensitive_files();
+    for (auto& finding : result.sensitive) {
+        for (auto& sample : finding.samples) {
+            if (real && sample.path.size() > 5 && sample.path.compare(sample.path.size() - 5, 5, "/.git") == 0) {
+                sample.note = git_push_note(sample.path);
+            }
+        }
+    }
+    if (!checkpoint_file.empty() && !engine.stopped_early()) {
+        // The scan finished, so the checkpoint has nothing left to resume
+        ::unlink(checkpoint_file.c_str());
+    }
+    
+    // Subtree sizes are only complete when the whole tree was walked in this run
+    if (use_history && !engine.resumed() && !engine.stopped_early()) {
+        auto subtrees = engine.subtree_sizes();
+        for (auto& [entries, subtree] : subtrees) {
+            subtree = canonical_root + subtree.substr(root.size());
+        }
+        if (targets.empty()) {
+            ScanHistory::save(options.history_file, canonical_root, std::move(subtrees));
+        }
+        // The common root was not scanned; each target keeps its own history
+        for (const auto& target : targets) {
+            std::vector<std::pair<uint64_t, std::string>> own;
+            for (const auto& subtree : subtrees) {
+                if (ScanHistory::is_within(subtree.second, target)) {
+                    own.push_back(subtree);
+                }
+            }
+            ScanHistory::save(options.history_file, target, std::move(own));
+        }
+    }
+    result.targets = engine.target_totals();
+    if (options.find != nullptr && (find_verdict & FindProgram::DELETE) != 0) {
+        result.total_directories++;
+    }
+    return result;
+}
+
+/**
+ * The Critical match that blocked a scan: a protected path the target is
+ * or contains, never the ancestor it merely lives under
+ */
+const ProtectedMatch& blocking_match(const std::vector<ProtectedMatch>& matches) {
+    const auto critical = std::find_if(matches.begin(), matches.end(), [](const ProtectedMatch& match) {
+        return match.severity == Severity::Critical && match.relation == Protection::Contains;
+    });
+    if (critical != matches.end()) {
+        return *critical;
+    }
+    return *std::find_if(matches.begin(), matches.end(), [](const ProtectedMatch& match) {
+        return match.severity == Severity::Critical && match.relation == Protection::Is;
+    });
+}
+
+/**
+ * One line for a protection rule that applies to an rm -rf target,
+ * colored by severity
+ */
+void print_protected(const ProtectedMatch& match) {
+    const char* labels[] = {"Protected", "Contains Protected", "Inside Protected"};
+    std::string value = match.relation == Protection::Is ? "" : match.path + ", by ";
+    value.append(match.pattern).append(" (").append(severity_name(match.severity)).append(")");
+    if (match.count > 1) {
+        value.append(", ").append(format_count(match.count)).append(" directories");
+    }
+    const std::string_view color = match.severity == Severity::Critical ? Color::RED
+                                 : match.severity == Severity::Warning ? Color::YELLOW : Color::CYAN;
+    std::cout << "  " << color << std::left << std::setw(20) << labels[static_cast<int>(match.relation)]
+              << Color::RESET << ": " << value << "\n";
+}
+
+/**
+ * Display detailed analysis results, timing the sort and render phases
+ * into `stats` when given
+ */
+void display_analysis(const AnalysisResult& result, ScanStats* stats = nullptr) {
+    const PhaseTimer render;
+    PhaseStats sort;
+    
+    std::cout << Color::BOLD << Color::BLUE << "\n📊 Analysis Results:\n" << Color::RESET;
+    print_separator();
+    
+    if (!result.targets.empty()) {
+        constexpr size_t MAX_TARGET_LINES = 20;
+        std::cout << Color::BOLD << "  Targets:\n" << Color::RESET;
+        for (size_t i = 0; i < std::min(result.targets.size(), MAX_TARGET_LINES); i++) {
+            const TargetTotals& target = result.targets[i];
+            std::cout << "    " << Color::CYAN << std::left << std::setw(20) << target.path << Color::RESET << ": ";
+            if (target.skipped.empty()) {
+                std::cout << format_count(target.files) << " files, " << format_count(target.directories)
+                          << " directories, " << format_size(target.bytes) << "\n";
+            } else {
+                std::cout << Color::YELLOW << "skipped" << Color::RESET << "\n";
+            }
+        }
+        if (result.targets.size() > MAX_TARGET_LINES) {
+            std::cout << "    ... and " << format_count(result.targets.size() - MAX_TARGET_LINES) << " more\n";
+        }
+        std::cout << "\n";
+    }
+    
+    print_info("Total Files", format_count(result.total_files));
+    print_info("Total Directories", format_count(result.total_directories));
+    print_info("Total Size", format_size(result.total_size));
+    
+    if (result.largest_file_size > 0) {
+        print_info("Largest File Size", format_size(result.largest_file_size));
+        print_info("Largest File Path", result.largest_file_path);
+    }
+    for (const auto& match : result.protected_paths) {
+        if (match.relation == Protection::Contains) {
+            print_protected(match);
+        }
+    }
+    
+    if (!result.sensitive.empty()) {
+        std::cout << "\n" << Color::BOLD << "  Sensitive Files:\n" << Color::RESET;
+        for (const auto& finding : result.sensitive) {
+            std::cout << "    " << Color::YELLOW << std::left << std::setw(20) << finding.category
+                      << Color::RESET << ": " << format_count(finding.count) << "\n";
+            for (const auto& sample : finding.samples) {
+                std::cout << "      " << sample.path;
+                if (!sample.note.empty()) {
+                    std::cout << Color::RED << " (" << sample.note << ")" << Color::RESET;
+                }
+                std::cout << "\n";
+            }
+            if (finding.count > finding.samples.size()) {
+                std::cout << "      ... and " << format_count(finding.count - finding.samples.size()) << " more\n";
+            }
+        }
+    }
+    
+    // Display top 10 file types
+    if (!result.file_types.empty()) {
+        std::cout << "\n" << Color::BOLD << "  File Types Distribution:\n" << Color::RESET;
+        
+        const bool approximate = result.file_types.approximate();
+        const PhaseTimer sort_timer;
+        const std::vector<FileTypeCount> top = result.file_types.top(10);
+        sort = sort_timer.elapsed();
+        for (const auto& type : top) {
+            std::cout << "    " << Color::CYAN << std::left << std::setw(20) << type.extension 
+                      << Color::RESET << ": " << (approximate ? "~" : "") << format_count(type.count) << " file(s)";
+            if (type.error > 0) {
+                std::cout << " (±" << format_count(type.error) << ")";
+            }
+            std::cout << "\n";
+        }
+        if (approximate) {
+            std::cout << "    " << Color::YELLOW << "Too many distinct extensions to count exactly; "
+                      << "counts are upper bounds (±max overcount)\n" << Color::RESET;
+        }
+    }
+    
+    print_separator();
+    if (stats != nullptr) {
+        stats->phase(Phase::Sort) = sort;
+        stats->phase(Phase::Render) = render.elapsed();
+        stats->phase(Phase::Render) -= sort;
+    }
+}
+
+/**
+ * Format a duration in seconds with a unit that keeps 3 significant digits
+ */
+std::string format_duration(double seconds) {
+    std::ostringstream oss;
+    oss << std::fixed;
+    if (seconds >= 1.0) {
+        oss << std::setprecision(2) << seconds << " s";
+    } else if (seconds >= 1e-3) {
+        oss << std::setprecision(2) << seconds * 1e3 << " ms";
+    } else {
+        oss << std::setprecision(0) << seconds * 1e6 << " µs";
+    }
+    return oss.str();
+}
+
+/**
+ * Print where an analysis spent its time (--stats)
+ */
+void print_scan_stats(const ScanStats& stats) {
+    std::cout << Color::BOLD << Color::BLUE << "\n⏱️  Scan Statistics:\n" << Color::RESET;
+    print_separator();
+#if ADVISOR_STATS
+    static const char* const phase_names[] = {"Scan", "Aggregation", "Sort", "Render"};
+    std::cout << Color::BOLD << "  " << std::left << std::setw(20) << "Phase" << std::right
+              << std::setw(12) << "Wall" << std::setw(12) << "User" << std::setw(12) << "System"
+              << Color::RESET << "\n";
+    for (size_t i = 0; i < static_cast<size_t>(Phase::Count); i++) {
+        const PhaseStats& phase = stats.phases[i];
+        std::cout << "  " << std::left << std::setw(20) << phase_names[i] << std::right
+                  << std::setw(12) << format_duration(phase.wall) << std::setw(12) << format_duration(phase.user)
+                  << std::setw(12) << format_duration(phase.system) << "\n";
+    }
+    std::cout << "\n";
+    
+    const PhaseStats& scan = stats.phase(Phase::Scan);
+    const double per_entry = stats.entries > 0 ? 1.0 / static_cast<double>(stats.entries) : 0.0;
+    std::ostringstream line;
+    line << std::fixed << std::setprecision(3);
+    line << stats.syscalls.total() << " (open " << stats.syscalls.open << ", getdents "
+         << stats.syscalls.getdents << ", stat " << stats.syscalls.stat << ", close " << stats.syscalls.close << ")";
+    print_info("Syscalls", line.str());
+    line.str("");
+    line << static_cast<double>(stats.syscalls.total()) * per_entry;
+    print_info("Syscalls/entry", line.str());
+    line.str("");
+    line << std::setprecision(0) << static_cast<double>(stats.entries) / std::max(scan.wall, 1e-9);
+    print_info("Entries/sec", line.str() + " (" + std::to_string(stats.entries) + " entries)");
+    print_info("Heap Allocated", format_bytes(stats.allocated_bytes) + " in " +
+                                 std::to_string(stats.allocations) + " allocations");
+    print_info("Peak Memory", format_bytes(peak_rss_bytes()));
+    
+    std::cout << "\n" << Color::BOLD << "  " << std::left << std::setw(8) << "Thread" << std::right
+              << std::setw(12) << "Busy" << std::setw(12) << "Idle" << std::setw(12) << "CPU"
+              << std::setw(9) << "Units" << std::setw(9) << "Steals" << Color::RESET << "\n";
+    for (size_t i = 0; i < stats.threads.size(); i++) {
+        const ThreadStats& thread = stats.threads[i];
+        std::cout << "  " << std::left << std::setw(8) << i << std::right
+                  << std::setw(12) << format_duration(static_cast<double>(thread.busy_ns) / 1e9)
+                  << std::setw(12) << format_duration(static_cast<double>(thread.idle_ns) / 1e9)
+                  << std::setw(12) << format_duration(static_cast<double>(thread.cpu_ns) / 1e9)
+                  << std::setw(9) << thread.units << std::setw(9) << thread.steals << "\n";
+    }
+    
+    // Busy time the workers did not spend on a CPU went to waiting for storage
+    uint64_t busy_ns = 0;
+    uint64_t cpu_ns = 0;
+    for (const auto& thread : stats.threads) {
+        busy_ns += thread.busy_ns;
+        cpu_ns += thread.cpu_ns;
+    }
+    const double off_cpu = busy_ns > cpu_ns ? static_cast<double>(busy_ns - cpu_ns) / static_cast<double>(busy_ns) : 0.0;
+    std::string verdict;
+    if (off_cpu > 0.5) {
+        verdict = "storage (" + std::to_string(static_cast<int>(off_cpu * 100)) + "% of busy time off-CPU)";
+    } else if (scan.system > scan.user) {
+        verdict = "kernel (system time exceeds user time)";
+    } else {
+        verdict = "advisor (user time dominates)";
+    }
+    std::cout << "\n";
+    print_info("Bottleneck", verdict);
+#else
+    (void)stats;
+    std::cout << "  " << Color::YELLOW << "Built with ADVISOR_STATS=0; no counters were collected\n" << Color::RESET;
+#endif
+    print_separator();
+}
+
+/**
+ * Version of the --format json/ndjson record layout; bumped whenever a
+ * field changes meaning or goes away
+ */
+constexpr uint64_t JSON_SCHEMA_VERSION = 1;
+
+/**
+ * Start a top-level record of the given type
+ */
+void begin_json_record(JsonWriter& json, const char* type) {
+    json.begin_object().key("schema").value(JSON_SCHEMA_VERSION).key("type").value(type);
+}
+
+/**
+ * Write the scan instrumentation, with times in whole microseconds
+ */
+void write_stats_json(JsonWriter& json, const ScanStats& stats) {
+    static const char* const phase_names[] = {"scan", "aggregation", "sort", "render"};
+    auto micros = [](double seconds) { return static_cast<uint64_t>(std::max(0.0, seconds) * 1e6 + 0.5); };
+    
+    json.key("stats").begin_object();
+    json.key("jobs").value(uint64_t{stats.jobs});
+    json.key("entries").value(stats.entries);
+    json.key("syscalls").begin_object()
+        .key("open").value(stats.syscalls.open)
+        .key("getdents").value(stats.syscalls.getdents)
+        .key("stat").value(stats.syscalls.stat)
+        .key("close").value(stats.syscalls.close)
+        .end_object();
+    json.key("allocations").value(stats.allocations);
+    json.key("allocated_bytes").value(stats.allocated_bytes);
+    json.key("phases").begin_object();
+    for (size_t i = 0; i < static_cast<size_t>(Phase::Count); i++) {
+        json.key(phase_names[i]).begin_object()
+            .key("wall_us").value(micros(stats.phases[i].wall))
+            .key("user_us").value(micros(stats.phases[i].user))
+            .key("system_us").value(micros(stats.phases[i].system))
+            .end_object();
+    }
+    json.end_object();
+    json.key("threads").begin_array();
+    for (const auto& thread : stats.threads) {
+        json.begin_object()
+            .key("busy_ns").value(thread.busy_ns)
+            .key("idle_ns").value(thread.idle_ns)
+            .key("cpu_ns").value(thread.cpu_ns)
+            .key("units").value(thread.units)
+            .key("steals").value(thread.steals)
+            .end_object();
+    }
+    json.end_array();
+    json.end_object();
+}
+
+/**
+ * Write protection matches as the "protected" array of the current object
+ */
+void write_protected_json(JsonWriter& json, const std::vector<ProtectedMatch>& matches) {
+    json.key("protected").begin_array();
+    for (const auto& match : matches) {
+        json.begin_object();
+        json.key("relation").value(protection_name(match.relation));
+        json.key("severity").value(severity_name(match.severity));
+        json.key("pattern").value(match.pattern).key("path").value(match.path).key("count").value(match.count);
+        json.end_object();
+    }
+    json.end_array();
+}
+
+/**
+ * Write the totals, largest file and file types of an analysis into the
+ * current object; returns the time spent sorting the file types
+ */
+PhaseStats write_analysis_fields(JsonWriter& json, const AnalysisResult& result) {
+    json.key("total_files").value(uint64_t{result.total_files});
+    json.key("total_directories").value(uint64_t{result.total_directories});
+    json.key("total_size").value(uint64_t{result.total_size});
+    json.key("largest_file");
+    if (result.largest_file_size > 0) {
+        json.begin_object()
+            .key("size").value(uint64_t{result.largest_file_size})
+            .key("path").value(result.largest_file_path)
+            .end_object();
+    } else {
+        json.null();
+    }
+    
+    // Every counted extension, not just the top 10 of the text report
+    const PhaseTimer sort_timer;
+    const std::vector<FileTypeCount> types = result.file_types.top(result.file_types.size());
+    const PhaseStats sort = sort_timer.elapsed();
+    json.key("file_types").begin_object();
+    json.key("approximate").value(result.file_types.approximate());
+    json.key("counts").begin_array();
+    for (const auto& type : types) {
+        json.begin_object().key("extension").value(type.extension).key("count").value(type.count);
+        if (result.file_types.approximate()) {
+            json.key("error").value(type.error);
+        }
+        json.end_object();
+    }
+    json.end_array().end_object();
+    json.key("over_limit").value(result.over_limit);
+    write_protected_json(json, result.protected_paths);
+    json.key("blocked_by_policy").value(result.blocked_by_policy);
+    if (!result.patterns.empty()) {
+        json.key("patterns").begin_array();
+        for (const auto& pattern : result.patterns) {
+            json.begin_object().key("pattern").value(pattern.pattern).key("matches").value(pattern.matches);
+            json.end_object();
+        }
+        json.end_array();
+    }
+    if (!result.targets.empty()) {
+        json.key("targets").begin_array();
+        for (const auto& target : result.targets) {
+            json.begin_object().key("path").value(target.path);
+            if (target.skipped.empty()) {
+                json.key("files").value(target.files).key("directories").value(target.directories);
+                json.key("size").value(target.bytes);
+            } else {
+                json.key("skipped").value(target.skipped);
+            }
+            json.end_object();
+        }
+        json.end_array();
+    }
+    json.key("sensitive").begin_array();
+    for (const auto& finding : result.sensitive) {
+        json.begin_object().key("category").value(finding.category).key("count").value(finding.count);
+        json.key("samples").begin_array();
+        for (const auto& sample : finding.samples) {
+            json.begin_object().key("path").value(sample.path);
+            if (!sample.note.empty()) {
+                json.key("note").value(sample.note);
+            }
+            json.end_object();
+        }
+        json.end_array().end_object();
+    }
+    json.end_array();
+    return sort;
+}
+
+/**
+ * Write an analysis result record, timing the sort and render phases into
+ * `stats` when given. An empty `path` (several targets) is left out.
+ */
+void write_analysis_json(JsonWriter& json, const std::string& path, const AnalysisResult& result,
+                         ScanStats* stats, std::string_view command = "rm -rf") {
+    const PhaseTimer render;
+    begin_json_record(json, "analysis");
+    json.key("command").value(command);
+    if (!path.empty()) {
+        json.key("target").value(path);
+    }
+    const PhaseStats sort = write_analysis_fields(json, result);
+    json.key("peak_rss").value(peak_rss_bytes());
+    
+    if (stats != nullptr) {
+        stats->phase(Phase::Sort) = sort;
+        stats->phase(Phase::Render) = render.elapsed();
+        stats->phase(Phase::Render) -= sort;
+        write_stats_json(json, *stats);
+    }
+    json.end_object();
+    json.end_record();
+}
+
+/**
+ * How advising on a command line went, in increasing order of severity;
+ * the commands of one line are combined with std::max. Blocked is a
+ * --block-over stop and Protected a Critical protected path; both rank
+ * above a usage error so their exit statuses always come through.
+ */
+enum class Advice { Silent, Given, Declined, UsageError, Blocked, Protected };
+
+/**
+ * What an analysis that stopped early comes to: Protected wins over Blocked
+ */
+Advice blocked_advice(const AnalysisResult& result) {
+    return result.blocked_by_policy ? Advice::Protected : result.over_limit ? Advice::Blocked : Advice::Given;
+}
+
+/**
+ * Write a progress record for --format ndjson
+ */
+void write_progress_json(JsonWriter& json, const ScanProgress& progress) {
+    begin_json_record(json, "progress");
+    json.key("elapsed_ms").value(progress.elapsed_ms);
+    json.key("files").value(progress.files);
+    json.key("directories").value(progress.directories);
+    json.key("bytes").value(progress.bytes);
+    json.key("queued").value(progress.queued);
+    json.end_object();
+    json.end_record();
+}
+
+/**
+ * What can be learned about an rm -rf target in a few milliseconds,
+ * without walking the tree
+ */
+struct QuickLook {
+    std::string canonical_path;
+    bool mount_point = false;  // the target is the root of a mounted filesystem
+    uint64_t entries = 0;      // top-level entries (capped)
+    uint64_t directories = 0;  // of which directories
+    bool more_entries = false; // the cap was reached
+    std::vector<std::string> markers;
+    std::vector<ProtectedMatch> protection;  // rules the target is, or lives under
+    double elapsed = 0.0;      // seconds
+};
+
+/**
+ * Look at the target itself and its top-level entries only
+ */
+QuickLook quick_look(const std::string& path, const ProtectionPolicy* policy = nullptr) {
+    constexpr uint64_t MAX_ENTRIES = 65536;
+    const auto start = std::chrono::steady_clock::now();
+    PosixFs().check_directory(path);
+    
+    QuickLook look;
+    look.canonical_path = fs::canonical(path).string();
+    if (policy != nullptr) {
+        look.protection = policy->match_target(look.canonical_path);
+    }
+    struct stat self{};
+    struct stat parent{};
+    if (::stat(look.canonical_path.c_str(), &self) == 0 && ::stat((look.canonical_path + "/..").c_str(), &parent) == 0) {
+        look.mount_point = self.st_dev != parent.st_dev || self.st_ino == parent.st_ino;
+    }
+    
+    if (DIR* dir = ::opendir(look.canonical_path.c_str())) {
+        while (const dirent* entry = ::readdir(dir)) {
+            const std::string_view name = entry->d_name;
+            if (name == "." || name == "..") {
+                continue;
+            }
+            if (look.entries == MAX_ENTRIES) {
+                look.more_entries = true;
+                break;
+            }
+            look.entries++;
+            look.directories += entry->d_type == DT_DIR ? 1 : 0;
+            if (SensitiveMatcher::instance().match(name) != 0) {
+                look.markers.emplace_back(name);
+            }
+        }
+        ::closedir(dir);
+    }
+    std::sort(look.markers.begin(), look.markers.end());
+    look.elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return look;
+}
+
+/**
+ * Write a quick_look record, the first answer of an NDJSON rm -rf analysis
+ */
+void write_quick_look_json(JsonWriter& json, const std::string& path, const QuickLook& look) {
+    begin_json_record(json, "quick_look");
+    json.key("target").value(path).key("canonical_path").value(look.canonical_path);
+    json.key("mount_point").value(look.mount_point);
+    json.key("entries").value(look.entries).key("directories").value(look.directories);
+    json.key("more_entries").value(look.more_entries);
+    json.key("markers").begin_array();
+    for (const auto& marker : look.markers) {
+        json.value(marker);
+    }
+    json.end_array();
+    write_protected_json(json, look.protection);
+    json.key("elapsed_us").value(static_cast<uint64_t>(look.elapsed * 1e6 + 0.5));
+    json.end_object();
+    json.end_record();
+}
+
+/**
+ * Write an expansion record: what a pattern among the rm -rf operands matched
+ */
+void write_expansion_json(JsonWriter& json, const PatternExpansion& pattern) {
+    begin_json_record(json, "expansion");
+    json.key("pattern").value(pattern.pattern).key("matches").value(pattern.matches);
+    json.key("directories_read").value(pattern.directories_read);
+    json.key("elapsed_us").value(static_cast<uint64_t>(pattern.elapsed * 1e6 + 0.5));
+    json.end_object();
+    json.end_record();
+}
+
+/**
+ * The paths of an rm -rf as typed, for messages
+ */
+std::string join_paths(const std::vector<std::string>& paths) {
+    std::string joined;
+    for (const auto& path : paths) {
+        joined.append(joined.empty() ? "" : " ").append(path);
+    }
+    return joined;
+}
+
+/**
+ * Values of a brace range body such as "1..5", "08..10", "a..e" or
+ * "0..20..5"; false when it is not a range
+ */
+bool brace_range(const std::string& body, std::vector<std::string>& items) {
+    constexpr long MAX_ITEMS = 4096;
+    const size_t dots = body.find("..");
+    if (dots == std::string::npos) {
+        return false;
+    }
+    std::string first = body.substr(0, dots);
+    std::string last = body.substr(dots + 2);
+    long step = 1;
+    const size_t step_dots = last.find("..");
+    auto number = [](const std::string& text, long& value) {
+        const char* end = text.data() + text.size();
+        return !text.empty() && std::from_chars(text.data(), end, value).ptr == end;
+    };
+    if (step_dots != std::string::npos && (!number(last.substr(step_dots + 2), step) || step == 0)) {
+        return false;
+    }
+    if (step_dots != std::string::npos) {
+        last.resize(step_dots);
+    }
+    step = std::labs(step);
+    
+    long from = 0;
+    long to = 0;
+    if (number(first, from) && number(last, to)) {
+        if (std::labs(to - from) / step >= MAX_ITEMS) {
+            throw std::runtime_error("Brace range {" + body + "} has more than 4096 items");
+        }
+        // A leading zero pads every item to the wider end
+        auto padded = [](const std::string& text) { return text.size() > 1 && text[text.front() == '-' ? 1 : 0] == '0'; };
+        const size_t width = padded(first) || padded(last) ? std::max(first.size(), last.size()) : 0;
+        for (long value = from; from <= to ? value <= to : value >= to; value += from <= to ? step : -step) {
+            std::string item = std::to_string(std::labs(value));
+            const size_t digits = width > (value < 0 ? 1u : 0u) ? width - (value < 0 ? 1 : 0) : 0;
+            if (item.size() < digits) {
+                item.insert(0, digits - item.size(), '0');
+            }
+            items.push_back(value < 0 ? "-" + item : item);
+        }
+        return true;
+    }
+    if (first.size() == 1 && last.size() == 1 && std::isalpha(static_cast<unsigned char>(first[0])) &&
+        std::isalpha(static_cast<unsigned char>(last[0]))) {
+        const int a = first[0];
+        const int b = last[0];
+        for (int c = a; a <= b ? c <= b : c >= b; c += a <= b ? static_cast<int>(step) : -static_cast<int>(step)) {
+            items.emplace_back(1, static_cast<char>(c));
+        }
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Brace expansion of one word, as the shell does it before anything
+ * else: "{a,b}c" gives "ac" and "bc", "x{1..3}" gives x1 x2 x3. Braces
+ * with neither a comma nor a range, and escaped ones, stay as they are.
+ */
+void expand_braces(const std::string& word, std::vector<std::string>& out) {
+    constexpr size_t MAX_WORDS = 4096;
+    for (size_t open = 0; open < word.size(); open++) {
+        if (word[open] == '\\') {
+            open++;
+            continue;
+        }
+        if (word[open] != '{') {
+            continue;
+        }
+        std::vector<size_t> commas;
+        size_t close = std::string::npos;
+        size_t depth = 0;
+        for (size_t i = open + 1; i < word.size() && close == std::string::npos; i++) {
+            if (word[i] == '\\') {
+                i++;
+            } else if (word[i] == '{') {
+                depth++;
+            } else if (word[i] == '}' && depth == 0) {
+                close = i;
+            } else if (word[i] == '}') {
+                depth--;
+            } else if (word[i] == ',' && depth == 0) {
+                commas.push_back(i);
+            }
+        }
+        if (close == std::string::npos) {
+            break;
+        }
+        
+        std::vector<std::string> items;
+        if (!commas.empty()) {
+            size_t from = open + 1;
+            commas.push_back(close);
+            for (const size_t comma : commas) {
+                items.push_back(word.substr(from, comma - from));
+                from = comma + 1;
+            }
+        } else if (!brace_range(word.substr(open + 1, close - open - 1), items)) {
+            continue;
+        }
+        const std::string prefix = word.substr(0, open);
+        const std::string suffix = word.substr(close + 1);
+        for (const auto& item : items) {
+            expand_braces(prefix + item + suffix, out);
+            if (out.size() > MAX_WORDS) {
+                throw std::runtime_error("Brace expansion of " + word + " gives more than 4096 words");
+            }
+        }
+        return;
+    }
+    out.push_back(word);
+}
+
+/**
+ * A leading "~" or "~/" replaced by $HOME
+ */
+std::string expand_tilde(const std::string& word) {
+    if (word.empty() || word[0] != '~' || (word.size() > 1 && word[1] != '/')) {
+        return word;
+    }
+    const char* home = std::getenv("HOME");
+    return home != nullptr && *home != '\0' ? home + word.substr(1) : word;
+}
+
+/**
+ * Pathname expansion for rm -rf operands that reach advisor unexpanded,
+ * from hooks, scripts and --command.
+ *
+ * A pattern is matched one path component at a time. Runs of literal
+ * components are appended without touching the disk, so the only
+ * directories read are those a glob component has to be matched in,
+ * each once. `**` matches any number of directories; like bash, it
+ * matches a symbolic link to a directory but does not descend below it.
+ * At the end of a pattern it stops at the first level, since those
+ * entries hold everything below. As in the shell, a leading '.' is only
+ * matched by a pattern starting with one, a trailing '/' keeps
+ * directories only, and the matches of a pattern are sorted.
+ */
+class GlobExpander {
+public:
+    /**
+     * Append the paths matching `pattern` to `out`; returns how many
+     */
+    size_t expand(const std::string& pattern, std::vector<std::string>& out) {
+        components_.clear();
+        for (size_t from = 0; from < pattern.size();) {
+            const size_t slash = std::min(pattern.find('/', from), pattern.size());
+            if (slash > from) {
+                components_.push_back(pattern.substr(from, slash - from));
+            }
+            from = slash + 1;
+        }
+        directories_only_ = pattern.size() > 1 && pattern.back() == '/';
+        
+        const size_t first = out.size();
+        out_ = &out;
+        visit(pattern.compare(0, 1, "/") == 0 ? "/" : "", 0, false);
+        std::sort(out.begin() + static_cast<std::ptrdiff_t>(first), out.end());
+        out.erase(std::unique(out.begin() + static_cast<std::ptrdiff_t>(first), out.end()), out.end());
+        return out.size() - first;
+    }
+    
+    uint64_t directories_read() const { return directories_read_; }
+    
+    /**
+     * True when a component has an unescaped `*`, `?` or `[`
+     */
+    static bool is_pattern(std::string_view component) {
+        for (size_t i = 0; i < component.size(); i++) {
+            if (component[i] == '\\') {
+                i++;
+            } else if (component[i] == '*' || component[i] == '?' || component[i] == '[') {
+                return true;
+            }
+        }
+        return false;
+    }
+    
+private:
+    struct Entry {
+        std::string name;
+        bool directory;  // a real directory, not a link to one
+        bool link;
+    };
+    
+    static std::string join(const std::string& dir, const std::string& name) {
+        return dir.empty() ? name : dir.back() == '/' ? dir + name : dir + '/' + name;
+    }
+    
+    /**
+     * Continue matching at component `index`; `exists` when `path` is
+     * already known to be there
+     */
+    void visit(std::string path, size_t index, bool exists) {
+        for (; index < components_.size() && !is_pattern(components_[index]); index++) {
+            std::string literal = components_[index];
+            literal.erase(std::remove(literal.begin(), literal.end(), '\\'), literal.end());
+            path = join(path, literal);
+            exists = false;
+        }
+        if (index == components_.size()) {
+            add(path, exists);
+            return;
+        }
+        std::vector<Entry> entries;
+        if (list(path, entries)) {
+            match(path, entries, index);
+        }
+    }
+    
+    /**
+     * Match component `index` against the entries of `dir`
+     */
+    void match(const std::string& dir, const std::vector<Entry>& entries, size_t index) {
+        const std::string& component = components_[index];
+        const bool last = index + 1 == components_.size();
+        if (component == "**") {
+            if (last) {
+                for (const auto& entry : entries) {
+                    if (entry.name[0] != '.') {
+                        add(join(dir, entry.name), true);
+                    }
+                }
+                return;
+            }
+            match(dir, entries, index + 1);  // no directory at all
+            for (const auto& entry : entries) {
+                std::vector<Entry> below;
+                if ((entry.directory || entry.link) && entry.name[0] != '.' && list(join(dir, entry.name), below)) {
+                    match(join(dir, entry.name), below, entry.directory ? index : index + 1);
+                }
+            }
+            return;
+        }
+        for (const auto& entry : entries) {
+            if ((entry.name[0] == '.' && component[0] != '.') || !glob_match(component, entry.name)) {
+                continue;
+            }
+            if (last) {
+                add(join(dir, entry.name), true);
+            } else {
+                visit(join(dir, entry.name), index + 1, true);
+            }
+        }
+    }
+    
+    bool list(const std::string& dir, std::vector<Entry>& entries) {
+        DIR* handle = ::opendir(dir.empty() ? "." : dir.c_str());
+        if (handle == nullptr) {
+            return false;
+        }
+        directories_read_++;
+        while (const dirent* entry = ::readdir(handle)) {
+            const std::string_view name = entry->d_name;
+            if (name == "." || name == "..") {
+                continue;
+            }
+            bool directory = entry->d_type == DT_DIR;
+            bool link = entry->d_type == DT_LNK;
+            struct stat info{};
+            if (entry->d_type == DT_UNKNOWN && ::fstatat(::dirfd(handle), entry->d_name, &info, AT_SYMLINK_NOFOLLOW) == 0) {
+                directory = S_ISDIR(info.st_mode);
+                link = S_ISLNK(info.st_mode);
+            }
+            entries.push_back({std::string(name), directory, link});
+        }
+        ::closedir(handle);
+        return true;
+    }
+    
+    void add(const std::string& path, bool exists) {
+        struct stat info{};
+        if (directories_only_ ? ::stat(path.c_str(), &info) != 0 || !S_ISDIR(info.st_mode)
+                              : !exists && ::lstat(path.c_str(), &info) != 0) {
+            return;
+        }
+        out_->push_back(path);
+    }
+    
+    std::vector<std::string> components_;
+    bool directories_only_ = false;
+    std::vector<std::string>* out_ = nullptr;
+    uint64_t directories_read_ = 0;
+};
+
+/**
+ * The rm -rf operands after the expansions the shell would have made:
+ * tilde, braces and globs. Relative operands are resolved against `cwd`
+ * when one is given. An operand naming an existing path is taken as it
+ * is, so a quoted name with a `*` in it still means that file. Patterns
+ * are reported in `patterns`; one that matches nothing is dropped, as
+ * rm -f would ignore it.
+ */
+std::vector<std::string> expand_operands(const std::vector<std::string>& operands, const std::string& cwd,
+                                         std::vector<PatternExpansion>& patterns) {
+    std::vector<std::string> paths;
+    GlobExpander expander;
+    for (const auto& operand : operands) {
+        std::string word = expand_tilde(operand);
+        if (!cwd.empty() && word.compare(0, 1, "/") != 0) {
+            word = (fs::path(cwd) / word).string();
+        }
+        struct stat info{};
+        if (::lstat(word.c_str(), &info) == 0 ||
+            (word.find('{') == std::string::npos && !GlobExpander::is_pattern(word))) {
+            paths.push_back(std::move(word));
+            continue;
+        }
+        
+        const auto start = std::chrono::steady_clock::now();
+        const uint64_t directories_before = expander.directories_read();
+        const size_t first = paths.size();
+        std::vector<std::string> words;
+        expand_braces(word, words);
+        for (auto& each : words) {
+            if (GlobExpander::is_pattern(each)) {
+                expander.expand(each, paths);
+            } else {
+                paths.push_back(std::move(each));
+            }
+        }
+        patterns.push_back({operand, paths.size() - first, expander.directories_read() - directories_before,
+                            std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count()});
+    }
+    if (paths.empty()) {
+        throw std::runtime_error("No match for " + join_paths(operands));
+    }
+    return paths;
+}
+
+// Directories of one rm -rf that get a quick look before the scan
+constexpr size_t MAX_QUICK_LOOKS = 16;
+
+/**
+ * What an rm -rf of one or more paths comes down to: the directories to
+ * scan, with duplicates and nested ones folded into the target holding
+ * them, and the files that are targets themselves
+ */
+struct RemovePlan {
+    std::string root;                  // for analyze_folder(): the only directory, or the directories' common ancestor; empty without any
+    std::vector<std::string> targets;  // canonical, when more than one directory is scanned
+    std::vector<size_t> target_given;  // index into `given` of each directory scanned
+    std::vector<std::pair<size_t, std::string>> files;  // index into `given` and canonical path of each file
+    std::vector<TargetTotals> given;   // every path as given; skipped ones say why, files have their totals
+};
+
+/**
+ * Canonicalize and deduplicate rm -rf targets. Throws the first error
+ * when none of them can be analyzed.
+ */
+RemovePlan plan_removal(const std::vector<std::string>& paths) {
+    RemovePlan plan;
+    std::vector<std::pair<std::string, size_t>> order;  // sort key, index into paths
+    std::vector<bool> directory(paths.size(), false);
+    std::string first_error;
+    for (size_t i = 0; i < paths.size(); i++) {
+        plan.given.push_back({paths[i], 0, 0, 0, ""});
+        try {
+            const fs::path given = paths[i];
+            // lstat() follows a link only for a trailing slash, which is also when rm -r does
+            struct stat info{};
+            const bool exists = ::lstat(paths[i].c_str(), &info) == 0;
+            directory[i] = exists && S_ISDIR(info.st_mode);
+            if (!exists) {
+                PosixFs().check_directory(paths[i]);
+            }
+            // A file or a link is removed by itself: only its directory is resolved
+            std::string key = directory[i] ? fs::canonical(given).string()
+                                           : (fs::canonical(given.has_parent_path() ? given.parent_path() : ".") /
+                                              given.filename()).string();
+            plan.given[i].files = directory[i] ? 0 : 1;
+            plan.given[i].bytes = directory[i] ? 0 : static_cast<uint64_t>(info.st_size);
+            // '\0' sorts below every name byte, so each directory comes right before what it holds
+            std::replace(key.begin(), key.end(), '/', '\0');
+            order.emplace_back(std::move(key), i);
+        } catch (const std::exception& e) {
+            plan.given[i].skipped = e.what();
+            first_error = first_error.empty() ? e.what() : first_error;
+        }
+    }
+    if (order.empty()) {
+        throw std::runtime_error(first_error);
+    }
+    
+    std::sort(order.begin(), order.end());
+    std::vector<std::pair<std::string, size_t>> kept;  // canonical path, index into paths
+    for (auto& [key, index] : order) {
+        std::replace(key.begin(), key.end(), '\0', '/');
+        if (!kept.empty() && ScanHistory::is_within(key, kept.back().first)) {
+            plan.given[index].skipped = paths[index] + (key != kept.back().first ? " is inside "
+                                                   : directory[index] ? " is the same directory as "
+                                                                      : " is the same file as ") +
+                                        paths[kept.back().second];
+            plan.given[index].files = 0;
+            plan.given[index].bytes = 0;
+            continue;
+        }
+        kept.emplace_back(std::move(key), index);
+    }
+    
+    std::vector<std::pair<std::string, size_t>> directories;
+    for (auto& [canonical, index] : kept) {
+        if (directory[index]) {
+            directories.emplace_back(std::move(canonical), index);
+        } else {
+            plan.files.emplace_back(index, std::move(canonical));
+        }
+    }
+    if (directories.size() == 1) {
+        plan.root = paths[directories[0].second];
+        plan.target_given.push_back(directories[0].second);
+        return plan;
+    }
+    for (auto& [canonical, index] : directories) {
+        if (plan.root.empty()) {
+            plan.root = canonical;
+        }
+        while (!ScanHistory::is_within(canonical, plan.root)) {
+            plan.root.resize(std::max<size_t>(1, plan.root.rfind('/')));
+        }
+        plan.targets.push_back(std::move(canonical));
+        plan.target_given.push_back(index);
+    }
+    return plan;
+}
+
+/**
+ * Per-path totals of an rm -rf with several paths, in the order given;
+ * empty for a single path
+ */
+std::vector<TargetTotals> target_report(const RemovePlan& plan, const AnalysisResult& result) {
+    if (plan.given.size() < 2) {
+        return {};
+    }
+    std::vector<TargetTotals> report = plan.given;
+    for (size_t i = 0; i < plan.target_given.size(); i++) {
+        TargetTotals& totals = report[plan.target_given[i]];
+        if (plan.targets.empty()) {
+            totals.files = result.total_files;
+            totals.directories = result.total_directories;
+            totals.bytes = result.total_size;
+        } else if (i < result.targets.size()) {
+            totals.files = result.targets[i].files;
+            totals.directories = result.targets[i].directories;
+            totals.bytes = result.targets[i].bytes;
+        }
+    }
+    return report;
+}
+
+/**
+ * The directories of a plan that get a quick look: only the first few,
+ * since the scan covers every one anyway
+ */
+std::vector<std::string> quick_look_targets(const RemovePlan& plan) {
+    if (plan.targets.empty()) {
+        return plan.root.empty() ? std::vector<std::string>{} : std::vector<std::string>{plan.root};
+    }
+    return {plan.targets.begin(), plan.targets.begin() + static_cast<std::ptrdiff_t>(std::min(plan.targets.size(), MAX_QUICK_LOOKS))};
+}
+
+/**
+ * Count a sensitive file that is an rm -rf target itself
+ */
+void add_sensitive_target(std::vector<SensitiveFinding>& findings, uint64_t bits, const std::string& path) {
+    const auto kind = static_cast<size_t>(SENSITIVE_PATTERNS[__builtin_ctzll(bits)].kind);
+    auto kind_of = [](const SensitiveFinding& finding) {
+        return static_cast<size_t>(std::find(std::begin(SENSITIVE_KIND_NAMES), std::end(SENSITIVE_KIND_NAMES),
+                                             finding.category) - std::begin(SENSITIVE_KIND_NAMES));
+    };
+    auto at = std::find_if(findings.begin(), findings.end(), [&](const SensitiveFinding& finding) { return kind_of(finding) >= kind; });
+    if (at == findings.end() || kind_of(*at) != kind) {
+        at = findings.insert(at, SensitiveFinding{SENSITIVE_KIND_NAMES[kind], 0, {}});
+    }
+    at->count++;
+    // Targets are as shallow as it gets
+    at->samples.insert(at->samples.begin(), {path, ""});
+    at->samples.resize(std::min(at->samples.size(), SENSITIVE_SAMPLES));
+}
+
+/**
+ * Analyze what an rm -rf plan removes: its directories in one scan, and
+ * the files among its targets. Files are checked against the protection
+ * rules like directories; a Critical one blocks the scan.
+ */
+AnalysisResult analyze_removal(const RemovePlan& plan, const ScanOptions& scan, ScanStats* stats = nullptr) {
+    std::vector<ProtectedMatch> protection;
+    if (scan.protection != nullptr) {
+        for (const auto& [index, canonical] : plan.files) {
+            for (auto& match : scan.protection->match_target(canonical)) {
+                protection.push_back(std::move(match));
+            }
+        }
+    }
+    const bool blocked = std::any_of(protection.begin(), protection.end(), [](const ProtectedMatch& match) {
+        return match.relation == Protection::Is && match.severity == Severity::Critical;
+    });
+    
+    AnalysisResult result;
+    if (!plan.root.empty() && !blocked) {
+        result = analyze_folder(plan.root, scan, stats, plan.targets);
+    }
+    result.targets = target_report(plan, result);
+    result.protected_paths.insert(result.protected_paths.begin(), protection.begin(), protection.end());
+    result.blocked_by_policy |= blocked;
+    if (blocked) {
+        return result;
+    }
+    for (const auto& [index, canonical] : plan.files) {
+        const TargetTotals& file = plan.given[index];
+        const std::string name = fs::path(file.path).filename().string();
+        result.total_files += file.files;
+        result.total_size += file.bytes;
+        if (file.files == 0) {
+            continue;
+        }
+        result.file_types.add(get_extension(name));
+        if (file.bytes > result.largest_file_size) {
+            result.largest_file_size = file.bytes;
+            result.largest_file_path = file.path;
+        }
+        if (const uint64_t bits = SensitiveMatcher::instance().match(name) & ~sensitive_directory_bits()) {
+            add_sensitive_target(result.sensitive, bits, file.path);
+        }
+    }
+    return result;
+}
+
+/**
+ * rm -rf analysis for --format json/ndjson: the result (or an error)
+ * as one record, preceded by progress records in NDJSON mode. Returns
+ * Protected when the target is, or the scan found, a Critical protected
+ * path, and Blocked when the scan stopped at a --block-over threshold.
+ */
+Advice report_remove_json(const std::vector<std::string>& paths, const AdvisorOptions& options) {
+    JsonWriter json;
+    ScanOptions scan = options.scan;
+    if (options.format == OutputFormat::Ndjson) {
+        // Runs on the scanner's progress thread while this one waits in analyze_folder()
+        scan.progress = [&json](const ScanProgress& progress) { write_progress_json(json, progress); };
+    }
+    
+    try {
+        std::vector<PatternExpansion> patterns;
+        const std::vector<std::string> targets = expand_operands(paths, "", patterns);
+        const RemovePlan plan = plan_removal(targets);
+        if (options.format == OutputFormat::Ndjson) {
+            for (const auto& pattern : patterns) {
+                write_expansion_json(json, pattern);
+            }
+            for (const auto& target : quick_look_targets(plan)) {
+                write_quick_look_json(json, target, quick_look(target, scan.protection));
+            }
+        }
+        ScanStats stats;
+        AnalysisResult result = analyze_removal(plan, scan, options.stats ? &stats : nullptr);
+        result.patterns = std::move(patterns);
+        write_analysis_json(json, targets.size() == 1 ? targets[0] : "", result, options.stats ? &stats : nullptr);
+        return blocked_advice(result);
+    } catch (const std::exception& e) {
+        begin_json_record(json, "error");
+        json.key("target").value(join_paths(paths)).key("message").value(e.what());
+        json.end_object();
+        json.end_record();
+    }
+    return Advice::Given;
+}
+
+/**
+ * Non-scanning advisories for --format json/ndjson
+ */
+void report_command_json(const std::string& cmd, const std::vector<std::string>& args, const std::string& warning) {
+    JsonWriter json;
+    begin_json_record(json, "advisory");
+    json.key("command").value(cmd);
+    json.key("args").begin_array();
+    for (const auto& arg : args) {
+        json.value(arg);
+    }
+    json.end_array();
+    json.key("warning").value(warning);
+    json.end_object();
+    json.end_record();
+}
+
+/**
+ * Handle reboot/shutdown commands
+ */
+void handle_system_command(const std::string& cmd) {
+    print_header("SYSTEM COMMAND ADVISORY");
+    
+    std::cout << Color::BOLD << "Command: " << Color::MAGENTA << cmd << Color::RESET << "\n\n";
+    
+    print_warning("This will " + cmd + " your entire system!");
+    std::cout << "\n";
+    print_info("Impact", "All running applications will be terminated");
+    print_info("Data Loss Risk", "Any unsaved work will be lost");
+    print_info("Affected Users", "All logged-in users will be disconnected");
+    
+    std::cout << "\n" << Color::BOLD << Color::RED 
+              << "⛔ This is a critical system operation. Ensure all work is saved!\n" 
+              << Color::RESET;
+}
+
+/**
+ * Print the quick look, before the deep analysis starts
+ */
+void display_quick_look(const QuickLook& look) {
+    std::cout << Color::BOLD << Color::BLUE << "\n⚡ Quick Look:\n" << Color::RESET;
+    print_separator();
+    print_info("Target", look.canonical_path);
+    print_info("Mount Point", look.mount_point ? "yes - an entire filesystem" : "no");
+    
+    NumberText entries = format_count(look.entries);
+    if (look.more_entries) {
+        entries.append("+");
+    }
+    print_info("Top-Level Entries", std::string(entries) + " (" + std::string(format_count(look.directories)) +
+                                    " directories)");
+    if (look.markers.empty()) {
+        print_info("Sensitive Markers", "none at the top level");
+    } else {
+        std::string markers;
+        for (const auto& marker : look.markers) {
+            markers.append(markers.empty() ? "" : ", ").append(marker);
+        }
+        std::cout << "  " << Color::YELLOW << std::left << std::setw(20) << "Sensitive Markers" << Color::RESET
+                  << ": " << markers << "\n";
+    }
+    for (const auto& match : look.protection) {
+        print_protected(match);
+    }
+    print_info("Answered In", format_duration(look.elapsed));
+}
+
+/**
+ * One line describing a scan in progress
+ */
+std::string progress_text(const ScanProgress& progress) {
+    return "Scanned " + std::string(format_count(progress.files)) + " files in " +
+           std::string(format_count(progress.directories)) + " directories, " +
+           std::string(format_size(progress.bytes)) + " so far (" +
+           format_duration(static_cast<double>(progress.elapsed_ms) / 1000.0) + ")";
+}
+
+/**
+ * A y/N question on the controlling terminal that can be answered while
+ * a scan is still running. The question line can be redrawn with progress.
+ */
+class TerminalPrompt {
+public:
+    TerminalPrompt() : fd_(::open("/dev/tty", O_RDWR | O_CLOEXEC | O_NOCTTY)) {}
+    ~TerminalPrompt() {
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+    }
+    
+    TerminalPrompt(const TerminalPrompt&) = delete;
+    TerminalPrompt& operator=(const TerminalPrompt&) = delete;
+    
+    bool available() const { return fd_ >= 0; }
+    
+    /**
+     * Replace the current terminal line with `text`
+     */
+    void show(const std::string& text) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const std::string line = "\r\033[K" + text;
+        if (::write(fd_, line.data(), line.size()) < 0) {
+            // Nothing sensible to do; the answer is still read
+        }
+    }
+    
+    /**
+     * Wait up to `timeout` (negative: forever) for an answer line:
+     * 1 for yes, 0 for no, -1 when none came
+     */
+    int answer(std::chrono::milliseconds timeout) {
+        pollfd ready{fd_, POLLIN, 0};
+        if (::poll(&ready, 1, static_cast<int>(timeout.count())) <= 0) {
+            return -1;
+        }
+        char line[256];
+        const ssize_t count = ::read(fd_, line, sizeof(line));
+        answered_ = true;
+        return count > 0 && (line[0] == 'y' || line[0] == 'Y') ? 1 : 0;
+    }
+    
+    bool answered() const { return answered_; }
+    
+private:
+    int fd_;
+    std::mutex mutex_;
+    bool answered_ = false;
+};
+
+/**
+ * Handle rm -rf commands: a quick look at the target first, then the
+ * full analysis as it completes. With --confirm the user is asked whether
+ * to go ahead and may answer before the analysis finishes. A Critical
+ * protected target is refused (Protected) without a scan; a target over a
+ * --block-over threshold (Blocked) or holding a Critical protected
+ * directory (Protected) is refused as soon as the scan finds out.
+ */
+Advice handle_remove_command(const std::vector<std::string>& paths, const AdvisorOptions& options) {
+    if (options.format != OutputFormat::Text) {
+        return report_remove_json(paths, options);
+    }
+    
+    print_header("DESTRUCTIVE OPERATION ADVISORY");
+    
+    const std::string path = join_paths(paths);
+    std::cout << Color::BOLD << "Command: " << Color::MAGENTA << "rm -rf " << path << Color::RESET << "\n\n";
+    
+    print_warning("Recursive deletion requested!");
+    
+    TerminalPrompt prompt;
+    const bool ask = options.confirm && prompt.available();
+    const std::string question = "Delete " + path + "? [y/N] ";
+    int answer = -1;
+    try {
+        std::vector<PatternExpansion> patterns;
+        const RemovePlan plan = plan_removal(expand_operands(paths, "", patterns));
+        for (const auto& pattern : patterns) {
+            print_info("Pattern", pattern.pattern + ": " + std::string(format_count(pattern.matches)) + " matches, " +
+                                  std::string(format_count(pattern.directories_read)) + " directories read in " +
+                                  format_duration(pattern.elapsed));
+        }
+        constexpr size_t MAX_SKIPPED_LINES = 10;
+        size_t skipped = 0;
+        for (const auto& target : plan.given) {
+            if (!target.skipped.empty() && skipped++ < MAX_SKIPPED_LINES) {
+                print_info("Skipped", target.skipped);
+            }
+        }
+        if (skipped > MAX_SKIPPED_LINES) {
+            print_info("Skipped", "and " + std::string(format_count(skipped - MAX_SKIPPED_LINES)) + " more paths");
+        }
+        const std::vector<std::string> looks = quick_look_targets(plan);
+        if (looks.size() < plan.targets.size()) {
+            print_info("Quick Looks", "the first " + std::to_string(looks.size()) + " of " +
+                                      std::string(format_count(plan.targets.size())) + " directories");
+        }
+        for (const auto& target : looks) {
+            const QuickLook look = quick_look(target, options.scan.protection);
+            display_quick_look(look);
+            for (const auto& match : look.protection) {
+                if (match.relation == Protection::Is && match.severity == Severity::Critical) {
+                    std::cout << "\n" << Color::BOLD << Color::RED << "⛔ BLOCKED: " << look.canonical_path
+                              << " is protected by " << match.pattern << " (critical)\n" << Color::RESET;
+                    return Advice::Protected;
+                }
+            }
+        }
+        
+        const size_t target_count = plan.target_given.size() + plan.files.size();
+        std::cout << "\n" << Color::YELLOW
+                  << (target_count > 1 ? "🔍 Analyzing " + std::string(format_count(target_count)) + " targets...\n"
+                      : plan.files.empty() ? std::string("🔍 Analyzing target directory...\n")
+                                           : std::string("🔍 Analyzing target file...\n"))
+                  << Color::RESET;
+        if (options.scan.governor.enabled) {
+            print_info("Scan Governor", "idle I/O class, nice 19, PSI-adaptive concurrency");
+        }
+        std::cout.flush();
+        
+        // The analysis runs in the background so progress can be shown and the
+        // question answered early
+        ScanOptions scan = options.scan;
+        std::atomic<bool> cancel{false};
+        scan.cancel = &cancel;
+        scan.progress_interval = std::chrono::milliseconds(250);
+        if (ask) {
+            scan.progress = [&](const ScanProgress& progress) { prompt.show("  " + progress_text(progress) + " - " + question); };
+            prompt.show(question);
+        } else if (stdout_is_terminal()) {
+            scan.progress = [](const ScanProgress& progress) { std::cout << "\r\033[K  " << progress_text(progress) << std::flush; };
+        }
+        
+        ScanStats stats;
+        AnalysisResult result;
+        std::exception_ptr failure;
+        std::atomic<bool> finished{false};
+        std::thread scanner([&] {
+            try {
+                result = analyze_removal(plan, scan, options.stats ? &stats : nullptr);
+            } catch (...) {
+                failure = std::current_exception();
+            }
+            finished = true;
+        });
+        while (ask && !finished && (answer = prompt.answer(std::chrono::milliseconds(50))) < 0) {
+        }
+        cancel = answer >= 0;
+        scanner.join();
+        if (scan.progress && !ask) {
+            std::cout << "\r\033[K";
+        }
+        if (failure) {
+            std::rethrow_exception(failure);
+        }
+        
+        if (result.over_limit) {
+            const bool too_many = options.scan.stop_over_files > 0 && result.total_files > options.scan.stop_over_files;
+            std::cout << "\n" << Color::BOLD << Color::RED << "⛔ BLOCKED: the target holds more than "
+                      << (too_many ? std::string(format_count(options.scan.stop_over_files)) + " files (--block-over-files)"
+                                   : std::string(format_size(options.scan.stop_over_bytes)) + " (--block-over)")
+                      << "\n   The scan stopped after " << format_count(result.total_files) << " files, "
+                      << format_size(result.total_size) << "; the rest was not scanned.\n" << Color::RESET;
+            return Advice::Blocked;
+        }
+        if (result.blocked_by_policy) {
+            const ProtectedMatch& critical = blocking_match(result.protected_paths);
+            std::cout << "\n" << Color::BOLD << Color::RED << "⛔ BLOCKED: "
+                      << (critical.relation == Protection::Is ? critical.path + " is protected"
+                                                              : "the target contains " + critical.path + ", protected")
+                      << " by " << critical.pattern << " (critical)"
+                      << "\n   The scan stopped after " << format_count(result.total_files) << " files, "
+                      << format_size(result.total_size) << "; the rest was not scanned.\n" << Color::RESET;
+            return Advice::Protected;
+        }
+        if (answer >= 0) {
+            std::cout << "\n" << Color::YELLOW << "Answered before the analysis finished; "
+                      << "scanned " << format_count(result.total_files) << " files, "
+                      << format_size(result.total_size) << " by then.\n" << Color::RESET;
+        } else {
+            display_analysis(result, options.stats ? &stats : nullptr);
+            if (options.stats) {
+                print_scan_stats(stats);
+            }
+            if (options.scan.max_memory > 0) {
+                print_info("Peak Memory", format_bytes(peak_rss_bytes()) + " (budget " +
+                                          format_bytes(options.scan.max_memory) + ")");
+            }
+            
+            std::cout << "\n" << Color::BOLD << Color::RED 
+                      << "⛔ DANGER: This operation is IRREVERSIBLE!\n"
+                      << "   All " << format_count(result.total_files) << " files and " 
+                      << format_count(result.total_directories) << " directories will be PERMANENTLY deleted.\n"
+                      << "   Total data loss: " << format_size(result.total_size) << "\n"
+                      << Color::RESET;
+        }
+                  
+    } catch (const std::exception& e) {
+        print_error(e.what());
+        std::cout << "\n" << Color::RED 
+                  << "Unable to analyze directory, but deletion would still proceed if executed!\n" 
+                  << Color::RESET;
+    }
+    
+    if (!options.confirm) {
+        return Advice::Given;
+    }
+    if (!ask) {
+        std::cout << "\n";
+        print_warning("--confirm needs a terminal to ask on; not confirming");
+        return Advice::Declined;
+    }
+    if (answer < 0) {
+        std::cout.flush();
+        prompt.show("\n" + question);
+        answer = prompt.answer(std::chrono::milliseconds(-1));
+    }
+    return answer == 1 ? Advice::Given : Advice::Declined;
+}
+
+/**
+ * A find command line split into its start points and its expression
+ */
+struct FindCommand {
+    std::vector<std::string> start_points;
+    std::vector<std::string> expression;
+};
+
+/**
+ * Split a find command line (args[0] is find). Start points run up to the
+ * first word that begins an expression; without one find starts at ".".
+ */
+FindCommand parse_find_command(int count, const char* const* args) {
+    FindCommand command;
+    int i = 1;
+    for (; i < count; i++) {
+        const std::string_view arg = args[i];
+        if (arg == "-L" || arg == "-follow") {
+            throw std::runtime_error("find: -L follows symbolic links, which advisor does not count");
+        }
+        if (arg == "-D") {
+            i++;
+        } else if (arg != "-H" && arg != "-P" && arg.substr(0, 2) != "-O") {
+            break;
+        }
+    }
+    for (; i < count; i++) {
+        const std::string_view arg = args[i];
+        if ((!arg.empty() && arg[0] == '-') || arg == "(" || arg == "!") {
+            break;
+        }
+        command.start_points.emplace_back(arg);
+    }
+    if (command.start_points.empty()) {
+        command.start_points.emplace_back(".");
+    }
+    command.expression.assign(args + i, args + count);
+    return command;
+}
+
+/**
+ * Handle a find that deletes (-delete, -exec rm): the expression is
+ * evaluated over each start point during the scan, and only what it
+ * deletes is counted. Blocked like rm -rf when a --block-over threshold
+ * is crossed, Protected when a Critical protected directory would go.
+ */
+Advice handle_find_command(int count, const char* const* args, const AdvisorOptions& options) {
+    std::string line = "find";
+    for (int i = 1; i < count; i++) {
+        line.append(" ").append(args[i]);
+    }
+    const bool json = options.format != OutputFormat::Text;
+    std::unique_ptr<JsonWriter> writer;
+    if (json) {
+        writer = std::make_unique<JsonWriter>();
+    } else {
+        print_header("DESTRUCTIVE OPERATION ADVISORY");
+        std::cout << Color::BOLD << "Command: " << Color::MAGENTA << line << Color::RESET << "\n\n";
+        print_warning("find deletes everything its expression matches!");
+    }
+    
+    Advice advice = Advice::Given;
+    std::string start;
+    try {
+        const FindCommand command = parse_find_command(count, args);
+        const FindProgram program = FindProgram::compile(command.expression);
+        ScanOptions scan = options.scan;
+        scan.find = &program;
+        if (json && options.format == OutputFormat::Ndjson) {
+            scan.progress = [&writer](const ScanProgress& progress) { write_progress_json(*writer, progress); };
+        } else if (!json && stdout_is_terminal()) {
+            scan.progress_interval = std::chrono::milliseconds(250);
+            scan.progress = [](const ScanProgress& progress) { std::cout << "\r\033[K  " << progress_text(progress) << std::flush; };
+        }
+        if (!json) {
+            print_info("Deletes By", program.action());
+        }
+        
+        for (const auto& point : command.start_points) {
+            start = point;
+            ScanStats stats;
+            if (!json) {
+                print_info("Start Point", point);
+                std::cout << "\n" << Color::YELLOW << "🔍 Evaluating the expression...\n" << Color::RESET << std::flush;
+            }
+            const AnalysisResult result = analyze_folder(point, scan, options.stats ? &stats : nullptr);
+            advice = std::max(advice, blocked_advice(result));
+            if (json) {
+                write_analysis_json(*writer, point, result, options.stats ? &stats : nullptr, "find");
+                continue;
+            }
+            if (scan.progress) {
+                std::cout << "\r\033[K";
+            }
+            if (result.over_limit) {
+                std::cout << "\n" << Color::BOLD << Color::RED << "⛔ BLOCKED: the matches under " << point
+                          << " exceed the --block-over threshold"
+                          << "\n   The scan stopped after " << format_count(result.total_files) << " files, "
+                          << format_size(result.total_size) << "; the rest was not scanned.\n" << Color::RESET;
+                return Advice::Blocked;
+            }
+            if (result.blocked_by_policy) {
+                const ProtectedMatch& critical = blocking_match(result.protected_paths);
+                std::cout << "\n" << Color::BOLD << Color::RED << "⛔ BLOCKED: the matches include "
+                          << critical.path << ", protected by " << critical.pattern << " (critical)\n"
+                          << Color::RESET;
+                return Advice::Protected;
+            }
+            display_analysis(result, options.stats ? &stats : nullptr);
+            if (options.stats) {
+                print_scan_stats(stats);
+            }
+            std::cout << "\n" << Color::BOLD << Color::RED
+                      << "⛔ DANGER: This operation is IRREVERSIBLE!\n"
+                      << "   " << format_count(result.total_files) << " files and "
+                      << format_count(result.total_directories) << " directories under " << point
+                      << " match and will be PERMANENTLY deleted.\n"
+                      << "   Total data loss: " << format_size(result.total_size) << "\n" << Color::RESET;
+            if (program.action().find("-delete") != std::string::npos && result.total_directories > 0) {
+                std::cout << Color::YELLOW << "   (-delete removes a directory only once it is empty)\n"
+                          << Color::RESET;
+            }
+        }
+    } catch (const std::exception& e) {
+        if (json) {
+            begin_json_record(*writer, "error");
+            writer->key("target").value(start.empty() ? line : start).key("message").value(e.what());
+            writer->end_object();
+            writer->end_record();
+        } else {
+            print_error(e.what());
+            std::cout << "\n" << Color::RED
+                      << "Unable to evaluate the expression, but find would still delete what it matches!\n"
+                      << Color::RESET;
+        }
+    }
+    return advice;
+}
+
+/**
+ * True when `word` is one of the '|'-separated words in `words`
+ */
+bool word_in_list(std::string_view word, std::string_view words) {
+    while (!words.empty()) {
+        const size_t bar = words.find('|');
+        if (words.substr(0, bar) == word) {
+            return true;
+        }
+        words = bar == std::string_view::npos ? std::string_view() : words.substr(bar + 1);
+    }
+    return false;
+}
+
+/**
+ * What advisor does with a command line
+ */
+enum class CommandAction : uint8_t {
+    Benign,       // nothing to say; exit silently
+    Remove,       // recursive deletion: scan the target
+    RemoveUsage,  // recursive deletion without a target
+    Power,        // reboot, shutdown and friends
+    FindDelete,   // find expression that deletes: evaluate it over the tree
+    Warn          // generic destructive-command warning
+};
+
+/**
+ * Flags the command rules test for, whatever their spelling
+ */
+enum CommandFlag : uint32_t {
+    FLAG_RECURSIVE = 1u << 0,
+    FLAG_FORCE = 1u << 1,
+    FLAG_CANCEL = 1u << 2,
+    FLAG_LIST = 1u << 3,
+    FLAG_ALL = 1u << 4,
+    FLAG_HELP = 1u << 5,
+};
+
+/**
+ * One spelling of a flag: a short option letter (also inside clusters
+ * such as -rf), a long option, or both
+ */
+struct FlagSpelling {
+    char short_name;
+    std::string_view long_name;
+    uint32_t flag;
+};
+
+/**
+ * Operand patterns a rule can require
+ */
+enum class ArgShape : uint8_t {
+    Any,           // no requirement
+    Operand,       // at least one operand
+    NoOperand,     // no operands at all
+    OperandPrefix, // some operand starts with `argument` (dd of=)
+    FirstOperand,  // the first operand is one of the '|'-separated words in `argument`
+    Word,          // some argument is one of the '|'-separated words in `argument`
+    ExecRemove     // one of the `argument` words runs rm (find -exec rm {} ;)
+};
+
+/**
+ * One classification rule; a command's rules are tried in order and the
+ * first match wins
+ */
+struct CommandRule {
+    uint32_t required = 0;  // flags that must all be present
+    uint32_t excluded = 0;  // flags that must all be absent
+    ArgShape shape = ArgShape::Any;
+    std::string_view argument;
+    CommandAction action = CommandAction::Benign;
+    std::string_view verb;  // what a Power rule does, if not the matched word itself
+};
+
+/**
+ * Everything advisor knows about one command name
+ */
+struct CommandSpec {
+    std::string_view name;
+    const FlagSpelling* flags;
+    size_t flag_count;
+    const CommandRule* rules;
+    size_t rule_count;
+};
+
+namespace CommandTable {
+    constexpr FlagSpelling NO_FLAGS[] = {{'\0', "", 0}};
+    constexpr FlagSpelling RM_FLAGS[] = {
+        {'r', "recursive", FLAG_RECURSIVE}, {'R', "", FLAG_RECURSIVE}, {'f', "force", FLAG_FORCE},
+        {'\0', "help", FLAG_HELP},
+    };
+    constexpr FlagSpelling CHMOD_FLAGS[] = {{'R', "recursive", FLAG_RECURSIVE}, {'\0', "help", FLAG_HELP}};
+    constexpr FlagSpelling SHUTDOWN_FLAGS[] = {{'c', "", FLAG_CANCEL}, {'\0', "help", FLAG_HELP}};
+    constexpr FlagSpelling POWER_FLAGS[] = {{'\0', "help", FLAG_HELP}};
+    constexpr FlagSpelling LIST_FLAGS[] = {{'l', "list", FLAG_LIST}, {'\0', "help", FLAG_HELP}};
+    constexpr FlagSpelling WIPEFS_FLAGS[] = {{'a', "all", FLAG_ALL}, {'\0', "help", FLAG_HELP}};
+    
+    constexpr CommandRule RM_RULES[] = {
+        {FLAG_HELP, 0, ArgShape::Any, "", CommandAction::Benign, ""},
+        {FLAG_RECURSIVE, 0, ArgShape::Operand, "", CommandAction::Remove, ""},
+        {FLAG_RECURSIVE, 0, ArgShape::NoOperand, "", CommandAction::RemoveUsage, ""},
+        {0, 0, ArgShape::Operand, "", CommandAction::Warn, ""},
+    };
+    constexpr CommandRule RECURSIVE_RULES[] = {
+        {FLAG_RECURSIVE, FLAG_HELP, ArgShape::Operand, "", CommandAction::Warn, ""},
+    };
+    constexpr CommandRule SHUTDOWN_RULES[] = {
+        {0, FLAG_CANCEL | FLAG_HELP, ArgShape::Any, "", CommandAction::Power, ""},
+    };
+    constexpr CommandRule POWER_RULES[] = {
+        {0, FLAG_HELP, ArgShape::Any, "", CommandAction::Power, ""},
+    };
+    constexpr CommandRule SYSTEMCTL_RULES[] = {
+        {0, 0, ArgShape::FirstOperand, "reboot|poweroff|halt|kexec|soft-reboot", CommandAction::Power, ""},
+        {0, 0, ArgShape::FirstOperand, "stop|kill|disable|mask|isolate", CommandAction::Warn, ""},
+    };
+    constexpr CommandRule INIT_RULES[] = {
+        {0, 0, ArgShape::FirstOperand, "0", CommandAction::Power, "shutdown"},
+        {0, 0, ArgShape::FirstOperand, "6", CommandAction::Power, "reboot"},
+    };
+    constexpr CommandRule DD_RULES[] = {
+        {0, 0, ArgShape::OperandPrefix, "of=", CommandAction::Warn, ""},
+    };
+    constexpr CommandRule PARTITION_RULES[] = {
+        {0, FLAG_LIST | FLAG_HELP, ArgShape::Operand, "", CommandAction::Warn, ""},
+    };
+    constexpr CommandRule WIPEFS_RULES[] = {
+        {FLAG_ALL, FLAG_HELP, ArgShape::Operand, "", CommandAction::Warn, ""},
+    };
+    constexpr CommandRule WARN_RULES[] = {
+        {0, FLAG_HELP, ArgShape::Operand, "", CommandAction::Warn, ""},
+    };
+    constexpr CommandRule ALWAYS_WARN_RULES[] = {
+        {0, 0, ArgShape::Any, "", CommandAction::Warn, ""},
+    };
+    constexpr CommandRule FIND_RULES[] = {
+        {0, 0, ArgShape::Word, "-delete", CommandAction::FindDelete, ""},
+        {0, 0, ArgShape::ExecRemove, "-exec|-execdir|-ok|-okdir", CommandAction::FindDelete, ""},
+    };
+    
+    #define ADVISOR_COMMAND(name, flags, rules) {name, flags, std::size(flags), rules, std::size(rules)}
+    constexpr CommandSpec COMMANDS[] = {
+        ADVISOR_COMMAND("rm", RM_FLAGS, RM_RULES),
+        ADVISOR_COMMAND("reboot", POWER_FLAGS, POWER_RULES),
+        ADVISOR_COMMAND("shutdown", SHUTDOWN_FLAGS, SHUTDOWN_RULES),
+        ADVISOR_COMMAND("halt", POWER_FLAGS, POWER_RULES),
+        ADVISOR_COMMAND("poweroff", POWER_FLAGS, POWER_RULES),
+        ADVISOR_COMMAND("systemctl", NO_FLAGS, SYSTEMCTL_RULES),
+        ADVISOR_COMMAND("init", NO_FLAGS, INIT_RULES),
+        ADVISOR_COMMAND("telinit", NO_FLAGS, INIT_RULES),
+        ADVISOR_COMMAND("dd", NO_FLAGS, DD_RULES),
+        ADVISOR_COMMAND("mkfs", POWER_FLAGS, WARN_RULES),
+        ADVISOR_COMMAND("mkswap", POWER_FLAGS, WARN_RULES),
+        ADVISOR_COMMAND("fdisk", LIST_FLAGS, PARTITION_RULES),
+        ADVISOR_COMMAND("sfdisk", LIST_FLAGS, PARTITION_RULES),
+        ADVISOR_COMMAND("parted", LIST_FLAGS, PARTITION_RULES),
+        ADVISOR_COMMAND("wipefs", WIPEFS_FLAGS, WIPEFS_RULES),
+        ADVISOR_COMMAND("shred", POWER_FLAGS, WARN_RULES),
+        ADVISOR_COMMAND("truncate", POWER_FLAGS, WARN_RULES),
+        ADVISOR_COMMAND("chmod", CHMOD_FLAGS, RECURSIVE_RULES),
+        ADVISOR_COMMAND("chown", CHMOD_FLAGS, RECURSIVE_RULES),
+        ADVISOR_COMMAND("chgrp", CHMOD_FLAGS, RECURSIVE_RULES),
+        ADVISOR_COMMAND("killall", POWER_FLAGS, WARN_RULES),
+        ADVISOR_COMMAND("pkill", POWER_FLAGS, WARN_RULES),
+        ADVISOR_COMMAND("kill", NO_FLAGS, ALWAYS_WARN_RULES),
+        ADVISOR_COMMAND("find", NO_FLAGS, FIND_RULES),
+    };
+    #undef ADVISOR_COMMAND
+    
+    // Perfect hash of the command names, found at compile time
+    constexpr size_t SLOTS = 64;
+    
+    constexpr uint32_t hash(std::string_view name, uint32_t seed) {
+        uint32_t h = 2166136261u ^ seed;
+        for (const char c : name) {
+            h = (h ^ static_cast<unsigned char>(c)) * 16777619u;
+        }
+        return h ^ (h >> 15);
+    }
+    
+    constexpr bool collision_free(uint32_t seed) {
+        bool used[SLOTS] = {};
+        for (const auto& command : COMMANDS) {
+            const size_t slot = hash(command.name, seed) % SLOTS;
+            if (used[slot]) {
+                return false;
+            }
+            used[slot] = true;
+        }
+        return true;
+    }
+    
+    constexpr uint32_t find_seed() {
+        uint32_t seed = 0;
+        while (!collision_free(seed)) {
+            seed++;
+        }
+        return seed;
+    }
+    
+    constexpr uint32_t SEED = find_seed();
+    
+    struct SlotTable {
+        int8_t index[SLOTS];
+    };
+    
+    constexpr SlotTable build_slots() {
+        SlotTable table{};
+        for (auto& slot : table.index) {
+            slot = -1;
+        }
+        for (size_t i = 0; i < std::size(COMMANDS); i++) {
+            table.index[hash(COMMANDS[i].name, SEED) % SLOTS] = static_cast<int8_t>(i);
+        }
+        return table;
+    }
+    
+    constexpr SlotTable SLOT_TABLE = build_slots();
+    static_assert(std::size(COMMANDS) <= SLOTS / 2, "grow SLOTS with the command table");
+    
+    /**
+     * The spec for a command name, or nullptr
+     */
+    inline const CommandSpec* find(std::string_view name) {
+        const int8_t index = SLOT_TABLE.index[hash(name, SEED) % SLOTS];
+        if (index < 0 || COMMANDS[index].name != name) {
+            return nullptr;
+        }
+        return &COMMANDS[index];
+    }
+}
+
+/**
+ * Result of classifying a command line
+ */
+struct CommandMatch {
+    CommandAction action = CommandAction::Benign;
+    std::string_view command;  // normalized name, or the systemctl verb for Power
+    int operand = -1;          // index of the first operand in the classified args
+};
+
+/**
+ * Classify a command line (args[0] is the command) against the compiled
+ * rule table without allocating: the name is looked up in the perfect
+ * hash, flags are folded into a bitmask by the command's own spellings,
+ * and the rules are then tried in order
+ */
+CommandMatch classify_command(int count, const char* const* args) {
+    CommandMatch match;
+    if (count < 1) {
+        return match;
+    }
+    
+    // /usr/bin/rm is rm, and every mkfs.<type> is mkfs
+    std::string_view name = args[0];
+    const size_t slash = name.rfind('/');
+    if (slash != std::string_view::npos) {
+        name.remove_prefix(slash + 1);
+    }
+    if (name.substr(0, 5) == "mkfs.") {
+        name = "mkfs";
+    }
+    const CommandSpec* spec = CommandTable::find(name);
+    if (spec == nullptr) {
+        return match;
+    }
+    match.command = name;
+    
+    auto short_flag = [&](char c) -> uint32_t {
+        for (size_t i = 0; i < spec->flag_count; i++) {
+            if (spec->flags[i].short_name == c) {
+                return spec->flags[i].flag;
+            }
+        }
+        return 0;
+    };
+    auto long_flag = [&](std::string_view option) -> uint32_t {
+        option = option.substr(0, option.find('='));
+        for (size_t i = 0; i < spec->flag_count; i++) {
+            if (!spec->flags[i].long_name.empty() && spec->flags[i].long_name == option) {
+                return spec->flags[i].flag;
+            }
+        }
+        return 0;
+    };
+    
+    uint32_t flags = 0;
+    int operands = 0;
+    bool options_done = false;
+    for (int i = 1; i < count; i++) {
+        const std::string_view arg = args[i];
+        if (options_done || arg.size() < 2 || arg[0] != '-') {
+            if (operands++ == 0) {
+                match.operand = i;
+            }
+        } else if (arg == "--") {
+            options_done = true;
+        } else if (arg[1] == '-') {
+            flags |= long_flag(arg.substr(2));
+        } else {
+            for (const char c : arg.substr(1)) {
+                flags |= short_flag(c);
+            }
+        }
+    }
+    
+    for (size_t r = 0; r < spec->rule_count; r++) {
+        const CommandRule& rule = spec->rules[r];
+        if ((flags & rule.required) != rule.required || (flags & rule.excluded) != 0) {
+            continue;
+        }
+        bool shape = true;
+        switch (rule.shape) {
+        case ArgShape::Any:
+            break;
+        case ArgShape::Operand:
+            shape = operands > 0;
+            break;
+        case ArgShape::NoOperand:
+            shape = operands == 0;
+            break;
+        case ArgShape::OperandPrefix:
+            shape = false;
+            for (int i = match.operand; i > 0 && i < count && !shape; i++) {
+                shape = std::string_view(args[i]).substr(0, rule.argument.size()) == rule.argument;
+            }
+            break;
+        case ArgShape::FirstOperand:
+            shape = operands > 0 && word_in_list(args[match.operand], rule.argument);
+            if (shape && rule.action == CommandAction::Power) {
+                match.command = rule.verb.empty() ? std::string_view(args[match.operand]) : rule.verb;
+            }
+            break;
+        case ArgShape::Word:
+            shape = false;
+            for (int i = 1; i < count && !shape; i++) {
+                shape = word_in_list(args[i], rule.argument);
+            }
+            break;
+        case ArgShape::ExecRemove:
+            shape = false;
+            for (int i = 1; i + 1 < count && !shape; i++) {
+                shape = word_in_list(args[i], rule.argument) && fs::path(args[i + 1]).filename() == "rm";
+            }
+            break;
+        }
+        if (shape) {
+            match.action = rule.action;
+            return match;
+        }
+    }
+    return match;
+}
+
+/**
+ * Every operand of a command line (args[0] is the command), skipping
+ * options the way classify_command() does
+ */
+std::vector<std::string> command_operands(int count, const char* const* args) {
+    std::vector<std::string> operands;
+    bool options_done = false;
+    for (int i = 1; i < count; i++) {
+        const std::string_view arg = args[i];
+        if (options_done || arg.size() < 2 || arg[0] != '-') {
+            operands.emplace_back(arg);
+        } else if (arg == "--") {
+            options_done = true;
+        }
+    }
+    return operands;
+}
+
+/**
+ * Advisor's own commands, which are never classified
+ */
+bool is_builtin_command(std::string_view cmd) {
+    return cmd == "audit" || cmd == "bench" || cmd == "help";
+}
+
+/**
+ * A program that runs another command given on its own command line
+ */
+struct CommandWrapper {
+    std::string_view name;
+    std::string_view value_options;       // short options that take a value
+    std::string_view long_value_options;  // '|'-separated long options that take a value
+    uint8_t operands;                     // operands before the wrapped command
+    bool supplies_operands;               // the wrapped command gets more operands at run time
+};
+
+constexpr CommandWrapper COMMAND_WRAPPERS[] = {
+    {"sudo", "ugCDhprtUT", "user|group|chdir|host|prompt|role|type|other-user|close-from|command-timeout", 0, false},
+    {"doas", "uC", "", 0, false},
+    {"env", "uCS", "unset|chdir|split-string", 0, false},
+    {"nice", "n", "adjustment", 0, false},
+    {"ionice", "cnpP", "class|classdata|pid|pgid|uid", 0, false},
+    {"nohup", "", "", 0, false},
+    {"time", "fo", "format|output", 0, false},
+    {"command", "", "", 0, false},
+    {"exec", "a", "", 0, false},
+    {"builtin", "", "", 0, false},
+    {"stdbuf", "ioe", "input|output|error", 0, false},
+    {"timeout", "sk", "signal|kill-after", 1, false},
+    {"chroot", "", "userspec|groups", 1, false},
+    {"watch", "nd", "interval|differences", 0, false},
+    {"xargs", "aEdILnPs", "arg-file|eof|delimiter|replace|max-lines|max-args|max-procs|max-chars|process-slot-var", 0, true},
+};
+
+/**
+ * Index of the word naming the command a command line actually runs,
+ * past NAME=VALUE assignments and wrappers such as sudo, env, nice and
+ * xargs (and their options); `count` when there is none. Sets
+ * `via_xargs` when xargs adds operands that are not on the line.
+ */
+template <typename WordAt>
+size_t find_command_word(size_t count, WordAt word_at, bool& via_xargs) {
+    size_t i = 0;
+    while (i < count) {
+        const std::string_view word = word_at(i);
+        const size_t equals = word.find('=');
+        if (equals != std::string_view::npos && equals > 0 && word[0] != '-' &&
+            word.find('/') > equals) {
+            i++;  // NAME=VALUE before the command, or an env argument
+            continue;
+        }
+        
+        std::string_view name = word.substr(word.rfind('/') + 1);
+        const CommandWrapper* wrapper = nullptr;
+        for (const auto& candidate : COMMAND_WRAPPERS) {
+            if (candidate.name == name) {
+                wrapper = &candidate;
+                break;
+            }
+        }
+        if (wrapper == nullptr) {
+            return i;
+        }
+        via_xargs = via_xargs || wrapper->supplies_operands;
+        
+        // Skip the wrapper's own options and operands
+        i++;
+        while (i < count) {
+            const std::string_view option = word_at(i);
+            if (option == "--") {
+                i++;
+                break;
+            }
+            if (option.size() < 2 || option[0] != '-') {
+                break;
+            }
+            i++;
+            if (option[1] == '-') {
+                if (option.find('=') == std::string_view::npos &&
+                    word_in_list(option.substr(2), wrapper->long_value_options)) {
+                    i++;
+                }
+                continue;
+            }
+            // In a cluster, the first option taking a value swallows the rest or the next word
+            for (size_t c = 1; c < option.size(); c++) {
+                if (wrapper->value_options.find(option[c]) != std::string_view::npos) {
+                    if (c + 1 == option.size()) {
+                        i++;
+                    }
+                    break;
+                }
+            }
+        }
+        i += wrapper->operands;
+    }
+    return count;
+}
+
+/**
+ * Set of byte values, usable in constant expressions
+ */
+struct CharSet {
+    uint64_t bits[4] = {};
+    
+    constexpr CharSet(std::string_view chars) {
+        for (const char c : chars) {
+            bits[static_cast<unsigned char>(c) / 64] |= uint64_t{1} << (static_cast<unsigned char>(c) % 64);
+        }
+    }
+    
+    constexpr bool test(unsigned char c) const { return (bits[c / 64] >> (c % 64)) & 1; }
+};
+
+// Characters that end a shell word, and those that end it or need a closer look
+constexpr CharSet SHELL_WORD_END{" \t\n\r|&;<>()"};
+constexpr CharSet SHELL_WORD_SPECIAL{" \t\n\r|&;<>()\\'\"$`*?[{~"};
+
+/**
+ * Shell command line parsed into a compact AST.
+ *
+ * Words are (offset, length) spans of the source, so parsing copies
+ * nothing; unquote() materializes a word only when a caller needs its
+ * value. Simple commands record their words, redirections and the
+ * operator joining them to the next command (|, &&, ||, ; or &), so a
+ * list of pipelines reads back in order. Command substitutions ($(...),
+ * `...`) are recorded as spans to parse separately. Heredoc bodies are
+ * skipped. Compound commands (if, while, for, case, { }, ( )) are
+ * flattened into the simple commands they contain.
+ */
+class ShellScript {
+public:
+    enum WordFlag : uint8_t {
+        WORD_QUOTED = 1,   // contains quotes or backslashes; unquote() before use
+        WORD_EXPANDS = 2,  // contains unquoted $, `, or glob characters
+    };
+    
+    enum class Connector : uint8_t { End, Pipe, And, Or, Sequence, Background };
+    
+    struct Word {
+        uint32_t offset;
+        uint32_t length;
+        uint8_t flags;
+    };
+    
+    struct Span {
+        uint32_t offset;
+        uint32_t length;
+    };
+    
+    struct Redirect {
+        Word target;
+        int32_t fd;  // explicit descriptor, or -1
+        char op[4];  // "<", ">", ">>", "<<", "<<<", "&>", ">&", ...
+    };
+    
+    struct Command {
+        uint32_t first_word;
+        uint32_t word_count;
+        uint32_t first_redirect;
+        uint32_t redirect_count;
+        Connector next;  // how this command connects to the following one
+    };
+    
+    /**
+     * Parse `source`, which must outlive the script; storage from earlier
+     * parses is reused
+     */
+    void parse(std::string_view source) {
+        source_ = source;
+        words_.clear();
+        redirects_.clear();
+        commands_.clear();
+        substitutions_.clear();
+        heredocs_.clear();
+        pos_ = 0;
+        begin_command();
+        
+        while (pos_ < source_.size()) {
+            const char c = source_[pos_];
+            if (c == ' ' || c == '\t' || c == '\r') {
+                pos_++;
+            } else if (c == '\\' && pos_ + 1 < source_.size() && source_[pos_ + 1] == '\n') {
+                pos_ += 2;  // line continuation
+            } else if (c == '#' && at_word_start()) {
+                while (pos_ < source_.size() && source_[pos_] != '\n') {
+                    pos_++;
+                }
+            } else if (c == '\n') {
+                pos_++;
+                end_command(Connector::Sequence);
+                skip_heredocs();
+            } else if (is_operator(c)) {
+                parse_operator();
+            } else {
+                parse_word();
+            }
+        }
+        end_command(Connector::End);
+    }
+    
+    std::string_view source() const { return source_; }
+    const std::vector<Word>& words() const { return words_; }
+    const std::vector<Redirect>& redirects() const { return redirects_; }
+    const std::vector<Command>& commands() const { return commands_; }
+    const std::vector<Span>& substitutions() const { return substitutions_; }
+    
+    /**
+     * A word as written, quotes included
+     */
+    std::string_view raw(const Word& word) const { return source_.substr(word.offset, word.length); }
+    
+    /**
+     * Source text of a command substitution
+     */
+    std::string_view text(const Span& span) const { return source_.substr(span.offset, span.length); }
+    
+    /**
+     * The value of a word after quote removal (expansions are left as written)
+     */
+    void unquote(const Word& word, std::string& out) const {
+        out.clear();
+        const std::string_view text = raw(word);
+        if ((word.flags & WORD_QUOTED) == 0) {
+            out.assign(text);
+            return;
+        }
+        for (size_t i = 0; i < text.size(); i++) {
+            const char c = text[i];
+            if (c == '\\' && i + 1 < text.size()) {
+                out += text[++i];
+            } else if (c == '\'') {
+                const size_t end = std::min(text.find('\'', i + 1), text.size());
+                out.append(text, i + 1, end - i - 1);
+                i = end;
+            } else if (c == '$' && i + 1 < text.size() && text[i + 1] == '\'') {
+                i = unquote_ansi(text, i + 2, out);
+            } else if (c == '"') {
+                for (i++; i < text.size() && text[i] != '"'; i++) {
+                    if (text[i] == '\\' && i + 1 < text.size() && std::string_view("$`\"\\").find(text[i + 1]) != std::string_view::npos) {
+                        i++;
+                    }
+                    out += text[i];
+                }
+            } else {
+                out += c;
+            }
+        }
+    }
+    
+private:
+    struct Heredoc {
+        std::string_view delimiter;
+        bool strip_tabs;
+    };
+    
+    static bool is_operator(char c) {
+        return c == '|' || c == '&' || c == ';' || c == '<' || c == '>' || c == '(' || c == ')';
+    }
+    
+    static bool is_word_end(char c) {
+        return SHELL_WORD_END.test(static_cast<unsigned char>(c));
+    }
+    
+    bool at_word_start() const {
+        return pos_ == 0 || is_word_end(source_[pos_ - 1]);
+    }
+    
+    void begin_command() {
+        commands_.push_back({static_cast<uint32_t>(words_.size()), 0,
+                             static_cast<uint32_t>(redirects_.size()), 0, Connector::End});
+        redirect_target_ = false;
+    }
+    
+    /**
+     * Close the current command; empty ones (e.g. after `;;` or a keyword)
+     * are dropped, but a stronger connector still replaces a weaker one
+     */
+    void end_command(Connector next) {
+        Command& command = commands_.back();
+        if (command.word_count == 0 && command.redirect_count == 0) {
+            if (commands_.size() > 1 && next != Connector::Sequence && next != Connector::End) {
+                commands_[commands_.size() - 2].next = next;
+            }
+            return;
+        }
+        command.next = next;
+        begin_command();
+    }
+    
+    void parse_operator() {
+        const std::string_view rest = source_.substr(pos_);
+        auto starts = [&](std::string_view op) { return rest.substr(0, op.size()) == op; };
+        
+        if (starts("&&")) {
+            pos_ += 2;
+            end_command(Connector::And);
+        } else if (starts("||")) {
+            pos_ += 2;
+            end_command(Connector::Or);
+        } else if (starts("|&") || starts("|")) {
+            pos_ += starts("|&") ? 2 : 1;
+            end_command(Connector::Pipe);
+        } else if (starts(";;&") || starts(";;") || starts(";&") || starts(";")) {
+            pos_ += starts(";;&") ? 3 : starts(";;") || starts(";&") ? 2 : 1;
+            end_command(Connector::Sequence);
+        } else if (starts("&>>") || starts("&>")) {
+            parse_redirect(starts("&>>") ? "&>>" : "&>", -1);
+        } else if (starts("&")) {
+            pos_++;
+            end_command(Connector::Background);
+        } else if (starts("(") || starts(")")) {
+            pos_++;
+            end_command(Connector::Sequence);
+        } else {
+            parse_redirect(nullptr, -1);
+        }
+    }
+    
+    /**
+     * Parse a redirection operator at pos_ (or the given one); its target
+     * is the next word
+     */
+    void parse_redirect(const char* op, int32_t fd) {
+        static constexpr std::string_view OPERATORS[] = {"<<<", "<<-", "&>>", "<<", ">>", "<&", ">&", "<>", ">|", "&>", "<", ">"};
+        std::string_view matched;
+        for (const auto candidate : OPERATORS) {
+            if ((op == nullptr || candidate == op) && source_.substr(pos_, candidate.size()) == candidate) {
+                matched = candidate;
+                break;
+            }
+        }
+        pos_ += matched.size();
+        Redirect redirect{{0, 0, 0}, fd, {}};
+        std::memcpy(redirect.op, matched.data(), matched.size());
+        redirects_.push_back(redirect);
+        commands_.back().redirect_count++;
+        redirect_target_ = true;
+        heredoc_pending_ = matched == "<<" || matched == "<<-";
+        heredoc_strip_ = matched == "<<-";
+    }
+    
+    void parse_word() {
+        const size_t start = pos_;
+        uint8_t flags = 0;
+        while (pos_ < source_.size()) {
+            const char c = source_[pos_];
+            if (!SHELL_WORD_SPECIAL.test(static_cast<unsigned char>(c))) {
+                pos_++;
+            } else if (is_word_end(c)) {
+                break;
+            } else if (c == '\\') {
+                flags |= WORD_QUOTED;
+                pos_ += 2;
+            } else if (c == '\'') {
+                flags |= WORD_QUOTED;
+                pos_ = std::min(source_.find('\'', pos_ + 1), source_.size() - 1) + 1;
+            } else if (c == '"') {
+                flags |= WORD_QUOTED;
+                skip_double_quoted();
+            } else if (c == '$' || c == '`') {
+                flags |= WORD_EXPANDS;
+                skip_expansion();
+            } else {
+                if (c == '*' || c == '?' || c == '[' || c == '{' || c == '~') {
+                    flags |= WORD_EXPANDS;
+                }
+                pos_++;
+            }
+        }
+        pos_ = std::min(pos_, source_.size());
+        const std::string_view text = source_.substr(start, pos_ - start);
+        
+        // "2>file": a descriptor number glued to a redirection
+        if (pos_ < source_.size() && (source_[pos_] == '<' || source_[pos_] == '>') && flags == 0 &&
+            text.size() <= 4 && std::all_of(text.begin(), text.end(), [](char d) { return d >= '0' && d <= '9'; })) {
+            int32_t fd = 0;
+            std::from_chars(text.data(), text.data() + text.size(), fd);
+            parse_redirect(nullptr, fd);
+            return;
+        }
+        
+        Command& command = commands_.back();
+        if (redirect_target_) {
+            redirect_target_ = false;
+            redirects_.back().target = {static_cast<uint32_t>(start), static_cast<uint32_t>(text.size()), flags};
+            if (heredoc_pending_) {
+                heredocs_.push_back({text, heredoc_strip_});
+                heredoc_pending_ = false;
+            }
+            return;
+        }
+        
+        // Reserved words are structure, not commands
+        if (command.word_count == 0 && flags == 0 && text.size() <= 8) {
+            if (word_in_list(text, "if|then|else|elif|do|while|until|{|!|time|function")) {
+                return;
+            }
+            if (word_in_list(text, "fi|done|esac|}")) {
+                end_command(Connector::Sequence);
+                return;
+            }
+        }
+        words_.push_back({static_cast<uint32_t>(start), static_cast<uint32_t>(text.size()), flags});
+        command.word_count++;
+    }
+    
+    void skip_double_quoted() {
+        for (pos_++; pos_ < source_.size() && source_[pos_] != '"';) {
+            if (source_[pos_] == '\\') {
+                pos_ += 2;
+            } else if (source_[pos_] == '$' || source_[pos_] == '`') {
+                skip_expansion();
+            } else {
+                pos_++;
+            }
+        }
+        pos_ = std::min(pos_ + 1, source_.size());
+    }
+    
+    /**
+     * Skip $var, ${...}, $((...)), $(...) or `...` at pos_, recording
+     * command substitutions
+     */
+    void skip_expansion() {
+        if (source_[pos_] == '`') {
+            const size_t start = ++pos_;
+            while (pos_ < source_.size() && source_[pos_] != '`') {
+                pos_ += source_[pos_] == '\\' ? 2 : 1;
+            }
+            pos_ = std::min(pos_, source_.size());
+            substitutions_.push_back({static_cast<uint32_t>(start), static_cast<uint32_t>(pos_ - start)});
+            pos_ = std::min(pos_ + 1, source_.size());
+            return;
+        }
+        pos_++;
+        if (pos_ >= source_.size()) {
+            return;
+        }
+        if (source_[pos_] == '\'') {
+            // $'...' allows \' inside
+            for (pos_++; pos_ < source_.size() && source_[pos_] != '\'';) {
+                pos_ += source_[pos_] == '\\' ? 2 : 1;
+            }
+            pos_ = std::min(pos_ + 1, source_.size());
+        } else if (source_[pos_] == '{') {
+            skip_balanced('{', '}');
+        } else if (source_[pos_] == '(') {
+            const bool arithmetic = pos_ + 1 < source_.size() && source_[pos_ + 1] == '(';
+            const size_t start = pos_ + 1;
+            skip_balanced('(', ')');
+            if (!arithmetic && pos_ > start) {
+                substitutions_.push_back({static_cast<uint32_t>(start), static_cast<uint32_t>(pos_ - 1 - start)});
+            }
+        }
+    }
+    
+    /**
+     * Skip from an opening bracket at pos_ past its match, minding quotes
+     */
+    void skip_balanced(char open, char close) {
+        int depth = 0;
+        while (pos_ < source_.size()) {
+            const char c = source_[pos_];
+            if (c == '\\') {
+                pos_ += 2;
+                continue;
+            }
+            if (c == '\'') {
+                pos_ = std::min(source_.find('\'', pos_ + 1), source_.size() - 1) + 1;
+                continue;
+            }
+            if (c == '"') {
+                skip_double_quoted();
+                continue;
+            }
+            pos_++;
+            if (c == open) {
+                depth++;
+            } else if (c == close && --depth == 0) {
+                return;
+            }
+        }
+        pos_ = source_.size();
+    }
+    
+    /**
+     * Skip the bodies of heredocs opened on the line that just ended
+     */
+    void skip_heredocs() {
+        for (const auto& heredoc : heredocs_) {
+            // The delimiter may be quoted to disable expansion; the terminator is not
+            std::string_view delimiter = heredoc.delimiter;
+            if (delimiter.size() >= 2 && (delimiter.front() == '\'' || delimiter.front() == '"')) {
+                delimiter = delimiter.substr(1, delimiter.size() - 2);
+            }
+            while (pos_ < source_.size()) {
+                const size_t end = std::min(source_.find('\n', pos_), source_.size());
+                std::string_view line = source_.substr(pos_, end - pos_);
+                pos_ = std::min(end + 1, source_.size());
+                if (heredoc.strip_tabs) {
+                    line.remove_prefix(std::min(line.find_first_not_of('\t'), line.size()));
+                }
+                if (line == delimiter) {
+                    break;
+                }
+            }
+        }
+        heredocs_.clear();
+    }
+    
+    /**
+     * Append the value of a $'...' body starting at `i`; returns the index
+     * of the closing quote
+     */
+    static size_t unquote_ansi(std::string_view text, size_t i, std::string& out) {
+        for (; i < text.size() && text[i] != '\''; i++) {
+            if (text[i] != '\\' || i + 1 >= text.size()) {
+                out += text[i];
+                continue;
+            }
+            switch (text[++i]) {
+            case 'n': out += '\n'; break;
+            case 't': out += '\t'; break;
+            case 'r': out += '\r'; break;
+            case '0': out += '\0'; break;
+            default: out += text[i]; break;
+            }
+        }
+        return i;
+    }
+    
+    std::string_view source_;
+    size_t pos_ = 0;
+    std::vector<Word> words_;
+    std::vector<Redirect> redirects_;
+    std::vector<Command> commands_;
+    std::vector<Span> substitutions_;
+    std::vector<Heredoc> heredocs_;
+    bool redirect_target_ = false;
+    bool heredoc_pending_ = false;
+    bool heredoc_strip_ = false;
+};
+
+
+/**
+ * Handle other dangerous commands
+ */
+void handle_dangerous_command(const std::string& cmd, const std::vector<std::string>& args) {
+    print_header("POTENTIALLY DANGEROUS COMMAND");
+    
+    std::cout << Color::BOLD << "Command: " << Color::MAGENTA << cmd;
+    for (const auto& arg : args) {
+        std::cout << " " << arg;
+    }
+    std::cout << Color::RESET << "\n\n";
+    
+    print_warning("This command may have significant system impact!");
+    std::cout << "\n" << Color::YELLOW 
+              << "Please review the command carefully before execution.\n" 
+              << Color::RESET;
+}
+
+/**
+ * Display help information
+ */
+void show_help() {
+    print_header("Command Advisor - Help");
+    
+    std::cout << Color::BOLD << "DESCRIPTION:\n" << Color::RESET;
+    std::cout << "  A safety tool that analyzes potentially dangerous system commands\n";
+    std::cout << "  and provides detailed warnings and impact analysis.\n\n";
+    
+    std::cout << Color::BOLD << "USAGE:\n" << Color::RESET;
+    std::cout << "  advisor [options] <command> [arguments...]\n\n";
+    
+    std::cout << Color::BOLD << "OPTIONS:\n" << Color::RESET;
+    std::cout << "  " << Color::CYAN << "--traversal=MODE" << Color::RESET 
+              << "    - Directory walk order: auto, readdir or inode\n";
+    std::cout << "                        (inode sorts by inode number; best on HDDs)\n";
+    std::cout << "  " << Color::CYAN << "--jobs=N" << Color::RESET 
+              << "            - Number of scanner threads (default: automatic)\n";
+    std::cout << "  " << Color::CYAN << "--governor" << Color::RESET 
+              << "          - Idle I/O priority, nice 19, back off under PSI pressure\n";
+    std::cout << "  " << Color::CYAN << "--max-iops=N" << Color::RESET 
+              << "        - Cap filesystem calls per second\n";
+    std::cout << "  " << Color::CYAN << "--max-cpu=PCT" << Color::RESET 
+              << "       - Cap scanner CPU use (percent of one core)\n";
+    std::cout << "  " << Color::CYAN << "--max-memory=SIZE" << Color::RESET 
+              << "   - Bound scanner memory (e.g. 256M); spills to disk\n";
+    std::cout << "  " << Color::CYAN << "--history=FILE" << Color::RESET 
+              << "      - Scan history used to start big subtrees first\n";
+    std::cout << "                        (default: ~/.cache/advisor/history.tsv)\n";
+    std::cout << "  " << Color::CYAN << "--no-history" << Color::RESET 
+              << "        - Neither read nor record scan history\n";
+    std::cout << "  " << Color::CYAN << "--checkpoint=FILE" << Color::RESET 
+              << "   - Save scan progress to FILE every few seconds\n";
+    std::cout << "  " << Color::CYAN << "--checkpoint-interval=S" << Color::RESET 
+              << " - Seconds between checkpoints (default: 5)\n";
+    std::cout << "  " << Color::CYAN << "--resume=FILE" << Color::RESET 
+              << "       - Continue an interrupted scan from FILE\n";
+    std::cout << "  " << Color::CYAN << "--record=FILE" << Color::RESET 
+              << "       - Save every listing and stat result the scan sees\n";
+    std::cout << "  " << Color::CYAN << "--replay=FILE" << Color::RESET 
+              << "       - Scan a recording instead of the filesystem\n";
+    std::cout << "  " << Color::CYAN << "--replay-latency=DUR" << Color::RESET 
+              << " - Delay each replayed call (e.g. 2ms)\n";
+    std::cout << "  " << Color::CYAN << "--command=STRING" << Color::RESET 
+              << "    - Analyze a shell command line (pipes, &&, sh -c, $(...))\n";
+    std::cout << "  " << Color::CYAN << "--protect=FILE" << Color::RESET 
+              << "      - Protected-path rules for rm -rf; critical ones exit 4\n";
+    std::cout << "                        (default: ~/.config/advisor/protect.conf or built-in)\n";
+    std::cout << "  " << Color::CYAN << "--no-protect" << Color::RESET 
+              << "        - Do not check rm -rf targets against protected paths\n";
+    std::cout << "  " << Color::CYAN << "--block-over=SIZE" << Color::RESET 
+              << "   - Stop and exit 3 once an rm -rf target exceeds SIZE\n";
+    std::cout << "  " << Color::CYAN << "--block-over-files=N" << Color::RESET 
+              << " - Stop and exit 3 once it holds more than N files\n";
+    std::cout << "  " << Color::CYAN << "--confirm" << Color::RESET 
+              << "           - Ask before rm -rf; exit 2 unless confirmed\n";
+    std::cout << "  " << Color::CYAN << "--serve-stdio" << Color::RESET 
+              << "       - Answer NDJSON requests on stdin (CI service mode)\n";
+    std::cout << "  " << Color::CYAN << "--format=FMT" << Color::RESET 
+              << "        - Output as text (default), json or ndjson\n";
+    std::cout << "  " << Color::CYAN << "--stats" << Color::RESET 
+              << "             - Show phase timings, syscalls and thread activity\n";
+    std::cout << "  " << Color::CYAN << "--trace=FILE" << Color::RESET 
+              << "        - Write a Chrome/Perfetto timeline of the scan\n";
+    std::cout << "  " << Color::CYAN << "--trace-threshold=DUR" << Color::RESET 
+              << " - Shortest span traced (default: 100us)\n\n";
+    
+    std::cout << Color::BOLD << "SUPPORTED COMMANDS:\n" << Color::RESET;
+    std::cout << "  " << Color::CYAN << "reboot" << Color::RESET 
+              << "              - Analyze system reboot impact\n";
+    std::cout << "  " << Color::CYAN << "shutdown" << Color::RESET 
+              << "            - Analyze system shutdown impact\n";
+    std::cout << "  " << Color::CYAN << "rm -rf <path>" << Color::RESET 
+              << "       - Analyze recursive deletion impact\n";
+    std::cout << "  " << Color::CYAN << "find ... -delete" << Color::RESET 
+              << "    - Analyze what a find -delete or -exec rm removes\n";
+    std::cout << "  " << Color::CYAN << "bench [options]" << Color::RESET 
+              << "     - Benchmark the scanner on a generated tree\n";
+    std::cout << "                        (--depth, --fanout, --files, --sizes, --extensions,\n";
+    std::cout << "                         --seed, --threads, --runs, --backend, --latency,\n";
+    std::cout << "                         --dir, --json, --keep)\n";
+    std::cout << "  " << Color::CYAN << "audit FILE..." << Color::RESET 
+              << "       - Find dangerous commands in scripts, history, CI YAML\n";
+    std::cout << "  " << Color::CYAN << "help, --help, -h" << Color::RESET 
+              << "  - Show this help message\n\n";
+    
+    std::cout << Color::BOLD << "EXAMPLES:\n" << Color::RESET;
+    std::cout << "  advisor reboot\n";
+    std::cout << "  advisor shutdown\n";
+    std::cout << "  advisor rm -rf /tmp/old_data\n";
+    std::cout << "  advisor find /var/log -name '*.gz' -mtime +30 -delete\n";
+    std::cout << "  advisor audit deploy/*.sh .gitlab-ci.yml ~/.bash_history\n";
+    std::cout << "  advisor bench --threads=1,4 --json=bench.json\n\n";
+    
+    std::cout << Color::BOLD << "EXIT STATUS:\n" << Color::RESET;
+    std::cout << "  0  analysis shown, or nothing to say\n";
+    std::cout << "  1  usage error or invalid option\n";
+    std::cout << "  2  --confirm was not answered yes\n";
+    std::cout << "  3  blocked by --block-over or --block-over-files\n";
+    std::cout << "  4  blocked by a critical protected path\n\n";
+    
+    std::cout << Color::BOLD << "NOTE:\n" << Color::RESET;
+    std::cout << "  This tool only provides analysis and warnings.\n";
+    std::cout << "  It does NOT execute the actual commands.\n\n";
+}
+
+/**
+ * Match a long option in either "--name=value" or "--name value" form.
+ *
+ * Advances `index` past a separate value argument when one is consumed.
+ */
+bool take_option(const std::string& arg, const std::string& name, int& index, int argc,
+                 char* argv[], std::string& value) {
+    if (arg == name) {
+        if (index + 1 >= argc) {
+            throw std::runtime_error("Missing value for " + name);
+        }
+        value = argv[++index];
+        return true;
+    }
+    if (arg.size() > name.size() && arg.compare(0, name.size(), name) == 0 && arg[name.size()] == '=') {
+        value = arg.substr(name.size() + 1);
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Parse a non-negative integer option value
+ */
+unsigned parse_unsigned(const std::string& value, const std::string& name) {
+    if (value.empty() || value.find_first_not_of("0123456789") != std::string::npos || value.size() > 9) {
+        throw std::runtime_error("Invalid value for " + name + ": " + value);
+    }
+    return static_cast<unsigned>(std::stoul(value));
+}
+
+/**
+ * Parse a byte size such as "4096", "512K", "256M", "10G" or "1TiB"
+ */
+uint64_t parse_size(const std::string& value, const std::string& name) {
+    size_t digits = 0;
+    while (digits < value.size() && std::isdigit(static_cast<unsigned char>(value[digits]))) {
+        digits++;
+    }
+    std::string suffix = value.substr(digits);
+    for (auto& c : suffix) {
+        c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+    }
+    if (suffix.size() > 1 && suffix.back() == 'B') {
+        suffix.pop_back();
+    }
+    if (suffix.size() > 1 && suffix.back() == 'I') {
+        suffix.pop_back();
+    }
+    
+    static const std::string UNITS = "BKMGT";
+    const size_t unit = suffix.empty() ? 0 : suffix.size() == 1 ? UNITS.find(suffix[0]) : std::string::npos;
+    if (digits == 0 || digits > 15 || unit == std::string::npos) {
+        throw std::runtime_error("Invalid size for " + name + ": " + value);
+    }
+    const uint64_t number = std::stoull(value.substr(0, digits));
+    if (number > UINT64_MAX >> (10 * unit)) {
+        throw std::runtime_error("Size for " + name + " is too large: " + value);
+    }
+    return number << (10 * unit);
+}
+
+/**
+ * Parse a duration such as "0", "250us", "2ms" or "1s"
+ */
+std::chrono::microseconds parse_duration(const std::string& value, const std::string& name) {
+    size_t digits = 0;
+    while (digits < value.size() && std::isdigit(static_cast<unsigned char>(value[digits]))) {
+        digits++;
+    }
+    const std::string unit = value.substr(digits);
+    if (digits == 0 || digits > 9 || (unit.empty() && value != "0")) {
+        throw std::runtime_error("Invalid duration for " + name + ": " + value + " (e.g. 500us, 2ms, 1s)");
+    }
+    const uint64_t count = std::stoull(value.substr(0, digits));
+    if (unit == "us" || unit.empty()) {
+        return std::chrono::microseconds(count);
+    }
+    if (unit == "ms") {
+        return std::chrono::milliseconds(count);
+    }
+    if (unit == "s") {
+        return std::chrono::seconds(count);
+    }
+    throw std::runtime_error("Invalid duration for " + name + ": " + value + " (e.g. 500us, 2ms, 1s)");
+}
+
+/**
+ * Shape of the synthetic tree generated by `advisor bench`
+ */
+struct BenchTreeSpec {
+    unsigned depth = 3;    // directory levels below the root
+    unsigned fanout = 10;  // subdirectories per directory
+    unsigned files = 50;   // files per directory
+    std::string sizes = "lognormal:4K";
+    std::vector<std::pair<std::string, unsigned>> extensions = {
+        {"c", 25}, {"h", 15}, {"txt", 15}, {"log", 10}, {"json", 10}, {"png", 10}, {"so", 5}, {"", 10}};
+    uint64_t seed = 42;
+};
+
+/**
+ * Settings for `advisor bench`
+ */
+struct BenchOptions {
+    BenchTreeSpec tree;
+    bool in_memory = false;                 // scan a MemoryFs instead of files on disk
+    std::chrono::microseconds latency{0};   // per call, in-memory backend only
+    std::string dir;  // parent of the generated tree, "" = /dev/shm or $TMPDIR
+    std::vector<unsigned> threads = {1, 2, 4, 8};
+    unsigned runs = 3;
+    std::string json_file;  // "-" = stdout
+    bool keep = false;
+};
+
+/**
+ * Best of `runs` scans for one traversal / cache / thread-count combination
+ */
+struct BenchResult {
+    std::string traversal;
+    std::string cache;
+    unsigned threads;
+    uint64_t entries;
+    double seconds;
+    SyscallCounts syscalls;
+    uint64_t allocations;
+    uint64_t peak_rss;
+};
+
+/**
+ * File size sampler: "empty", "fixed:SIZE", "uniform:MAX" or "lognormal:MEDIAN"
+ */
+class SizeDistribution {
+public:
+    explicit SizeDistribution(const std::string& spec) {
+        const size_t colon = spec.find(':');
+        kind_ = spec.substr(0, colon);
+        if (kind_ == "empty" && colon == std::string::npos) {
+            return;
+        }
+        if ((kind_ != "fixed" && kind_ != "uniform" && kind_ != "lognormal") || colon == std::string::npos) {
+            throw std::runtime_error("Invalid size distribution: " + spec +
+                                     " (expected empty, fixed:SIZE, uniform:MAX or lognormal:MEDIAN)");
+        }
+        value_ = parse_size(spec.substr(colon + 1), "--sizes");
+    }
+    
+    uint64_t operator()(std::mt19937_64& rng) const {
+        if (kind_ == "fixed") {
+            return value_;
+        }
+        if (kind_ == "uniform") {
+            return std::uniform_int_distribution<uint64_t>(0, value_)(rng);
+        }
+        if (kind_ == "lognormal") {
+            // A wide spread gives the long tail of real trees; capped at 1 TiB
+            std::lognormal_distribution<double> dist(std::log(std::max<double>(1.0, static_cast<double>(value_))), 2.0);
+            return static_cast<uint64_t>(std::min(dist(rng), 1099511627776.0));
+        }
+        return 0;
+    }
+    
+private:
+    std::string kind_;
+    uint64_t value_ = 0;
+};
+
+/**
+ * Parse "c:30,h:20,none:10" into (extension, weight) pairs; "none" means
+ * files without an extension
+ */
+std::vector<std::pair<std::string, unsigned>> parse_extension_mix(const std::string& value) {
+    std::vector<std::pair<std::string, unsigned>> mix;
+    std::istringstream in(value);
+    std::string item;
+    while (std::getline(in, item, ',')) {
+        const size_t colon = item.find(':');
+        std::string ext = item.substr(0, colon);
+        const unsigned weight = colon == std::string::npos ? 1 : parse_unsigned(item.substr(colon + 1), "--extensions");
+        if (ext.empty() || ext.find('/') != std::string::npos) {
+            throw std::runtime_error("Invalid value for --extensions: " + value);
+        }
+        mix.emplace_back(ext == "none" ? "" : ext, weight);
+    }
+    if (mix.empty()) {
+        throw std::runtime_error("Invalid value for --extensions: " + value);
+    }
+    return mix;
+}
+
+/**
+ * Parse a comma-separated list of thread counts
+ */
+std::vector<unsigned> parse_thread_list(const std::string& value) {
+    std::vector<unsigned> threads;
+    std::istringstream in(value);
+    std::string item;
+    while (std::getline(in, item, ',')) {
+        const unsigned count = parse_unsigned(item, "--threads");
+        if (count == 0) {
+            throw std::runtime_error("Invalid value for --threads: " + value);
+        }
+        threads.push_back(count);
+    }
+    if (threads.empty()) {
+        throw std::runtime_error("Invalid value for --threads: " + value);
+    }
+    return threads;
+}
+
+/**
+ * Build the synthetic tree rooted at `root` in memory. The same spec and
+ * seed always produce the same tree.
+ */
+std::unique_ptr<MemoryFs> generate_bench_tree(const std::string& root, const BenchTreeSpec& spec) {
+    std::mt19937_64 rng(spec.seed);
+    const SizeDistribution sizes(spec.sizes);
+    std::vector<unsigned> weights;
+    for (const auto& [ext, weight] : spec.extensions) {
+        weights.push_back(weight);
+    }
+    std::discrete_distribution<size_t> pick_extension(weights.begin(), weights.end());
+    
+    auto tree = std::make_unique<MemoryFs>();
+    uint64_t inode = 1;
+    std::vector<std::pair<std::string, unsigned>> pending = {{root, 0}};
+    while (!pending.empty()) {
+        const auto [dir, level] = pending.back();
+        pending.pop_back();
+        tree->add_directory(dir);
+        
+        std::string name;
+        for (unsigned i = 0; i < spec.files; i++) {
+            const std::string& ext = spec.extensions[pick_extension(rng)].first;
+            name = "f" + std::to_string(i) + (ext.empty() ? "" : "." + ext);
+            tree->add_entry(name, ++inode, DT_REG, MemoryFs::STAT_OK, DT_REG, sizes(rng));
+        }
+        if (level < spec.depth) {
+            for (unsigned i = 0; i < spec.fanout; i++) {
+                name = "d" + std::to_string(i);
+                tree->add_entry(name, ++inode, DT_DIR, MemoryFs::STAT_OK, DT_DIR);
+                pending.emplace_back(dir + "/" + name, level + 1);
+            }
+        }
+    }
+    return tree;
+}
+
+/**
+ * Ask the kernel to drop clean page, dentry and inode caches (needs root)
+ */
+bool drop_caches() {
+    ::sync();
+    const int fd = ::open("/proc/sys/vm/drop_caches", O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    const bool ok = ::write(fd, "3\n", 2) == 2;
+    ::close(fd);
+    return ok;
+}
+
+/**
+ * Restart peak RSS accounting so current_peak_rss() measures from here
+ */
+bool reset_peak_rss() {
+    const int fd = ::open("/proc/self/clear_refs", O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    const bool ok = ::write(fd, "5", 1) == 1;
+    ::close(fd);
+    return ok;
+}
+
+/**
+ * Peak RSS since the last reset_peak_rss(), in bytes
+ */
+uint64_t current_peak_rss() {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 6, "VmHWM:") == 0) {
+            return std::strtoull(line.c_str() + 6, nullptr, 10) * 1024;
+        }
+    }
+    return peak_rss_bytes();
+}
+
+/**
+ * Write benchmark results as JSON, for regression tracking
+ */
+void write_bench_json(JsonWriter& json, const BenchOptions& options, const std::string& root,
+                      uint64_t entries, const std::vector<BenchResult>& results) {
+    const BenchTreeSpec& tree = options.tree;
+    json.begin_object().key("schema").value(uint64_t{1});
+    json.key("backend").value(options.in_memory ? "memory" : "disk");
+    json.key("latency_us").value(static_cast<uint64_t>(options.latency.count()));
+    json.key("tree").begin_object().key("path").value(root);
+    json.key("depth").value(static_cast<uint64_t>(tree.depth)).key("fanout").value(static_cast<uint64_t>(tree.fanout));
+    json.key("files").value(static_cast<uint64_t>(tree.files)).key("sizes").value(tree.sizes);
+    json.key("seed").value(static_cast<uint64_t>(tree.seed)).key("entries").value(entries).end_object();
+    json.key("runs").value(static_cast<uint64_t>(options.runs));
+    json.key("stats").value(ADVISOR_STATS != 0);
+    json.key("results").begin_array();
+    for (const BenchResult& r : results) {
+        const double per_entry = r.entries > 0 ? 1.0 / static_cast<double>(r.entries) : 0.0;
+        json.begin_object().key("traversal").value(r.traversal).key("cache").value(r.cache);
+        json.key("threads").value(static_cast<uint64_t>(r.threads)).key("entries").value(r.entries);
+        json.key("seconds").value(r.seconds, 6);
+        json.key("entries_per_second").value(static_cast<double>(r.entries) / r.seconds, 6);
+        json.key("syscalls").begin_object().key("open").value(r.syscalls.open).key("getdents").value(r.syscalls.getdents);
+        json.key("stat").value(r.syscalls.stat).key("close").value(r.syscalls.close).end_object();
+        json.key("syscalls_per_entry").value(static_cast<double>(r.syscalls.total()) * per_entry, 6);
+        json.key("allocations_per_entry").value(static_cast<double>(r.allocations) * per_entry, 6);
+        json.key("peak_rss_bytes").value(r.peak_rss).end_object();
+    }
+    json.end_array().end_object().end_record();
+}
+
+/**
+ * Print benchmark results as a table, with speed-up relative to the first
+ * thread count of the same traversal and cache state
+ */
+void print_bench_table(const std::vector<BenchResult>& results) {
+    std::cout << "\n" << Color::BOLD
+              << std::left << std::setw(10) << "Traversal" << std::setw(7) << "Cache"
+              << std::right << std::setw(8) << "Threads" << std::setw(13) << "Entries/s"
+              << std::setw(15) << "Syscalls/entry" << std::setw(13) << "Allocs/entry"
+              << std::setw(12) << "Peak RSS" << std::setw(9) << "Speedup" << Color::RESET << "\n";
+    print_separator();
+    
+    const BenchResult* baseline = nullptr;
+    for (const auto& r : results) {
+        if (baseline == nullptr || baseline->traversal != r.traversal || baseline->cache != r.cache) {
+            baseline = &r;
+        }
+        const double per_entry = r.entries > 0 ? 1.0 / static_cast<double>(r.entries) : 0.0;
+        std::cout << std::left << std::setw(10) << r.traversal << std::setw(7) << r.cache
+                  << std::right << std::setw(8) << r.threads
+                  << std::setw(13) << static_cast<uint64_t>(static_cast<double>(r.entries) / r.seconds)
+                  << std::fixed << std::setprecision(3)
+                  << std::setw(15) << static_cast<double>(r.syscalls.total()) * per_entry
+                  << std::setw(13) << static_cast<double>(r.allocations) * per_entry
+                  << std::setw(12) << format_bytes(r.peak_rss)
+                  << std::setprecision(2) << std::setw(8) << baseline->seconds / r.seconds << "x\n";
+    }
+    std::cout << std::defaultfloat;
+}
+
+/**
+ * `advisor bench startup`: exec advisor on benign commands, as a shell
+ * preexec hook would, and fail unless the p99 exec-to-exit time is below
+ * the limit. The 1 ms default holds for static builds; a dynamically
+ * linked binary pays for the loader and gets 5 ms.
+ */
+void handle_startup_bench(const std::vector<std::string>& args) {
+    unsigned runs = 1000;
+    std::chrono::microseconds max_p99{ADVISOR_STATIC ? 1000 : 5000};
+    std::vector<char*> argv;
+    for (const auto& arg : args) {
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    }
+    const int argc = static_cast<int>(argv.size());
+    for (int index = 0; index < argc; index++) {
+        const std::string arg = argv[index];
+        std::string value;
+        if (take_option(arg, "--runs", index, argc, argv.data(), value)) {
+            runs = std::max(1u, parse_unsigned(value, "--runs"));
+        } else if (take_option(arg, "--max-p99", index, argc, argv.data(), value)) {
+            max_p99 = parse_duration(value, "--max-p99");
+        } else {
+            throw std::runtime_error("Unknown startup bench option: " + arg);
+        }
+    }
+    
+    // Typical interactive command lines; none of them needs advice
+    static const char* const commands[][4] = {
+        {"advisor", "ls", "-la", nullptr},
+        {"advisor", "git", "status", nullptr},
+        {"advisor", "cd", "/tmp", nullptr},
+        {"advisor", "make", "-j8", nullptr},
+    };
+    const std::string self = fs::read_symlink("/proc/self/exe").string();
+    posix_spawn_file_actions_t actions;
+    ::posix_spawn_file_actions_init(&actions);
+    ::posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    
+    auto run_once = [&](const char* const* command) {
+        pid_t pid = 0;
+        const auto start = std::chrono::steady_clock::now();
+        if (::posix_spawn(&pid, self.c_str(), &actions, nullptr, const_cast<char* const*>(command), environ) != 0) {
+            throw std::runtime_error("Cannot run " + self + ": " + std::strerror(errno));
+        }
+        int status = 0;
+        ::waitpid(pid, &status, 0);
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            throw std::runtime_error(std::string("advisor ") + command[1] + " did not exit 0");
+        }
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    };
+    
+    print_header("STARTUP BENCHMARK");
+    print_info("Binary", self);
+    print_info("Runs", std::to_string(runs));
+    flush_if_interactive();
+    
+    std::vector<int64_t> samples;
+    samples.reserve(runs);
+    for (unsigned run = 0; run < runs / 10 + 1; run++) {
+        run_once(commands[run % std::size(commands)]);  // warm the page cache and loader
+    }
+    for (unsigned run = 0; run < runs; run++) {
+        samples.push_back(run_once(commands[run % std::size(commands)]));
+    }
+    ::posix_spawn_file_actions_destroy(&actions);
+    std::sort(samples.begin(), samples.end());
+    
+    auto percentile = [&](double p) {
+        const auto rank = static_cast<size_t>(p * static_cast<double>(samples.size() - 1) + 0.5);
+        return format_duration(static_cast<double>(samples[rank]) / 1e9);
+    };
+    print_info("p50", percentile(0.50));
+    print_info("p90", percentile(0.90));
+    print_info("p99", percentile(0.99));
+    print_info("Max", percentile(1.0));
+    
+    const auto p99 = samples[static_cast<size_t>(0.99 * static_cast<double>(samples.size() - 1) + 0.5)];
+    if (p99 >= std::chrono::duration_cast<std::chrono::nanoseconds>(max_p99).count()) {
+        throw std::runtime_error("p99 startup time " + percentile(0.99) + " exceeds " +
+                                 format_duration(static_cast<double>(max_p99.count()) / 1e6));
+    }
+    std::cout << "\n" << Color::GREEN << "✓ p99 below " << format_duration(static_cast<double>(max_p99.count()) / 1e6)
+              << "\n" << Color::RESET;
+}
+
+/**
+ * `advisor bench`: generate a synthetic tree and measure the scanner on it
+ */
+void handle_bench_command(const std::vector<std::string>& args, const AdvisorOptions& advisor_options) {
+    if (!args.empty() && args[0] == "startup") {
+        handle_startup_bench(std::vector<std::string>(args.begin() + 1, args.end()));
+        return;
+    }
+    
+    BenchOptions options;
+    std::vector<char*> argv;
+    for (const auto& arg : args) {
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    }
+    const int argc = static_cast<int>(argv.size());
+    for (int index = 0; index < argc; index++) {
+        const std::string arg = argv[index];
+        std::string value;
+        if (arg == "--keep") {
+            options.keep = true;
+        } else if (take_option(arg, "--backend", index, argc, argv.data(), value)) {
+            if (value != "disk" && value != "memory") {
+                throw std::runtime_error("Invalid value for --backend: " + value + " (expected disk or memory)");
+            }
+            options.in_memory = value == "memory";
+        } else if (take_option(arg, "--latency", index, argc, argv.data(), value)) {
+            options.latency = parse_duration(value, "--latency");
+        } else if (take_option(arg, "--depth", index, argc, argv.data(), value)) {
+            options.tree.depth = parse_unsigned(value, "--depth");
+        } else if (take_option(arg, "--fanout", index, argc, argv.data(), value)) {
+            options.tree.fanout = parse_unsigned(value, "--fanout");
+        } else if (take_option(arg, "--files", index, argc, argv.data(), value)) {
+            options.tree.files = parse_unsigned(value, "--files");
+        } else if (take_option(arg, "--sizes", index, argc, argv.data(), value)) {
+            SizeDistribution{value};  // reject a bad spec before creating anything
+            options.tree.sizes = value;
+        } else if (take_option(arg, "--extensions", index, argc, argv.data(), value)) {
+            options.tree.extensions = parse_extension_mix(value);
+        } else if (take_option(arg, "--seed", index, argc, argv.data(), value)) {
+            options.tree.seed = parse_unsigned(value, "--seed");
+        } else if (take_option(arg, "--threads", index, argc, argv.data(), value)) {
+            options.threads = parse_thread_list(value);
+        } else if (take_option(arg, "--runs", index, argc, argv.data(), value)) {
+            options.runs = std::max(1u, parse_unsigned(value, "--runs"));
+        } else if (take_option(arg, "--dir", index, argc, argv.data(), value)) {
+            options.dir = value;
+        } else if (take_option(arg, "--json", index, argc, argv.data(), value)) {
+            options.json_file = value;
+        } else {
+            throw std::runtime_error("Unknown bench option: " + arg);
+        }
+    }
+    
+    if (options.latency.count() > 0 && !options.in_memory) {
+        throw std::runtime_error("--latency requires --backend=memory");
+    }
+    
+    // Prefer tmpfs so generating the tree does not wear a disk
+    std::string root = "/advisor-bench";
+    if (!options.in_memory) {
+        std::string parent = options.dir;
+        if (parent.empty()) {
+            const char* tmp = std::getenv("TMPDIR");
+            parent = ::access("/dev/shm", W_OK) == 0 ? "/dev/shm" : tmp != nullptr && *tmp != '\0' ? tmp : "/tmp";
+        }
+        root = parent + "/advisor-bench-XXXXXX";
+        if (::mkdtemp(root.data()) == nullptr) {
+            throw std::runtime_error("Cannot create benchmark directory in " + parent + ": " + std::strerror(errno));
+        }
+    }
+    
+    print_header("SCAN BENCHMARK");
+    std::ostringstream shape;
+    shape << "depth " << options.tree.depth << ", fan-out " << options.tree.fanout << ", "
+          << options.tree.files << " files/dir, sizes " << options.tree.sizes << ", seed " << options.tree.seed;
+    print_info("Tree", options.in_memory ? root + " (in memory)" : root);
+    print_info("Shape", shape.str());
+    flush_if_interactive();
+    
+    try {
+        const auto generate_start = std::chrono::steady_clock::now();
+        std::unique_ptr<MemoryFs> tree = generate_bench_tree(root, options.tree);
+        const uint64_t entries = tree->size();
+        if (options.in_memory) {
+            tree->set_latency(options.latency);
+        } else {
+            tree->materialize();
+            tree.reset();
+        }
+        const double generate_seconds =
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - generate_start).count();
+        std::ostringstream generated;
+        generated << entries << " (generated in " << std::fixed << std::setprecision(2) << generate_seconds << "s)";
+        print_info("Entries", generated.str());
+        
+        // Cold runs need root, and tmpfs has no backing store to go cold against
+        std::vector<std::string> caches = {"warm"};
+        struct statfs fs_info{};
+        constexpr long TMPFS_MAGIC_NUMBER = 0x01021994;
+        const bool on_tmpfs = ::statfs(root.c_str(), &fs_info) == 0 && fs_info.f_type == TMPFS_MAGIC_NUMBER;
+        if (options.in_memory) {
+            print_info("Cold Cache", "skipped (in-memory backend)");
+        } else if (on_tmpfs) {
+            print_info("Cold Cache", "skipped (tree is on tmpfs; use --dir on a disk)");
+        } else if (!drop_caches()) {
+            print_info("Cold Cache", "skipped (dropping caches needs root)");
+        } else {
+            caches.push_back("cold");
+        }
+        if (!ADVISOR_STATS) {
+            print_info("Counters", "disabled at build time (ADVISOR_STATS=0)");
+        }
+        
+        ScanOptions scan = advisor_options.scan;
+        scan.history_file.clear();
+        scan.checkpoint_file.clear();
+        scan.resume_file.clear();
+        scan.record_file.clear();
+        scan.replay_file.clear();
+        scan.filesystem = tree.get();
+        
+        flush_if_interactive();
+        std::vector<BenchResult> results;
+        for (const TraversalPolicy traversal : {TraversalPolicy::Readdir, TraversalPolicy::InodeOrder}) {
+            scan.traversal = traversal;
+            const std::string name = traversal == TraversalPolicy::Readdir ? "readdir" : "inode";
+            for (const auto& cache : caches) {
+                if (cache == "warm") {
+                    // Prime the caches once; the measured runs follow
+                    analyze_folder(root, scan);
+                }
+                for (const unsigned threads : options.threads) {
+                    scan.jobs = threads;
+                    BenchResult best{name, cache, threads, 0, 0.0, {}, 0, 0};
+                    for (unsigned run = 0; run < options.runs; run++) {
+                        if (cache == "cold") {
+                            drop_caches();
+                        }
+                        reset_peak_rss();
+                        ScanStats stats;
+                        const auto start = std::chrono::steady_clock::now();
+                        const AnalysisResult result = analyze_folder(root, scan, &stats);
+                        const double seconds =
+                            std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                        if (run == 0 || seconds < best.seconds) {
+                            best.entries = result.total_files + result.total_directories;
+                            best.seconds = std::max(seconds, 1e-9);
+                            best.syscalls = stats.syscalls;
+                            best.allocations = stats.allocations;
+                            best.peak_rss = current_peak_rss();
+                        }
+                    }
+                    results.push_back(best);
+                }
+            }
+        }
+        
+        print_bench_table(results);
+        if (options.json_file == "-") {
+            JsonWriter json;
+            write_bench_json(json, options, root, entries, results);
+        } else if (!options.json_file.empty()) {
+            write_json_file(options.json_file, [&](JsonWriter& json) {
+                write_bench_json(json, options, root, entries, results);
+            });
+            print_info("JSON", options.json_file);
+        }
+    } catch (...) {
+        if (!options.keep && !options.in_memory) {
+            std::error_code ec;
+            fs::remove_all(root, ec);
+        }
+        throw;
+    }
+    
+    if (options.in_memory) {
+        return;
+    }
+    if (options.keep) {
+        print_info("Kept", root);
+    } else {
+        std::error_code ec;
+        fs::remove_all(root, ec);
+    }
+}
+
+/**
+ * Parse advisor options preceding the command.
+ *
+ * Returns the index of the first command argument in argv.
+ */
+int parse_advisor_options(int argc, char* argv[], AdvisorOptions& options) {
+    options.scan.history_file = ScanHistory::default_path();
+    std::string protect_file = ProtectionPolicy::default_path();
+    bool protect = true;
+    
+    int index = 1;
+    for (; index < argc; index++) {
+        const std::string arg = argv[index];
+        if (arg.size() < 3 || arg.compare(0, 2, "--") != 0 || arg == "--help") {
+            break;
+        }
+        
+        std::string value;
+        if (arg == "--governor") {
+            options.scan.governor.enabled = true;
+        } else if (arg == "--stats") {
+            options.stats = true;
+        } else if (arg == "--confirm") {
+            options.confirm = true;
+        } else if (arg == "--serve-stdio") {
+            options.serve_stdio = true;
+        } else if (arg == "--no-history") {
+            options.scan.history_file.clear();
+        } else if (arg == "--no-protect") {
+            protect = false;
+        } else if (take_option(arg, "--protect", index, argc, argv, value)) {
+            protect_file = value;
+        } else if (take_option(arg, "--block-over", index, argc, argv, value)) {
+            options.scan.stop_over_bytes = parse_size(value, "--block-over");
+        } else if (take_option(arg, "--block-over-files", index, argc, argv, value)) {
+            options.scan.stop_over_files = parse_unsigned(value, "--block-over-files");
+        } else if (take_option(arg, "--max-memory", index, argc, argv, value)) {
+            options.scan.max_memory = parse_size(value, "--max-memory");
+        } else if (take_option(arg, "--checkpoint", index, argc, argv, value)) {
+            options.scan.checkpoint_file = value;
+        } else if (take_option(arg, "--checkpoint-interval", index, argc, argv, value)) {
+            options.scan.checkpoint_interval = parse_unsigned(value, "--checkpoint-interval");
+        } else if (take_option(arg, "--resume", index, argc, argv, value)) {
+            options.scan.resume_file = value;
+        } else if (take_option(arg, "--record", index, argc, argv, value)) {
+            options.scan.record_file = value;
+        } else if (take_option(arg, "--replay", index, argc, argv, value)) {
+            options.scan.replay_file = value;
+        } else if (take_option(arg, "--command", index, argc, argv, value)) {
+            options.command_line = value;
+        } else if (take_option(arg, "--format", index, argc, argv, value)) {
+            options.format = parse_output_format(value);
+        } else if (take_option(arg, "--trace", index, argc, argv, value)) {
+            options.scan.trace_file = value;
+        } else if (take_option(arg, "--trace-threshold", index, argc, argv, value)) {
+            options.scan.trace_threshold = parse_duration(value, "--trace-threshold");
+        } else if (take_option(arg, "--replay-latency", index, argc, argv, value)) {
+            options.scan.replay_latency = parse_duration(value, "--replay-latency");
+        } else if (take_option(arg, "--history", index, argc, argv, value)) {
+            options.scan.history_file = value;
+        } else if (take_option(arg, "--traversal", index, argc, argv, value)) {
+            options.scan.traversal = parse_traversal_policy(value);
+        } else if (take_option(arg, "--jobs", index, argc, argv, value)) {
+            options.scan.jobs = parse_unsigned(value, "--jobs");
+        } else if (take_option(arg, "--max-iops", index, argc, argv, value)) {
+            options.scan.governor.max_iops = parse_unsigned(value, "--max-iops");
+        } else if (take_option(arg, "--max-cpu", index, argc, argv, value)) {
+            options.scan.governor.max_cpu_percent = parse_unsigned(value, "--max-cpu");
+        } else {
+            throw std::runtime_error("Unknown option: " + arg);
+        }
+    }
+    
+    if (protect) {
+        options.protection = std::make_shared<const ProtectionPolicy>(ProtectionPolicy::load(protect_file));
+        options.scan.protection = options.protection.get();
+    }
+    return index;
+}
+
+/**
+ * Index of the script a shell runs with -c (sh -c 'rm -rf x'), or
+ * `count` when the command is not a shell given a command string
+ */
+template <typename WordAt>
+size_t find_shell_script(size_t count, WordAt word_at) {
+    if (count == 0 || !word_in_list(word_at(0).substr(word_at(0).rfind('/') + 1), "sh|bash|dash|zsh|ksh|ash|busybox")) {
+        return count;
+    }
+    bool has_c = false;
+    for (size_t i = 1; i < count; i++) {
+        const std::string_view word = word_at(i);
+        if (word.size() >= 2 && word[0] == '-' && word[1] != '-') {
+            has_c = has_c || word.find('c') != std::string_view::npos;
+        } else if (word.substr(0, 2) != "--") {
+            return has_c ? i : count;
+        }
+    }
+    return count;
+}
+
+/**
+ * Route one command (args[0] is the command, wrappers already skipped)
+ * to its handler. `via_xargs` means more operands arrive at run time.
+ */
+Advice advise_command(int count, const char* const* args, const AdvisorOptions& options, bool via_xargs = false) {
+    const CommandMatch match = classify_command(count, args);
+    const std::string cmd = args[0];
+    switch (match.action) {
+    case CommandAction::Benign:
+        return Advice::Silent;
+        
+    case CommandAction::Power: {
+        const std::string verb(match.command);
+        if (options.format != OutputFormat::Text) {
+            report_command_json(cmd, std::vector<std::string>(args + 1, args + count),
+                                "This will " + verb + " your entire system!");
+        } else {
+            handle_system_command(verb);
+        }
+        return Advice::Given;
+    }
+        
+    case CommandAction::Remove:
+        return handle_remove_command(command_operands(count, args), options);
+        
+    case CommandAction::FindDelete:
+        return handle_find_command(count, args, options);
+        
+    case CommandAction::RemoveUsage:
+        if (!via_xargs) {
+            print_error("Missing path argument for 'rm -rf' command");
+            std::cout << "Usage: advisor rm -rf <path>\n";
+            return Advice::UsageError;
+        }
+        // The targets come from xargs' input, so there is nothing to scan
+        [[fallthrough]];
+        
+    case CommandAction::Warn: {
+        // Generic dangerous command handler
+        const std::vector<std::string> rest(args + 1, args + count);
+        if (options.format != OutputFormat::Text) {
+            report_command_json(cmd, rest, "This command may have significant system impact!");
+        } else {
+            handle_dangerous_command(cmd, rest);
+        }
+        return Advice::Given;
+    }
+    }
+    return Advice::Silent;
+}
+
+/**
+ * Call visit(count, args, via_xargs, anchor) for every simple command of
+ * a shell command line or script: each pipeline stage and list element,
+ * sh -c strings and command substitutions included. Wrappers are already
+ * skipped in `args`. `anchor` points at the command in the outermost
+ * source; commands of an sh -c string are anchored at that string.
+ */
+template <typename Visit>
+void visit_commands(std::string_view source, const Visit& visit, const char* anchor = nullptr, unsigned depth = 0) {
+    constexpr unsigned MAX_NESTING = 8;
+    // One set of buffers per nesting level, reused from call to call
+    struct Scratch {
+        ShellScript script;
+        std::vector<std::string> values;
+        std::vector<const char*> args;
+    };
+    thread_local Scratch scratch[MAX_NESTING + 1];
+    ShellScript& script = scratch[depth].script;
+    std::vector<std::string>& values = scratch[depth].values;
+    std::vector<const char*>& args = scratch[depth].args;
+    script.parse(source);
+    
+    for (const auto& command : script.commands()) {
+        if (command.word_count == 0) {
+            continue;
+        }
+        values.resize(command.word_count);
+        for (uint32_t i = 0; i < command.word_count; i++) {
+            script.unquote(script.words()[command.first_word + i], values[i]);
+        }
+        auto word_at = [&](size_t i) { return std::string_view(values[i]); };
+        bool via_xargs = false;
+        const size_t start = find_command_word(values.size(), word_at, via_xargs);
+        if (start == values.size()) {
+            continue;
+        }
+        const char* where = anchor != nullptr ? anchor : source.data() + script.words()[command.first_word].offset;
+        
+        const size_t inner = start + find_shell_script(values.size() - start, [&](size_t i) { return word_at(start + i); });
+        if (inner < values.size()) {
+            if (depth < MAX_NESTING) {
+                visit_commands(values[inner], visit, where, depth + 1);
+            }
+            continue;
+        }
+        
+        args.clear();
+        for (size_t i = start; i < values.size(); i++) {
+            args.push_back(values[i].c_str());
+        }
+        visit(static_cast<int>(args.size()), args.data(), via_xargs, where);
+    }
+    
+    if (depth < MAX_NESTING) {
+        for (const auto& substitution : script.substitutions()) {
+            visit_commands(script.text(substitution), visit, anchor, depth + 1);
+        }
+    }
+}
+
+/**
+ * visit_commands() for a command given as arguments: wrappers are looked
+ * through and sh -c strings are parsed
+ */
+template <typename Visit>
+void visit_argument_commands(size_t count, const char* const* args, const Visit& visit) {
+    auto word_at = [&](size_t i) { return std::string_view(args[i]); };
+    bool via_xargs = false;
+    const size_t start = find_command_word(count, word_at, via_xargs);
+    const size_t script = start + find_shell_script(count - start, [&](size_t i) { return word_at(start + i); });
+    if (script < count) {
+        visit_commands(args[script], visit, args[script]);
+    } else if (start < count) {
+        visit(static_cast<int>(count - start), args + start, via_xargs, args[start]);
+    }
+}
+
+/**
+ * Advise on every simple command of a shell command line or script
+ */
+Advice advise_shell(std::string_view source, const AdvisorOptions& options) {
+    Advice advice = Advice::Silent;
+    visit_commands(source, [&](int count, const char* const* args, bool via_xargs, const char*) {
+        advice = std::max(advice, advise_command(count, args, options, via_xargs));
+    });
+    return advice;
+}
+
+/**
+ * Read-only view of a whole file: mapped when it is a regular file,
+ * otherwise (pipes, process substitution) read into memory
+ */
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path) {
+        const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            throw std::runtime_error(std::strerror(errno));
+        }
+        struct stat info{};
+        if (::fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+            void* data = ::mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED) {
+                ::madvise(data, static_cast<size_t>(info.st_size), MADV_SEQUENTIAL);
+                mapped_ = static_cast<const char*>(data);
+                size_ = static_cast<size_t>(info.st_size);
+            }
+        }
+        if (mapped_ == nullptr) {
+            char buffer[65536];
+            ssize_t count = 0;
+            while ((count = ::read(fd, buffer, sizeof(buffer))) > 0 || (count < 0 && errno == EINTR)) {
+                buffer_.append(buffer, static_cast<size_t>(std::max<ssize_t>(count, 0)));
+            }
+        }
+        ::close(fd);
+    }
+    
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    
+    ~MappedFile() {
+        if (mapped_ != nullptr) {
+            ::munmap(const_cast<char*>(mapped_), size_);
+        }
+    }
+    
+    std::string_view view() const { return mapped_ != nullptr ? std::string_view(mapped_, size_) : buffer_; }
+    
+private:
+    const char* mapped_ = nullptr;
+    size_t size_ = 0;
+    std::string buffer_;
+};
+
+/**
+ * Finds where a command from the classification table appears as a whole
+ * word, so `advisor audit` only parses the lines around those places.
+ * With SSE2, 16 positions at a time are compared against the first two
+ * bytes of every command name; the rare hits are checked in full.
+ */
+class CommandPrefilter {
+public:
+    CommandPrefilter() {
+        for (const auto& spec : CommandTable::COMMANDS) {
+            const auto first = static_cast<unsigned char>(spec.name[0]);
+            const auto second = static_cast<unsigned char>(spec.name[1]);
+            starts_[first] = true;
+            bool known = false;
+            for (size_t i = 0; i < pair_count_; i++) {
+                known = known || (pairs_[i][0] == first && pairs_[i][1] == second);
+            }
+            if (!known) {
+                pairs_[pair_count_][0] = first;
+                pairs_[pair_count_][1] = second;
+#if defined(__SSE2__)
+                first_[pair_count_] = _mm_set1_epi8(static_cast<char>(first));
+                second_[pair_count_] = _mm_set1_epi8(static_cast<char>(second));
+#endif
+                pair_count_++;
+            }
+        }
+    }
+    
+    /**
+     * Offset of the first command name at or after `from`, or text.size()
+     */
+    size_t find(std::string_view text, size_t from) const {
+        size_t i = from;
+#if defined(__SSE2__)
+        for (; i + 17 <= text.size(); i += 16) {
+            const __m128i here = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text.data() + i));
+            const __m128i next = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text.data() + i + 1));
+            __m128i hits = _mm_setzero_si128();
+            for (size_t pair = 0; pair < pair_count_; pair++) {
+                hits = _mm_or_si128(hits, _mm_and_si128(_mm_cmpeq_epi8(here, first_[pair]), _mm_cmpeq_epi8(next, second_[pair])));
+            }
+            for (auto mask = static_cast<unsigned>(_mm_movemask_epi8(hits)); mask != 0; mask &= mask - 1) {
+                const size_t at = i + static_cast<size_t>(__builtin_ctz(mask));
+                if (matches_at(text, at)) {
+                    return at;
+                }
+            }
+        }
+#endif
+        for (; i + 1 < text.size(); i++) {
+            if (starts_[static_cast<unsigned char>(text[i])] && matches_at(text, i)) {
+                return i;
+            }
+        }
+        return text.size();
+    }
+    
+private:
+    static bool is_name_byte(char c) {
+        return std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '-' || c == '.';
+    }
+    
+    static bool matches_at(std::string_view text, size_t at) {
+        if (at > 0 && is_name_byte(text[at - 1])) {
+            return false;
+        }
+        for (const auto& spec : CommandTable::COMMANDS) {
+            if (text.compare(at, spec.name.size(), spec.name) != 0) {
+                continue;
+            }
+            const size_t end = at + spec.name.size();
+            if (end == text.size() || !is_name_byte(text[end]) || (spec.name == "mkfs" && text[end] == '.')) {
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    static constexpr size_t MAX_PAIRS = std::size(CommandTable::COMMANDS);
+    bool starts_[256] = {};
+    unsigned char pairs_[MAX_PAIRS][2] = {};
+    size_t pair_count_ = 0;
+#if defined(__SSE2__)
+    __m128i first_[MAX_PAIRS];
+    __m128i second_[MAX_PAIRS];
+#endif
+};
+
+/**
+ * Call shell(code) for the shell code on each line of a CI YAML file:
+ * `run:`, `script:`, `before_script:` and `after_script:` values, given
+ * inline, as block scalars (| or >) or as lists. `code` views `text`.
+ */
+template <typename Shell>
+void for_each_yaml_shell_line(std::string_view text, const Shell& shell) {
+    enum class Context { None, Block, List };
+    Context context = Context::None;
+    size_t key_indent = 0;
+    
+    auto scalar = [](std::string_view value) {
+        if (value.size() >= 2 && (value.front() == '"' || value.front() == '\'') && value.back() == value.front()) {
+            return value.substr(1, value.size() - 2);
+        }
+        return value;
+    };
+    auto open_block = [&](std::string_view value, size_t indent) {
+        if (value.empty() || value[0] == '|' || value[0] == '>') {
+            context = value.empty() ? Context::List : Context::Block;
+            key_indent = indent;
+            return true;
+        }
+        return false;
+    };
+    
+    for (size_t begin = 0; begin < text.size();) {
+        const size_t end = std::min(text.find('\n', begin), text.size());
+        std::string_view line = text.substr(begin, end - begin);
+        begin = end + 1;
+        if (!line.empty() && line.back() == '\r') {
+            line.remove_suffix(1);
+        }
+        const size_t indent = std::min(line.find_first_not_of(' '), line.size());
+        std::string_view body = line.substr(indent);
+        if (body.empty()) {
+            continue;
+        }
+        if (context == Context::Block && indent > key_indent) {
+            shell(body);
+            continue;
+        }
+        if (context == Context::List && indent >= key_indent && body.substr(0, 2) == "- ") {
+            const std::string_view item = body.substr(std::min(body.find_first_not_of(' ', 2), body.size()));
+            if (item.empty() || item[0] == '|' || item[0] == '>') {
+                context = Context::Block;
+                key_indent = indent;
+            } else {
+                shell(scalar(item));
+            }
+            continue;
+        }
+        context = Context::None;
+        
+        // A key, possibly the first of a list item ("- run: make")
+        if (body.substr(0, 2) == "- ") {
+            body = body.substr(std::min(body.find_first_not_of(' ', 2), body.size()));
+        }
+        const size_t colon = body.find(':');
+        if (colon == std::string_view::npos || !word_in_list(body.substr(0, colon), "run|script|before_script|after_script")) {
+            continue;
+        }
+        std::string_view value = body.substr(colon + 1);
+        value.remove_prefix(std::min(value.find_first_not_of(' '), value.size()));
+        if (!open_block(value, indent)) {
+            shell(scalar(value));
+        }
+    }
+}
+
+/**
+ * Offset just past the heredoc bodies opened on the line that ends at
+ * `line_end`, or `line_end` when that line opens none
+ */
+size_t skip_heredoc_bodies(std::string_view text, size_t line_begin, size_t line_end) {
+    ShellScript opener;
+    opener.parse(text.substr(line_begin, line_end - line_begin));
+    size_t pos = std::min(line_end + 1, text.size());
+    std::string delimiter;
+    for (const auto& redirect : opener.redirects()) {
+        const std::string_view op = redirect.op;
+        if (op != "<<" && op != "<<-") {
+            continue;
+        }
+        opener.unquote(redirect.target, delimiter);
+        while (pos < text.size()) {
+            const size_t end = std::min(text.find('\n', pos), text.size());
+            std::string_view line = text.substr(pos, end - pos);
+            pos = std::min(end + 1, text.size());
+            if (op == "<<-") {
+                line.remove_prefix(std::min(line.find_first_not_of('\t'), line.size()));
+            }
+            if (line == delimiter) {
+                break;
+            }
+        }
+    }
+    return std::max(pos, line_end);
+}
+
+/**
+ * A dangerous command found by `advisor audit`
+ */
+struct AuditFinding {
+    size_t line;
+    CommandAction action;
+    std::string command;  // words after wrappers, joined by spaces
+};
+
+/**
+ * Everything `advisor audit` learned about one file
+ */
+struct AuditReport {
+    std::string path;
+    std::vector<AuditFinding> findings;
+    std::string error;       // why the file could not be read
+    uint64_t bytes = 0;
+    uint64_t candidates = 0;  // lines the prefilter sent to the parser
+};
+
+/**
+ * Short name of what a command would do, for audit findings
+ */
+const char* audit_category(CommandAction action) {
+    switch (action) {
+    case CommandAction::Remove:
+    case CommandAction::RemoveUsage:
+    case CommandAction::FindDelete:
+        return "delete";
+    case CommandAction::Power:
+        return "power";
+    case CommandAction::Warn:
+        return "dangerous";
+    case CommandAction::Benign:
+        break;
+    }
+    return "benign";
+}
+
+/**
+ * Audit one shell script, history file or CI YAML file
  */
-void print_info(const std::string& label, const std::string& value) {
-    std::cout << Color::BOLD << "  " << std::left << std::setw(20) << label << ": " 
-              << Color::RESET << value << "\n";
+void audit_file(const CommandPrefilter& prefilter, AuditReport& report) {
+    const MappedFile file(report.path);
+    const std::string_view text = file.view();
+    report.bytes = text.size();
+    
+    size_t counted = 0;   // newlines are counted up to here
+    size_t line = 1;
+    auto line_at = [&](size_t offset) {
+        line += static_cast<size_t>(std::count(text.data() + counted, text.data() + offset, '\n'));
+        counted = offset;
+        return line;
+    };
+    
+    std::string command;
+    auto audit = [&](std::string_view code) {
+        report.candidates++;
+        const size_t first_line = line_at(static_cast<size_t>(code.data() - text.data()));
+        visit_commands(code, [&](int count, const char* const* args, bool, const char* anchor) {
+            const CommandMatch match = classify_command(count, args);
+            if (match.action == CommandAction::Benign) {
+                return;
+            }
+            command.clear();
+            for (int i = 0; i < count; i++) {
+                command.append(i > 0 ? " " : "").append(args[i]);
+            }
+            const auto offset = static_cast<size_t>(anchor - text.data());
+            report.findings.push_back({first_line + static_cast<size_t>(std::count(code.data(), text.data() + offset, '\n')),
+                                       match.action, command});
+        });
+    };
+    
+    size_t next = prefilter.find(text, 0);
+    const std::string_view extension = fs::path(report.path).extension().native();
+    if (extension == ".yml" || extension == ".yaml") {
+        if (next < text.size()) {
+            for_each_yaml_shell_line(text, [&](std::string_view code) {
+                const auto begin = static_cast<size_t>(code.data() - text.data());
+                if (next < begin) {
+                    next = prefilter.find(text, begin);
+                }
+                if (next < begin + code.size()) {
+                    audit(code);
+                }
+            });
+        }
+        return;
+    }
+    
+    // Shell scripts and history files: parse whole lines, joining backslash
+    // continuations. Heredoc bodies are data, so candidates in them are skipped.
+    size_t heredoc = text.find("<<");
+    size_t body_begin = 0;
+    size_t body_end = 0;
+    while (next < text.size()) {
+        if (next >= body_begin && next < body_end) {
+            next = prefilter.find(text, body_end);
+            continue;
+        }
+        if (heredoc < next) {
+            const size_t newline = text.rfind('\n', heredoc);
+            const size_t line_begin = newline == std::string_view::npos ? 0 : newline + 1;
+            const size_t line_end = std::min(text.find('\n', heredoc), text.size());
+            body_begin = line_end + 1;
+            body_end = skip_heredoc_bodies(text, line_begin, line_end);
+            heredoc = text.find("<<", std::max(body_end, line_end));
+            continue;
+        }
+        
+        size_t begin = text.rfind('\n', next);
+        begin = begin == std::string_view::npos ? 0 : begin + 1;
+        while (begin >= 2 && text[begin - 2] == '\\') {
+            const size_t previous = text.rfind('\n', begin - 2);
+            begin = previous == std::string_view::npos ? 0 : previous + 1;
+        }
+        size_t end = next;
+        while ((end = std::min(text.find('\n', end), text.size())) < text.size() && end > 0 && text[end - 1] == '\\') {
+            end++;
+        }
+        audit(text.substr(begin, end - begin));
+        next = prefilter.find(text, end);
+    }
 }
 
 /**
- * Analyze a folder and return detailed statistics
+ * `advisor audit FILE...`: report dangerous commands in shell scripts,
+ * shell history and CI YAML, auditing files in parallel. Returns the exit
+ * status: 1 when anything was found or a file could not be read.
  */
-AnalysisResult analyze_folder(const std::string& path) {
-    AnalysisResult result;
-    
-    if (!fs::exists(path)) {
-        throw std::runtime_error("Path does not exist: " + path);
+int handle_audit_command(const std::vector<std::string>& paths, const AdvisorOptions& options) {
+    if (paths.empty()) {
+        print_error("No files to audit");
+        std::cout << "Usage: advisor audit FILE...\n";
+        return 1;
     }
     
-    if (!fs::is_directory(path)) {
-        throw std::runtime_error("Path is not a directory: " + path);
+    static const CommandPrefilter prefilter;
+    std::vector<AuditReport> reports(paths.size());
+    for (size_t i = 0; i < paths.size(); i++) {
+        reports[i].path = paths[i];
     }
     
-    try {
-        for (const auto& entry : fs::recursive_directory_iterator(
-            path, 
-            fs::directory_options::skip_permission_denied)) {
-            
+    const auto start = std::chrono::steady_clock::now();
+    std::atomic<size_t> next_file{0};
+    auto work = [&] {
+        for (size_t i; (i = next_file.fetch_add(1, std::memory_order_relaxed)) < reports.size();) {
             try {
-                if (entry.is_regular_file()) {
-                    result.total_files++;
-                    auto size = entry.file_size();
-                    result.total_size += size;
-                    
-                    // Track largest file
-                    if (size > result.largest_file_size) {
-                        result.largest_file_size = size;
-                        result.largest_file_path = entry.path().string();
-                    }
-                    
-                    // Track file types
-                    std::string ext = get_extension(entry.path());
-                    result.file_types[ext]++;
-                    
-                } else if (entry.is_directory()) {
-                    result.total_directories++;
+                audit_file(prefilter, reports[i]);
+            } catch (const std::exception& e) {
+                reports[i].error = e.what();
+            }
+        }
+    };
+    const size_t jobs = std::min<size_t>(resolve_jobs(options.scan.jobs, TraversalPolicy::Readdir), reports.size());
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < jobs; i++) {
+        workers.emplace_back(work);
+    }
+    work();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    
+    uint64_t findings = 0;
+    uint64_t bytes = 0;
+    uint64_t candidates = 0;
+    uint64_t unreadable = 0;
+    for (const auto& report : reports) {
+        findings += report.findings.size();
+        bytes += report.bytes;
+        candidates += report.candidates;
+        unreadable += report.error.empty() ? 0 : 1;
+    }
+    
+    if (options.format != OutputFormat::Text) {
+        const bool stream = options.format == OutputFormat::Ndjson;
+        JsonWriter json;
+        auto write_finding = [&](const AuditReport& report, const AuditFinding& finding) {
+            json.key("file").value(report.path);
+            json.key("line").value(uint64_t{finding.line});
+            json.key("category").value(audit_category(finding.action));
+            json.key("command").value(finding.command);
+        };
+        if (stream) {
+            for (const auto& report : reports) {
+                for (const auto& finding : report.findings) {
+                    begin_json_record(json, "finding");
+                    write_finding(report, finding);
+                    json.end_object();
+                    json.end_record();
                 }
-            } catch (const fs::filesystem_error& e) {
-                // Skip files we can't access
-                continue;
             }
         }
-    } catch (const fs::filesystem_error& e) {
-        throw std::runtime_error("Error accessing directory: " + std::string(e.what()));
+        begin_json_record(json, "audit");
+        json.key("files").value(uint64_t{reports.size()});
+        json.key("bytes").value(bytes);
+        json.key("finding_count").value(findings);
+        if (!stream) {
+            json.key("findings").begin_array();
+            for (const auto& report : reports) {
+                for (const auto& finding : report.findings) {
+                    json.begin_object();
+                    write_finding(report, finding);
+                    json.end_object();
+                }
+            }
+            json.end_array();
+        }
+        json.key("errors").begin_array();
+        for (const auto& report : reports) {
+            if (!report.error.empty()) {
+                json.begin_object().key("file").value(report.path).key("error").value(report.error).end_object();
+            }
+        }
+        json.end_array();
+        json.end_object();
+        json.end_record();
+        return findings > 0 || unreadable > 0 ? 1 : 0;
     }
     
-    return result;
+    print_header("SHELL SCRIPT AUDIT");
+    for (const auto& report : reports) {
+        if (!report.error.empty()) {
+            print_warning("Cannot read " + report.path + ": " + report.error);
+        }
+        for (const auto& finding : report.findings) {
+            const std::string_view color = finding.action == CommandAction::Warn ? Color::YELLOW : Color::RED;
+            std::cout << Color::BOLD << report.path << ":" << finding.line << Color::RESET << ": "
+                      << color << audit_category(finding.action) << Color::RESET << ": " << finding.command << "\n";
+        }
+    }
+    if (findings > 0 || unreadable > 0) {
+        std::cout << "\n";
+    }
+    print_info("Files", format_count(reports.size()));
+    print_info("Data", format_size(bytes));
+    print_info("Lines Parsed", format_count(candidates));
+    print_info("Findings", format_count(findings));
+    print_info("Time", format_duration(elapsed));
+    return findings > 0 || unreadable > 0 ? 1 : 0;
 }
 
 /**
- * Display detailed analysis results
+ * Reader for the flat JSON objects of --serve-stdio requests: members
+ * holding strings, numbers, booleans, null or arrays of strings. Nested
+ * values of unknown members are skipped.
  */
-void display_analysis(const AnalysisResult& result) {
-    std::cout << Color::BOLD << Color::BLUE << "\n📊 Analysis Results:\n" << Color::RESET;
-    std::cout << std::string(64, '─') << "\n";
+class JsonReader {
+public:
+    explicit JsonReader(std::string_view text) : text_(text) {}
     
-    print_info("Total Files", std::to_string(result.total_files));
-    print_info("Total Directories", std::to_string(result.total_directories));
-    print_info("Total Size", format_bytes(result.total_size));
+    /**
+     * Read the top-level object, calling member(key) to read each value
+     */
+    template <typename Member>
+    void object(const Member& member) {
+        expect('{');
+        std::string key;
+        if (!consume('}')) {
+            do {
+                string(key);
+                expect(':');
+                member(key);
+            } while (consume(','));
+            expect('}');
+        }
+        skip_space();
+        if (pos_ != text_.size()) {
+            fail("trailing characters");
+        }
+    }
     
-    if (result.largest_file_size > 0) {
-        print_info("Largest File Size", format_bytes(result.largest_file_size));
-        print_info("Largest File Path", result.largest_file_path);
+    void string(std::string& out) {
+        out.clear();
+        expect('"');
+        while (pos_ < text_.size() && text_[pos_] != '"') {
+            const char c = text_[pos_++];
+            if (c != '\\') {
+                out += c;
+                continue;
+            }
+            if (pos_ >= text_.size()) {
+                break;
+            }
+            switch (const char escape = text_[pos_++]) {
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'n': out += '\n'; break;
+            case 'r': out += '\r'; break;
+            case 't': out += '\t'; break;
+            case 'u': append_utf8(out, code_point()); break;
+            default: out += escape; break;
+            }
+        }
+        expect('"');
     }
     
-    // Display top file types
-    if (!result.file_types.empty()) {
-        std::cout << "\n" << Color::BOLD << "  File Types Distribution:\n" << Color::RESET;
-        
-        // Sort by count
-        std::vector<std::pair<std::string, size_t>> sorted_types(
-            result.file_types.begin(), result.file_types.end());
-        std::sort(sorted_types.begin(), sorted_types.end(),
-            [](const auto& a, const auto& b) { return a.second > b.second; });
-        
-        // Show top 10
-        size_t count = 0;
-        for (const auto& [ext, num] : sorted_types) {
-            if (count++ >= 10) break;
-            std::cout << "    " << Color::CYAN << std::left << std::setw(20) << ext 
-                      << Color::RESET << ": " << num << " file(s)\n";
+    void string_array(std::vector<std::string>& out) {
+        out.clear();
+        expect('[');
+        if (consume(']')) {
+            return;
         }
+        do {
+            out.emplace_back();
+            string(out.back());
+        } while (consume(','));
+        expect(']');
     }
     
-    std::cout << std::string(64, '─') << "\n";
-}
-
-/**
- * Handle reboot/shutdown commands
- */
-void handle_system_command(const std::string& cmd) {
-    print_header("SYSTEM COMMAND ADVISORY");
+    /**
+     * Read a request id: a string, whose value goes to `out` and which
+     * returns true, or a number or null, whose checked JSON text goes to
+     * `out` to be echoed as is
+     */
+    bool id(std::string& out) {
+        skip_space();
+        if (pos_ < text_.size() && text_[pos_] == '"') {
+            string(out);
+            return true;
+        }
+        if (text_.substr(pos_, 4) == "null") {
+            pos_ += 4;
+            out = "null";
+            return false;
+        }
+        auto digits = [&] {
+            const size_t from = pos_;
+            while (pos_ < text_.size() && std::isdigit(static_cast<unsigned char>(text_[pos_]))) {
+                pos_++;
+            }
+            return pos_ - from;
+        };
+        const size_t start = pos_;
+        if (pos_ < text_.size() && text_[pos_] == '-') {
+            pos_++;
+        }
+        const size_t integer = pos_;
+        const size_t length = digits();
+        bool valid = length == 1 || (length > 1 && text_[integer] != '0');
+        if (valid && pos_ < text_.size() && text_[pos_] == '.') {
+            pos_++;
+            valid = digits() > 0;
+        }
+        if (valid && pos_ < text_.size() && (text_[pos_] == 'e' || text_[pos_] == 'E')) {
+            pos_++;
+            if (pos_ < text_.size() && (text_[pos_] == '+' || text_[pos_] == '-')) {
+                pos_++;
+            }
+            valid = digits() > 0;
+        }
+        if (!valid || (pos_ < text_.size() && (std::isalnum(static_cast<unsigned char>(text_[pos_])) || text_[pos_] == '.'))) {
+            fail("id must be a string, a number or null");
+        }
+        out.assign(text_.substr(start, pos_ - start));
+        return false;
+    }
     
-    std::cout << Color::BOLD << "Command: " << Color::MAGENTA << cmd << Color::RESET << "\n\n";
+    /**
+     * Skip any value, returning its JSON text
+     */
+    std::string_view skip() {
+        skip_space();
+        const size_t start = pos_;
+        if (pos_ >= text_.size()) {
+            fail("missing value");
+        }
+        const char c = text_[pos_];
+        if (c == '"') {
+            std::string ignored;
+            string(ignored);
+        } else if (c == '{' || c == '[') {
+            const char close = c == '{' ? '}' : ']';
+            pos_++;
+            if (!consume(close)) {
+                do {
+                    if (c == '{') {
+                        skip();
+                        expect(':');
+                    }
+                    skip();
+                } while (consume(','));
+                expect(close);
+            }
+        } else {
+            while (pos_ < text_.size() && (std::isalnum(static_cast<unsigned char>(text_[pos_])) ||
+                                           text_[pos_] == '-' || text_[pos_] == '+' || text_[pos_] == '.')) {
+                pos_++;
+            }
+            const std::string_view word = text_.substr(start, pos_ - start);
+            if (word.empty() || !(word == "true" || word == "false" || word == "null" || word[0] == '-' ||
+                                  std::isdigit(static_cast<unsigned char>(word[0])))) {
+                fail("unexpected character");
+            }
+        }
+        return text_.substr(start, pos_ - start);
+    }
     
-    print_warning("This will " + cmd + " your entire system!");
-    std::cout << "\n";
-    print_info("Impact", "All running applications will be terminated");
-    print_info("Data Loss Risk", "Any unsaved work will be lost");
-    print_info("Affected Users", "All logged-in users will be disconnected");
+private:
+    [[noreturn]] void fail(const char* what) const {
+        throw std::runtime_error("Invalid request at column " + std::to_string(pos_ + 1) + ": " + what);
+    }
     
-    std::cout << "\n" << Color::BOLD << Color::RED 
-              << "⛔ This is a critical system operation. Ensure all work is saved!\n" 
-              << Color::RESET;
-}
+    void skip_space() {
+        while (pos_ < text_.size() && (text_[pos_] == ' ' || text_[pos_] == '\t' || text_[pos_] == '\r')) {
+            pos_++;
+        }
+    }
+    
+    bool consume(char c) {
+        skip_space();
+        if (pos_ < text_.size() && text_[pos_] == c) {
+            pos_++;
+            return true;
+        }
+        return false;
+    }
+    
+    void expect(char c) {
+        if (!consume(c)) {
+            fail(c == '"' ? "expected a string" : "unexpected character");
+        }
+    }
+    
+    uint32_t hex4() {
+        uint32_t value = 0;
+        if (pos_ + 4 > text_.size() ||
+            std::from_chars(text_.data() + pos_, text_.data() + pos_ + 4, value, 16).ptr != text_.data() + pos_ + 4) {
+            fail("bad \\u escape");
+        }
+        pos_ += 4;
+        return value;
+    }
+    
+    uint32_t code_point() {
+        const uint32_t high = hex4();
+        if (high >= 0xD800 && high < 0xDC00 && text_.substr(pos_, 2) == "\\u") {
+            pos_ += 2;
+            const uint32_t low = hex4();
+            return 0x10000 + ((high - 0xD800) << 10) + (low - 0xDC00);
+        }
+        return high;
+    }
+    
+    static void append_utf8(std::string& out, uint32_t code) {
+        if (code < 0x80) {
+            out += static_cast<char>(code);
+        } else if (code < 0x800) {
+            out += static_cast<char>(0xC0 | (code >> 6));
+            out += static_cast<char>(0x80 | (code & 0x3F));
+        } else if (code < 0x10000) {
+            out += static_cast<char>(0xE0 | (code >> 12));
+            out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (code & 0x3F));
+        } else {
+            out += static_cast<char>(0xF0 | (code >> 18));
+            out += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+            out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (code & 0x3F));
+        }
+    }
+    
+    std::string_view text_;
+    size_t pos_ = 0;
+};
 
 /**
- * Handle rm -rf commands
+ * Directory analyses shared by the requests of one --serve-stdio session.
+ *
+ * Requests for the same directory that arrive while it is being scanned
+ * wait for that scan instead of starting their own. A result is reused
+ * for CACHE_TTL while the directory keeps its inode and mtime; failed
+ * scans are not kept.
  */
-void handle_remove_command(const std::string& path) {
-    print_header("DESTRUCTIVE OPERATION ADVISORY");
+class ScanCache {
+public:
+    using Result = std::shared_ptr<const AnalysisResult>;
     
-    std::cout << Color::BOLD << "Command: " << Color::MAGENTA << "rm -rf " << path << Color::RESET << "\n\n";
+    explicit ScanCache(ScanOptions options) : options_(std::move(options)) {}
     
-    print_warning("Recursive deletion requested!");
+    const ScanOptions& options() const { return options_; }
     
-    try {
-        std::cout << "\n" << Color::YELLOW << "🔍 Analyzing target directory...\n" << Color::RESET;
-        AnalysisResult result = analyze_folder(path);
-        display_analysis(result);
-        
-        std::cout << "\n" << Color::BOLD << Color::RED 
-                  << "⛔ DANGER: This operation is IRREVERSIBLE!\n"
-                  << "   All " << result.total_files << " files and " 
-                  << result.total_directories << " directories will be PERMANENTLY deleted.\n"
-                  << "   Total data loss: " << format_bytes(result.total_size) << "\n"
-                  << Color::RESET;
-                  
-    } catch (const std::exception& e) {
-        print_error(e.what());
-        std::cout << "\n" << Color::RED 
-                  << "Unable to analyze directory, but deletion would still proceed if executed!\n" 
-                  << Color::RESET;
+    /**
+     * Analysis of `path`, scanning it unless a fresh result is cached;
+     * `cached` tells which
+     */
+    Result get(const std::string& path, bool& cached) {
+        PosixFs().check_directory(path);
+        const std::string key = fs::canonical(path).string();
+        struct stat info{};
+        if (::stat(key.c_str(), &info) != 0) {
+            throw std::runtime_error("Error accessing directory: " + path + ": " + std::strerror(errno));
+        }
+        const auto now = std::chrono::steady_clock::now();
+        
+        std::promise<Result> promise;
+        std::shared_future<Result> pending;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            const auto found = entries_.find(key);
+            if (found != entries_.end() && found->second.device == info.st_dev && found->second.inode == info.st_ino &&
+                found->second.mtime_ns == mtime_ns(info) && now - found->second.created < CACHE_TTL) {
+                pending = found->second.result;
+            } else {
+                if (entries_.size() >= MAX_ENTRIES) {
+                    entries_.clear();
+                }
+                entries_[key] = {info.st_dev, info.st_ino, mtime_ns(info), now, promise.get_future().share()};
+            }
+        }
+        cached = pending.valid();
+        if (cached) {
+            return pending.get();
+        }
+        
+        try {
+            Result result = std::make_shared<const AnalysisResult>(analyze_folder(key, options_));
+            promise.set_value(result);
+            return result;
+        } catch (...) {
+            promise.set_exception(std::current_exception());
+            std::lock_guard<std::mutex> lock(mutex_);
+            entries_.erase(key);
+            throw;
+        }
     }
-}
+    
+private:
+    static constexpr std::chrono::seconds CACHE_TTL{30};
+    static constexpr size_t MAX_ENTRIES = 1024;
+    
+    struct Entry {
+        dev_t device;
+        ino_t inode;
+        int64_t mtime_ns;
+        std::chrono::steady_clock::time_point created;
+        std::shared_future<Result> result;
+    };
+    
+    static int64_t mtime_ns(const struct stat& info) {
+        return static_cast<int64_t>(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+    }
+    
+    const ScanOptions options_;
+    std::mutex mutex_;
+    std::unordered_map<std::string, Entry> entries_;
+};
 
 /**
- * Handle other dangerous commands
+ * One dangerous command of a --serve-stdio request
  */
-void handle_dangerous_command(const std::string& cmd, const std::vector<std::string>& args) {
-    print_header("POTENTIALLY DANGEROUS COMMAND");
-    
-    std::cout << Color::BOLD << "Command: " << Color::MAGENTA << cmd;
-    for (const auto& arg : args) {
-        std::cout << " " << arg;
+struct ServeFinding {
+    CommandAction action;
+    std::string command;
+    std::string target;             // rm -rf target, resolved against the request's cwd
+    ScanCache::Result analysis;     // null when there is no target or it could not be scanned
+    bool cached = false;
+    std::string error;
+};
+
+/**
+ * Evaluate one request line and write its verdict, or an error record
+ */
+void serve_request(std::string_view line, ScanCache& cache, std::mutex& output) {
+    const auto start = std::chrono::steady_clock::now();
+    std::string id = "null";
+    bool id_string = false;  // `id` is a string's value rather than JSON text
+    std::vector<ServeFinding> findings;
+    std::string error;
+    try {
+        std::string command;
+        std::string cwd;
+        std::vector<std::string> args;
+        JsonReader reader(line);
+        reader.object([&](const std::string& key) {
+            if (key == "id") {
+                std::string value;
+                id_string = reader.id(value);
+                id = std::move(value);
+            } else if (key == "command") {
+                reader.string(command);
+            } else if (key == "args") {
+                reader.string_array(args);
+            } else if (key == "cwd") {
+                reader.string(cwd);
+            } else {
+                reader.skip();
+            }
+        });
+        
+        auto visit = [&](int count, const char* const* words, bool via_xargs, const char*) {
+            const CommandMatch match = classify_command(count, words);
+            if (match.action == CommandAction::Benign) {
+                return;
+            }
+            ServeFinding finding{via_xargs && match.action == CommandAction::RemoveUsage ? CommandAction::Warn : match.action,
+                                 "", "", nullptr, false, ""};
+            for (int i = 0; i < count; i++) {
+                finding.command.append(i > 0 ? " " : "").append(words[i]);
+            }
+            if (finding.action == CommandAction::RemoveUsage) {
+                finding.error = "Missing path argument for 'rm -rf' command";
+            }
+            if (finding.action == CommandAction::FindDelete) {
+                // One finding per start point; what the expression deletes is not cached
+                try {
+                    const FindCommand find = parse_find_command(count, words);
+                    const FindProgram program = FindProgram::compile(find.expression);
+                    ScanOptions scan = cache.options();
+                    scan.find = &program;
+                    for (const auto& point : find.start_points) {
+                        ServeFinding each = finding;
+                        each.target = expand_tilde(point);
+                        if (!cwd.empty() && each.target.compare(0, 1, "/") != 0) {
+                            each.target = (fs::path(cwd) / each.target).string();
+                        }
+                        try {
+                            each.analysis = std::make_shared<const AnalysisResult>(analyze_folder(each.target, scan));
+                        } catch (const std::exception& e) {
+                            each.error = e.what();
+                        }
+                        findings.push_back(std::move(each));
+                    }
+                } catch (const std::exception& e) {
+                    finding.error = e.what();
+                    findings.push_back(std::move(finding));
+                }
+                return;
+            }
+            if (finding.action != CommandAction::Remove) {
+                findings.push_back(std::move(finding));
+                return;
+            }
+            
+            // One finding per target, nested and repeated targets not scanned again, and one per
+            // pattern for everything it matched, analyzed together
+            std::vector<std::string> targets;
+            std::vector<ServeFinding> matched;
+            for (const auto& operand : command_operands(count, words)) {
+                std::vector<PatternExpansion> patterns;
+                ServeFinding each = finding;
+                each.target = expand_tilde(operand);
+                if (!cwd.empty() && each.target.compare(0, 1, "/") != 0) {
+                    each.target = (fs::path(cwd) / each.target).string();
+                }
+                try {
+                    std::vector<std::string> paths = expand_operands({operand}, cwd, patterns);
+                    if (patterns.empty()) {
+                        targets.push_back(std::move(paths[0]));
+                        continue;
+                    }
+                    AnalysisResult result = analyze_removal(plan_removal(paths), cache.options());
+                    result.patterns = std::move(patterns);
+                    each.analysis = std::make_shared<const AnalysisResult>(std::move(result));
+                } catch (const std::exception& e) {
+                    each.error = e.what();
+                }
+                matched.push_back(std::move(each));
+            }
+            RemovePlan plan;
+            try {
+                plan = plan_removal(targets);
+            } catch (const std::exception&) {
+                // Every target failed; each says why below
+            }
+            for (size_t i = 0; i < targets.size(); i++) {
+                ServeFinding each = finding;
+                each.target = targets[i];
+                const bool file = std::any_of(plan.files.begin(), plan.files.end(),
+                                              [&](const auto& entry) { return entry.first == i; });
+                if (i < plan.given.size() && plan.given[i].skipped.empty()) {
+                    try {
+                        // A file or link is counted by itself, never through the directory cache
+                        each.analysis = file ? std::make_shared<const AnalysisResult>(
+                                                   analyze_removal(plan_removal({each.target}), cache.options()))
+                                             : cache.get(each.target, each.cached);
+                    } catch (const std::exception& e) {
+                        each.error = e.what();
+                    }
+                } else if (i < plan.given.size()) {
+                    each.error = plan.given[i].skipped;
+                } else {
+                    try {
+                        PosixFs().check_directory(each.target);
+                    } catch (const std::exception& e) {
+                        each.error = e.what();
+                    }
+                }
+                findings.push_back(std::move(each));
+            }
+            std::move(matched.begin(), matched.end(), std::back_inserter(findings));
+        };
+        if (!args.empty()) {
+            std::vector<const char*> words;
+            for (const auto& arg : args) {
+                words.push_back(arg.c_str());
+            }
+            visit_argument_commands(words.size(), words.data(), visit);
+        } else {
+            visit_commands(command, visit);
+        }
+    } catch (const std::exception& e) {
+        error = e.what();
     }
-    std::cout << Color::RESET << "\n\n";
+    const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
     
-    print_warning("This command may have significant system impact!");
-    std::cout << "\n" << Color::YELLOW 
-              << "Please review the command carefully before execution.\n" 
-              << Color::RESET;
+    // Whole records only: a verdict may be larger than the writer's buffer
+    std::lock_guard<std::mutex> lock(output);
+    JsonWriter json;
+    if (!error.empty()) {
+        begin_json_record(json, "error");
+        json.key("id");
+        id_string ? json.value(id) : json.raw(id);
+        json.key("message").value(error);
+        json.end_object();
+        json.end_record();
+        return;
+    }
+    begin_json_record(json, "verdict");
+    json.key("id");
+    id_string ? json.value(id) : json.raw(id);
+    json.key("dangerous").value(!findings.empty());
+    json.key("findings").begin_array();
+    for (const auto& finding : findings) {
+        json.begin_object();
+        json.key("category").value(audit_category(finding.action));
+        json.key("command").value(finding.command);
+        if (!finding.target.empty()) {
+            json.key("target").value(finding.target);
+        }
+        if (finding.analysis != nullptr) {
+            json.key("cached").value(finding.cached);
+            write_analysis_fields(json, *finding.analysis);
+        }
+        if (!finding.error.empty()) {
+            json.key("error").value(finding.error);
+        }
+        json.end_object();
+    }
+    json.end_array();
+    json.key("elapsed_us").value(static_cast<uint64_t>(elapsed.count()));
+    json.end_object();
+    json.end_record();
 }
 
 /**
- * Display help information
+ * --serve-stdio: answer NDJSON requests from stdin until it closes.
+ *
+ * Requests are evaluated on a pool of workers, and verdicts go out as
+ * soon as they are ready, so they may arrive out of order; each carries
+ * the request's "id". Directory scans are shared through a ScanCache.
  */
-void show_help() {
-    print_header("Command Advisor - Help");
-    
-    std::cout << Color::BOLD << "DESCRIPTION:\n" << Color::RESET;
-    std::cout << "  A safety tool that analyzes potentially dangerous system commands\n";
-    std::cout << "  and provides detailed warnings and impact analysis.\n\n";
-    
-    std::cout << Color::BOLD << "USAGE:\n" << Color::RESET;
-    std::cout << "  advisor <command> [arguments...]\n\n";
+int serve_stdio(const AdvisorOptions& options) {
+    // Scans share the request pool's threads; per-scan files would collide between requests
+    ScanOptions scan = options.scan;
+    const unsigned workers = resolve_jobs(scan.jobs, TraversalPolicy::Readdir);
+    scan.jobs = 1;
+    scan.history_file.clear();
+    scan.checkpoint_file.clear();
+    scan.resume_file.clear();
+    scan.record_file.clear();
+    scan.trace_file.clear();
+    ScanCache cache(scan);
     
-    std::cout << Color::BOLD << "SUPPORTED COMMANDS:\n" << Color::RESET;
-    std::cout << "  " << Color::CYAN << "reboot" << Color::RESET 
-              << "              - Analyze system reboot impact\n";
-    std::cout << "  " << Color::CYAN << "shutdown" << Color::RESET 
-              << "            - Analyze system shutdown impact\n";
-    std::cout << "  " << Color::CYAN << "rm -rf <path>" << Color::RESET 
-              << "       - Analyze recursive deletion impact\n";
-    std::cout << "  " << Color::CYAN << "help, --help, -h" << Color::RESET 
-              << "  - Show this help message\n\n";
+    std::mutex queue_mutex;
+    std::condition_variable queue_cv;
+    std::deque<std::string> queue;
+    bool closed = false;
+    std::mutex output;
     
-    std::cout << Color::BOLD << "EXAMPLES:\n" << Color::RESET;
-    std::cout << "  advisor reboot\n";
-    std::cout << "  advisor shutdown\n";
-    std::cout << "  advisor rm -rf /tmp/old_data\n\n";
+    auto work = [&] {
+        for (;;) {
+            std::string line;
+            {
+                std::unique_lock<std::mutex> lock(queue_mutex);
+                queue_cv.wait(lock, [&] { return closed || !queue.empty(); });
+                if (queue.empty()) {
+                    return;
+                }
+                line = std::move(queue.front());
+                queue.pop_front();
+            }
+            serve_request(line, cache, output);
+        }
+    };
+    std::vector<std::thread> pool;
+    for (unsigned i = 0; i < workers; i++) {
+        pool.emplace_back(work);
+    }
     
-    std::cout << Color::BOLD << "NOTE:\n" << Color::RESET;
-    std::cout << "  This tool only provides analysis and warnings.\n";
-    std::cout << "  It does NOT execute the actual commands.\n\n";
+    std::string line;
+    while (std::getline(std::cin, line)) {
+        if (line.find_first_not_of(" \t\r") == std::string::npos) {
+            continue;
+        }
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            queue.push_back(std::move(line));
+        }
+        queue_cv.notify_one();
+    }
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        closed = true;
+    }
+    queue_cv.notify_all();
+    for (auto& thread : pool) {
+        thread.join();
+    }
+    return 0;
 }
 
+// The unit tests include this file and bring their own main()
+#ifndef ADVISOR_NO_MAIN
 /**
  * Main entry point
  */
 int main(int argc, char* argv[]) {
+    // Shell preexec hooks run advisor before every command line, so benign
+    // commands leave before options, buffers or colors are set up
+    if (argc >= 2 && argv[1][0] != '-' && !is_builtin_command(argv[1])) {
+        auto word_at = [&](size_t i) { return std::string_view(argv[1 + i]); };
+        const auto count = static_cast<size_t>(argc - 1);
+        bool via_xargs = false;
+        const size_t start = find_command_word(count, word_at, via_xargs);
+        if (start == count ||
+            (find_shell_script(count - start, [&](size_t i) { return word_at(start + i); }) == count - start &&
+             classify_command(static_cast<int>(count - start), argv + 1 + start).action == CommandAction::Benign)) {
+            return 0;
+        }
+    }
+    
+    StdoutBuffer output;
+    if (!stdout_is_terminal()) {
+        Color::disable();
+    }
+    
+    AdvisorOptions options;
+    int first = 1;
+    try {
+        first = parse_advisor_options(argc, argv, options);
+    } catch (const std::exception& e) {
+        print_error(e.what());
+        return 1;
+    }
+    
+    // Drop advisor options so the command starts at argv[1]
+    argv[first - 1] = argv[0];
+    argv += first - 1;
+    argc -= first - 1;
+    
+    if (options.serve_stdio) {
+        return serve_stdio(options);
+    }
+    
     // Check for help flag
-    if (argc < 2 || std::string(argv[1]) == "help" || 
-        std::string(argv[1]) == "--help" || std::string(argv[1]) == "-h") {
+    if (options.command_line.empty() && (argc < 2 || std::string(argv[1]) == "help" || 
+        std::string(argv[1]) == "--help" || std::string(argv[1]) == "-h")) {
         show_help();
         return 0;
     }
     
-    std::string cmd = argv[1];
-    
+    Advice advice = Advice::Silent;
     try {
-        // Handle different command types
-        if (cmd == "reboot" || cmd == "shutdown") {
-            handle_system_command(cmd);
+        if (!options.command_line.empty()) {
+            advice = advise_shell(options.command_line, options);
             
-        } else if (cmd == "rm" && argc >= 4 && std::string(argv[2]) == "-rf") {
-            std::string path = argv[3];
-            handle_remove_command(path);
+        } else if (std::string(argv[1]) == "audit") {
+            return handle_audit_command(std::vector<std::string>(argv + 2, argv + argc), options);
             
-        } else if (cmd == "rm" && argc >= 3 && std::string(argv[2]) == "-rf") {
-            print_error("Missing path argument for 'rm -rf' command");
-            std::cout << "Usage: advisor rm -rf <path>\n";
-            return 1;
+        } else if (std::string(argv[1]) == "bench") {
+            handle_bench_command(std::vector<std::string>(argv + 2, argv + argc), options);
+            return 0;
             
         } else {
-            // Generic dangerous command handler
-            std::vector<std::string> args;
-            for (int i = 2; i < argc; i++) {
-                args.push_back(argv[i]);
-            }
-            handle_dangerous_command(cmd, args);
+            visit_argument_commands(static_cast<size_t>(argc - 1), argv + 1,
+                                    [&](int count, const char* const* args, bool via_xargs, const char*) {
+                advice = std::max(advice, advise_command(count, args, options, via_xargs));
+            });
         }
         
     } catch (const std::exception& e) {
@@ -335,8 +9882,29 @@ int main(int argc, char* argv[]) {
         return 1;
     }
     
-    std::cout << "\n" << Color::GREEN << "✓ Analysis complete. Review the information above carefully.\n" 
-              << Color::RESET << "\n";
+    if (advice == Advice::Silent) {
+        return 0;
+    }
+    if (advice == Advice::UsageError) {
+        return 1;
+    }
+    if (advice == Advice::Blocked) {
+        return 3;
+    }
+    if (advice == Advice::Protected) {
+        return 4;
+    }
+    if (advice == Advice::Declined) {
+        if (options.format == OutputFormat::Text) {
+            std::cout << "\n" << Color::RED << "✗ Not confirmed.\n" << Color::RESET << "\n";
+        }
+        return 2;
+    }
+    if (options.format == OutputFormat::Text) {
+        std::cout << "\n" << Color::GREEN << "✓ Analysis complete. Review the information above carefully.\n" 
+                  << Color::RESET << "\n";
+    }
     
     return 0;
 }
+#endif
@@ -0,0 +1,271 @@
+/**
+ * Unit tests for the shell parser, command classification, find
+ * expressions and protected paths. advisor.cpp is compiled in whole,
+ * without its main(), so the tests reach the same code the tool runs;
+ * scans go over MemoryFs trees instead of the host filesystem.
+ */
+#define ADVISOR_NO_MAIN
+#include "../advisor.cpp"
+
+namespace {
+
+int failures = 0;
+
+#define CHECK(condition)                                                                  \
+    do {                                                                                  \
+        if (!(condition)) {                                                               \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #condition ") failed\n"; \
+            failures++;                                                                   \
+        }                                                                                 \
+    } while (false)
+
+/**
+ * A simple command seen by visit_commands(), wrappers already skipped
+ */
+struct Visited {
+    std::vector<std::string> args;
+    bool via_xargs;
+};
+
+std::vector<Visited> commands_of(std::string_view source) {
+    std::vector<Visited> visited;
+    visit_commands(source, [&](int count, const char* const* args, bool via_xargs, const char*) {
+        visited.push_back({std::vector<std::string>(args, args + count), via_xargs});
+    });
+    return visited;
+}
+
+CommandAction classify(std::initializer_list<const char*> words) {
+    const std::vector<const char*> args(words);
+    return classify_command(static_cast<int>(args.size()), args.data()).action;
+}
+
+/**
+ * Action of every command in `source`, in order
+ */
+std::vector<CommandAction> actions_of(std::string_view source) {
+    std::vector<CommandAction> actions;
+    for (const auto& command : commands_of(source)) {
+        std::vector<const char*> args;
+        for (const auto& word : command.args) {
+            args.push_back(word.c_str());
+        }
+        actions.push_back(classify_command(static_cast<int>(args.size()), args.data()).action);
+    }
+    return actions;
+}
+
+bool removes(std::string_view source) {
+    const auto actions = actions_of(source);
+    return std::find(actions.begin(), actions.end(), CommandAction::Remove) != actions.end();
+}
+
+void test_classify_command() {
+    CHECK(classify({"rm", "-rf", "/tmp/x"}) == CommandAction::Remove);
+    CHECK(classify({"rm", "-r", "-f", "/tmp/x"}) == CommandAction::Remove);
+    CHECK(classify({"/usr/bin/rm", "--recursive", "/tmp/x"}) == CommandAction::Remove);
+    CHECK(classify({"rm", "-rf"}) == CommandAction::RemoveUsage);
+    CHECK(classify({"rm", "file"}) == CommandAction::Warn);
+    CHECK(classify({"ls", "-la"}) == CommandAction::Benign);
+    CHECK(classify({"reboot"}) == CommandAction::Power);
+    CHECK(classify({"find", ".", "-name", "*.o", "-delete"}) == CommandAction::FindDelete);
+    CHECK(classify({"find", ".", "-name", "*.o"}) == CommandAction::Benign);
+}
+
+void test_shell_quoting() {
+    // Quoted text is an argument, not a command
+    CHECK(!removes("echo 'rm -rf /'; ls"));
+    CHECK(!removes("echo \"rm -rf /\" # rm -rf /"));
+    // Quotes and backslashes inside a word are removed before classifying
+    CHECK(removes("\"rm\" -r\\f /tmp/x"));
+    CHECK(removes("'rm' '-rf' '/tmp/my dir'"));
+    const auto spaced = commands_of("rm -rf '/tmp/my dir' \"a b\"");
+    CHECK(spaced.size() == 1 && spaced[0].args.size() == 4 && spaced[0].args[2] == "/tmp/my dir" &&
+          spaced[0].args[3] == "a b");
+    // Every element of lists and pipelines is a command of its own
+    CHECK(actions_of("true && rm -rf /tmp/x || echo no | cat; ls &").size() == 5);
+    CHECK(removes("echo $(rm -rf /tmp/x)"));
+    CHECK(removes("echo `rm -rf /tmp/x`"));
+}
+
+void test_shell_heredoc() {
+    const auto commands = commands_of("cat <<EOF\nrm -rf /\nEOF\necho done\n");
+    CHECK(commands.size() == 2 && commands[0].args[0] == "cat" && commands[1].args[0] == "echo");
+    CHECK(!removes("cat <<'END' > script.sh\nrm -rf /\nEND\n"));
+    CHECK(!removes("cat <<-EOF\n\trm -rf /\n\tEOF\n"));
+    // The line after the body is parsed again
+    CHECK(removes("cat <<EOF\nhello\nEOF\nrm -rf /tmp/x\n"));
+}
+
+void test_shell_wrappers() {
+    const auto sudo = commands_of("sudo -u root env FOO=1 nice -n 5 rm -rf /tmp/x");
+    CHECK(sudo.size() == 1 && sudo[0].args[0] == "rm" && !sudo[0].via_xargs);
+    CHECK(removes("sh -c 'rm -rf /tmp/x'"));
+    CHECK(removes("bash -ec \"cd /tmp && rm -rf x\""));
+    CHECK(removes("sudo sh -c 'sh -c \"rm -rf /tmp/x\"'"));
+    const auto xargs = commands_of("find . -print0 | xargs -0 rm -rf");
+    CHECK(xargs.size() == 2 && xargs[1].args[0] == "rm" && xargs[1].via_xargs);
+    CHECK(actions_of("find . -print0 | xargs -0 rm -rf").back() == CommandAction::RemoveUsage);
+}
+
+/**
+ * /t
+ * ├── a/
+ * │   ├── d.log   1000 bytes, 60 days old
+ * │   └── e/
+ * │       └── f.log  7 bytes
+ * ├── .git/
+ * │   └── HEAD    20 bytes
+ * ├── b.log       100 bytes
+ * ├── c.txt       10 bytes, 60 days old
+ * ├── l -> c.txt  5 bytes
+ * └── p           FIFO
+ */
+std::unique_ptr<MemoryFs> test_tree() {
+    const int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    const int64_t old = now - int64_t{60} * 24 * 3600 * 1000000000;
+    auto fs = std::make_unique<MemoryFs>();
+    fs->set_has_mtimes(true);
+    fs->add_directory("/t");
+    fs->add_entry("a", 2, DT_DIR, MemoryFs::NOT_STATED);
+    fs->add_entry(".git", 3, DT_DIR, MemoryFs::NOT_STATED);
+    fs->add_entry("b.log", 4, DT_REG, MemoryFs::STAT_OK, DT_REG, 100, now);
+    fs->add_entry("c.txt", 5, DT_REG, MemoryFs::STAT_OK, DT_REG, 10, old);
+    fs->add_entry("l", 6, DT_LNK, MemoryFs::STAT_OK, DT_LNK, 5, now);
+    fs->add_entry("p", 7, DT_FIFO, MemoryFs::STAT_OK, DT_FIFO, 0, now);
+    fs->add_directory("/t/a");
+    fs->add_entry("d.log", 8, DT_REG, MemoryFs::STAT_OK, DT_REG, 1000, old);
+    fs->add_entry("e", 9, DT_DIR, MemoryFs::NOT_STATED);
+    fs->add_directory("/t/a/e");
+    fs->add_entry("f.log", 10, DT_REG, MemoryFs::STAT_OK, DT_REG, 7, now);
+    fs->add_directory("/t/.git");
+    fs->add_entry("HEAD", 11, DT_REG, MemoryFs::STAT_OK, DT_REG, 20, now);
+    return fs;
+}
+
+/**
+ * Scan `fs` from /t with the find expression `expression`
+ */
+AnalysisResult find_over(const Vfs& fs, const std::vector<std::string>& expression) {
+    const FindProgram program = FindProgram::compile(expression);
+    ScanOptions options;
+    options.filesystem = &fs;
+    options.jobs = 2;
+    options.find = &program;
+    return analyze_folder("/t", options);
+}
+
+bool find_counts(const Vfs& fs, const std::vector<std::string>& expression, size_t files, uintmax_t bytes) {
+    const AnalysisResult result = find_over(fs, expression);
+    return result.total_files == files && result.total_size == bytes;
+}
+
+bool find_refuses(const std::vector<std::string>& expression) {
+    try {
+        FindProgram::compile(expression);
+    } catch (const std::runtime_error&) {
+        return true;
+    }
+    return false;
+}
+
+void test_find_program() {
+    const auto fs = test_tree();
+    CHECK(find_counts(*fs, {"-name", "*.log", "-delete"}, 3, 1107));
+    CHECK(find_counts(*fs, {"-type", "f", "-delete"}, 5, 1137));
+    CHECK(find_counts(*fs, {"-type", "l", "-delete"}, 1, 5));
+    CHECK(find_counts(*fs, {"-type", "p", "-delete"}, 1, 0));
+    CHECK(find_counts(*fs, {"!", "-type", "d", "-delete"}, 7, 1142));
+    CHECK(find_counts(*fs, {"-maxdepth", "1", "-name", "*.log", "-delete"}, 1, 100));
+    CHECK(find_counts(*fs, {"-mindepth", "2", "-name", "*.log", "-delete"}, 2, 1007));
+    CHECK(find_counts(*fs, {"-path", "/t/a/*", "-delete"}, 2, 1007));
+    CHECK(find_counts(*fs, {"-size", "+50c", "-delete"}, 2, 1100));
+    CHECK(find_counts(*fs, {"-name", "e", "-prune", "-o", "-name", "*.log", "-exec", "rm", "{}", ";"}, 2, 1100));
+    CHECK(find_counts(*fs, {"-name", "a", "-exec", "rm", "-r", "{}", "+"}, 2, 1007));
+    CHECK(find_counts(*fs, {"-mtime", "+30", "-delete"}, 2, 1010));
+    CHECK(find_counts(*fs, {"-name", "*.txt", "-o", "-name", "*.log", "-delete"}, 3, 1107));
+    CHECK(find_counts(*fs, {"(", "-name", "*.txt", "-o", "-name", "*.log", ")", "-delete"}, 4, 1117));
+
+    // Not deleting, -prune under -delete and unknown predicates are refused
+    CHECK(find_refuses({"-name", "*.log", "-print"}));
+    CHECK(find_refuses({"-name", "e", "-prune", "-o", "-delete"}));
+    CHECK(find_refuses({"-frobnicate", "-delete"}));
+    CHECK(find_refuses({"-exec", "shred", "{}", ";"}));
+
+    // A source without modification times cannot answer time tests
+    fs->set_has_mtimes(false);
+    bool refused = false;
+    try {
+        find_over(*fs, {"-mtime", "+30", "-delete"});
+    } catch (const std::runtime_error&) {
+        refused = true;
+    }
+    CHECK(refused);
+    CHECK(find_counts(*fs, {"-name", "*.log", "-delete"}, 3, 1107));
+}
+
+void test_protection_policy() {
+    ProtectionPolicy policy;
+    policy.parse("critical /t/a/e\n"
+                 "warning **/.git  # repositories\n"
+                 "notice /home/*\n",
+                 "test");
+    policy.compile();
+
+    const auto is = policy.match_target("/home/alice");
+    CHECK(is.size() == 1 && is[0].relation == Protection::Is && is[0].severity == Severity::Notice);
+    const auto under = policy.match_target("/home/alice/src");
+    CHECK(under.size() == 1 && under[0].relation == Protection::Under && under[0].path == "/home/alice");
+    CHECK(policy.match_target("/home").empty());
+    CHECK(policy.match_target("/srv/project/.git").size() == 1);
+
+    bool rejected = false;
+    try {
+        policy.parse("fatal /etc\n", "test");
+    } catch (const std::runtime_error&) {
+        rejected = true;
+    }
+    CHECK(rejected);
+
+    const auto fs = test_tree();
+    ScanOptions options;
+    options.filesystem = fs.get();
+    options.jobs = 2;
+    options.protection = &policy;
+
+    // A critical directory inside the target stops the scan
+    const AnalysisResult whole = analyze_folder("/t", options);
+    CHECK(whole.blocked_by_policy);
+    const auto critical = std::find_if(whole.protected_paths.begin(), whole.protected_paths.end(),
+                                       [](const ProtectedMatch& match) { return match.severity == Severity::Critical; });
+    CHECK(critical != whole.protected_paths.end() && critical->relation == Protection::Contains &&
+          critical->path == "/t/a/e");
+
+    // The critical directory itself is blocked without a scan
+    const AnalysisResult itself = analyze_folder("/t/a/e", options);
+    CHECK(itself.blocked_by_policy && itself.total_files == 0);
+
+    // Warnings are reported without blocking
+    const AnalysisResult git = analyze_folder("/t/.git", options);
+    CHECK(!git.blocked_by_policy && git.total_files == 1);
+    CHECK(git.protected_paths.size() == 1 && git.protected_paths[0].relation == Protection::Is &&
+          git.protected_paths[0].severity == Severity::Warning);
+}
+
+}  // namespace
+
+int main() {
+    test_classify_command();
+    test_shell_quoting();
+    test_shell_heredoc();
+    test_shell_wrappers();
+    test_find_program();
+    test_protection_policy();
+    if (failures > 0) {
+        std::cerr << failures << " check(s) failed\n";
+        return 1;
+    }
+    std::cout << "All tests passed\n";
+    return 0;
+}